@@ -0,0 +1,72 @@
+#ifndef BF_ALIGNED_ALLOCATOR_HPP
+#define BF_ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace bf {
+
+/// The size of a cache line in bytes.
+constexpr size_t cache_line_size = 64;
+
+/// An allocator that returns storage aligned at a given boundary, by default
+/// at cache-line granularity.
+/// @tparam T The value type.
+/// @tparam Alignment The alignment in bytes, a power of two.
+template <typename T, size_t Alignment = cache_line_size>
+class aligned_allocator
+{
+public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind
+  {
+    typedef aligned_allocator<U, Alignment> other;
+  };
+
+  aligned_allocator() = default;
+
+  template <typename U>
+  aligned_allocator(aligned_allocator<U, Alignment> const&)
+  {
+  }
+
+  T* allocate(size_t n)
+  {
+    if (n > max_size())
+      throw std::bad_alloc{};
+    auto size = n * sizeof(T);
+    void* p = nullptr;
+    if (posix_memalign(&p, Alignment, size ? size : 1) != 0)
+      throw std::bad_alloc{};
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p, size_t)
+  {
+    std::free(p);
+  }
+
+  size_t max_size() const
+  {
+    return static_cast<size_t>(-1) / sizeof(T);
+  }
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(aligned_allocator<T, A> const&, aligned_allocator<U, A> const&)
+{
+  return true;
+}
+
+template <typename T, typename U, size_t A>
+bool operator!=(aligned_allocator<T, A> const&, aligned_allocator<U, A> const&)
+{
+  return false;
+}
+
+} // namespace bf
+
+#endif
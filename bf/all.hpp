@@ -3,8 +3,20 @@
 
 #include "bf/bloom_filter/a2.hpp"
 #include "bf/bloom_filter/basic.hpp"
+#include "bf/bloom_filter/binary_fuse.hpp"
+#include "bf/bloom_filter/blocked.hpp"
 #include "bf/bloom_filter/bitwise.hpp"
+#include "bf/bloom_filter/concurrent.hpp"
+#include "bf/bloom_filter/count_min.hpp"
 #include "bf/bloom_filter/counting.hpp"
+#include "bf/bloom_filter/cuckoo.hpp"
+#include "bf/bloom_filter/quotient.hpp"
+#include "bf/bloom_filter/ribbon.hpp"
+#include "bf/bloom_filter/scalable.hpp"
+#include "bf/bloom_filter/sharded.hpp"
+#include "bf/bloom_filter/split_block.hpp"
 #include "bf/bloom_filter/stable.hpp"
+#include "bf/container.hpp"
+#include "bf/mapped_file.hpp"
 
 #endif
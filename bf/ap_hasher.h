@@ -76,4 +76,7 @@ private:
     0xF874B172, 0x0CF914D5, 0x784D3280, 0x4E8CFEBC, 0xC569F575, 0xCDB2A091,
     0x2CC016B4, 0x5C5F4421};
 };
+
+template <typename T>
+constexpr T APHahser<T>::predef_salt[APHahser<T>::predef_salt_count];
 } // namespace bf
\ No newline at end of file
@@ -3,12 +3,22 @@
 
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <string>
 #include <vector>
+#include <bf/aligned_allocator.hpp>
+#include <bf/span.hpp>
 
 namespace bf {
 
-/// A vector of bits.
+class container_reader;
+class container_writer;
+
+/// A vector of bits. The underlying blocks start at a cache-line boundary.
+///
+/// A bit vector can also *view* blocks that it does not own, such as a
+/// memory-mapped file. Views share their blocks on copy and copy them into
+/// owned storage before the first modification.
 class bitvector
 {
   friend std::string to_string(bitvector const&, bool, size_t);
@@ -68,6 +78,15 @@ public:
     num_bits_ = bits_.size() * bits_per_block;
   }
 
+  /// Constructs a read-only view of external blocks without copying them.
+  /// @param blocks The first of `bits_to_blocks(size)` blocks, whose unused
+  /// bits in the last block must be 0.
+  /// @param size The number of bits.
+  /// @param owner Keeps *blocks* alive as long as any view refers to them.
+  /// @pre *blocks* is aligned for `block_type`.
+  bitvector(block_type const* blocks, size_type size,
+            std::shared_ptr<void const> owner);
+
   /// Copy-constructs a bit vector.
   /// @param other The bit vector to copy.
   bitvector(bitvector const& other);
@@ -95,6 +114,25 @@ public:
   bitvector& operator|=(bitvector const& other);
   bitvector& operator^=(bitvector const& other);
   bitvector& operator-=(bitvector const& other);
+
+  /// ORs several bit vectors into this one on several threads. Each thread
+  /// owns a contiguous range of blocks and combines it with all bit vectors
+  /// a cache-sized chunk at a time, so that each block of `*this` passes
+  /// through memory once, no matter how many bit vectors there are.
+  /// @param others The bit vectors to merge.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return A reference to `*this`.
+  /// @pre All bit vectors in *others* have the same size as `*this`.
+  bitvector& merge(span<bitvector const* const> others, size_t threads = 0);
+
+  /// ANDs several bit vectors into this one on several threads, like
+  /// merge().
+  /// @param others The bit vectors to intersect with.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return A reference to `*this`.
+  /// @pre All bit vectors in *others* have the same size as `*this`.
+  bitvector& intersect(span<bitvector const* const> others,
+                       size_t threads = 0);
   friend bitvector operator&(bitvector const& x, bitvector const& y);
   friend bitvector operator|(bitvector const& x, bitvector const& y);
   friend bitvector operator^(bitvector const& x, bitvector const& y);
@@ -129,6 +167,7 @@ public:
     if (first == last)
       return;
 
+    detach();
     auto excess = extra_bits();
     auto delta = std::distance(first, last);
     bits_.reserve(blocks() + delta);
@@ -203,11 +242,42 @@ public:
   /// @return A const-reference to the bit at position *i*.
   const_reference operator[](size_type i) const;
 
+  /// Hints the CPU to fetch the block of a bit into the cache, so that a
+  /// later access to it does not stall.
+  /// @param i The bit position.
+  void prefetch(size_type i) const
+  {
+    __builtin_prefetch(data() + block_index(i));
+  }
+
   /// Counts the number of 1-bits in the bit vector. Also known as *population
-  /// count* or *Hamming weight*.
+  /// count* or *Hamming weight*. Uses AVX2 or the POPCNT instruction if the
+  /// CPU supports them.
   /// @return The number of bits set to 1.
   size_type count() const;
 
+  /// Retrieves the underlying blocks. Bit *i* resides in block
+  /// `i / bits_per_block` at position `i % bits_per_block`, and the unused
+  /// bits of the last block are 0.
+  /// @return A pointer to the first of `blocks()` blocks.
+  block_type* data()
+  {
+    detach();
+    return bits_.data();
+  }
+
+  block_type const* data() const
+  {
+    return view_ ? view_ : bits_.data();
+  }
+
+  /// Checks whether the bit vector views external blocks.
+  /// @return `true` iff the bit vector has not copied the blocks it views.
+  bool is_view() const
+  {
+    return view_ != nullptr;
+  }
+
   /// Retrieves the number of blocks of the underlying storage.
   /// @param The number of blocks that represent `size()` bits.
   size_type blocks() const;
@@ -238,6 +308,25 @@ public:
   unsigned int serializedSize() const;
   int fromBuf(const char* buf, unsigned int len);
 
+  /// Deserializes a bit vector like `fromBuf`, but views the blocks in *buf*
+  /// instead of copying them if they are suitably aligned.
+  /// @param buf The serialized bit vector.
+  /// @param len The size of the serialized bit vector.
+  /// @param owner Keeps *buf* alive as long as any view refers to it.
+  /// @return 0 on success.
+  int viewBuf(const char* buf, unsigned int len,
+              std::shared_ptr<void const> owner);
+
+  /// Appends the blocks to a container without copying them.
+  /// @param w The container to append to.
+  void write(container_writer& w) const;
+
+  /// Reads the blocks from the next section of a container. Views them in
+  /// place if the container has an owner.
+  /// @param r The container to read from.
+  /// @return 0 on success.
+  int read(container_reader& r);
+
 private:
   /// Computes the block index for a given bit position.
   static size_type constexpr block_index(size_type i)
@@ -288,10 +377,38 @@ private:
   /// `bitvector::npos` if no 1-bit exists.
   size_type find_from(size_type i) const;
 
-  std::vector<block_type> bits_;
+  /// Copies viewed blocks into owned storage. Every modification calls this
+  /// first.
+  void detach();
+
+  std::vector<block_type, aligned_allocator<block_type>> bits_;
   size_type num_bits_;
+  block_type const* view_ = nullptr;
+  std::shared_ptr<void const> owner_;
 };
 
+/// Counts the 1-bits of `x & y` without materializing it.
+/// @param x The first bit vector.
+/// @param y The second bit vector.
+/// @return The number of positions where both *x* and *y* have a 1-bit.
+/// @pre `x.size() == y.size()`
+bitvector::size_type count_and(bitvector const& x, bitvector const& y);
+
+/// Counts the 1-bits of `x | y` without materializing it.
+/// @param x The first bit vector.
+/// @param y The second bit vector.
+/// @return The number of positions where *x* or *y* has a 1-bit.
+/// @pre `x.size() == y.size()`
+bitvector::size_type count_or(bitvector const& x, bitvector const& y);
+
+/// Counts the 1-bits of `x ^ y` without materializing it, i.e., the Hamming
+/// distance of *x* and *y*.
+/// @param x The first bit vector.
+/// @param y The second bit vector.
+/// @return The number of positions where *x* and *y* differ.
+/// @pre `x.size() == y.size()`
+bitvector::size_type count_xor(bitvector const& x, bitvector const& y);
+
 /// Converts a bitvector to a `std::string`.
 ///
 /// @param b The bitvector to convert.
@@ -1,10 +1,15 @@
 #ifndef BF_BLOOM_FILTER_HPP
 #define BF_BLOOM_FILTER_HPP
 
+#include <iosfwd>
+#include <bf/span.hpp>
 #include <bf/wrap.hpp>
 
 namespace bf {
 
+class container_reader;
+class container_writer;
+
 /// The abstract Bloom filter interface.
 class bloom_filter
 {
@@ -12,6 +17,12 @@ class bloom_filter
   bloom_filter& operator=(bloom_filter const&) = delete;
 
 public:
+  /// The number of objects that the batched operations hash and prefetch
+  /// before touching the filter. Large enough to hide memory latency behind
+  /// many outstanding cache misses, small enough to keep the prefetched lines
+  /// in L1.
+  constexpr static size_t batch_size = 16;
+
   bloom_filter() = default;
   virtual ~bloom_filter() = default;
 
@@ -43,12 +54,74 @@ public:
   /// @return A frequency estimate for *o*.
   virtual size_t lookup(object const& o) const = 0;
 
+  /// Adds a sequence of elements to the Bloom filter. Implementations may
+  /// overlap the memory accesses of different elements, which pays off once
+  /// the filter exceeds the caches.
+  /// @param objects The wrapped objects to add.
+  virtual void add_many(span<object const> objects)
+  {
+    for (auto& o : objects)
+      add(o);
+  }
+
+  /// Retrieves the counts of a sequence of elements.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives the frequency estimate of `objects[i]` at
+  /// position *i*.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const
+  {
+    for (size_t i = 0; i < objects.size(); ++i)
+      counts[i] = lookup(objects[i]);
+  }
+
   /// Removes all items from the Bloom filter.
   virtual void clear() = 0;
 
-  virtual char* serialize(char* buf) = 0;
-  virtual unsigned int serializedSize() const = 0;
-  virtual int fromBuf(const char*buf, unsigned int len) = 0;
+  /// Writes the Bloom filter as a container to a buffer. Filters without a
+  /// legacy format of their own use the container.
+  /// @param buf The buffer of at least serializedSize() bytes.
+  /// @return The end of the written bytes.
+  virtual char* serialize(char* buf);
+
+  /// Computes the number of bytes that serialize() writes.
+  /// @return The size of the serialized filter.
+  virtual unsigned int serializedSize() const;
+
+  /// Restores the Bloom filter from the bytes that serialize() wrote.
+  /// @param buf The serialized filter.
+  /// @param len The number of bytes in *buf*.
+  /// @return 0 on success, 1 if *buf* is no container, and 2 if it does not
+  /// hold exactly one filter of this type.
+  virtual int fromBuf(const char*buf, unsigned int len);
+
+  /// Appends the state of the Bloom filter to a container.
+  /// @param w The container to append to.
+  virtual void write(container_writer& w) const = 0;
+
+  /// Restores the state of the Bloom filter from the next sections of a
+  /// container.
+  /// @param r The container to read from.
+  /// @return 0 on success.
+  virtual int read(container_reader& r) = 0;
+
+  /// Writes the Bloom filter as a container to a stream, straight from its
+  /// storage. Memory usage does not grow with the size of the filter.
+  /// @param out The stream to write to.
+  /// @return `true` on success.
+  bool save(std::ostream& out) const;
+
+  /// Writes the Bloom filter as a container to a file descriptor.
+  /// @param fd The file descriptor to write to.
+  /// @return `true` on success, `false` with `errno` set otherwise.
+  bool write_to(int fd) const;
+
+  /// Reads the Bloom filter from a container in a stream, straight into its
+  /// storage. The container must hold a filter of the same type.
+  /// @param in The stream to read from.
+  /// @return 0 on success.
+  int load(std::istream& in);
 };
 
 } // namespace bf
@@ -38,6 +38,8 @@ public:
   a2_bloom_filter(size_t k, size_t cells, size_t capacity,
                   size_t seed1 = 0, size_t seed2 = 0);
 
+  a2_bloom_filter() = default;
+
   using bloom_filter::add;
   using bloom_filter::lookup;
 
@@ -47,12 +49,14 @@ public:
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
   int fromBuf(const char*buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
 
 private:
   basic_bloom_filter first_;
   basic_bloom_filter second_;
   size_t items_ = 0; ///< Number of items in the active Bloom filter.
-  size_t capacity_;  ///< Maximum number of items in the active Bloom filter.
+  size_t capacity_ = 0;  ///< Maximum number of items in the active Bloom filter.
 };
 
 } // namespace bf
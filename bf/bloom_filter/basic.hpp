@@ -8,6 +8,8 @@
 
 namespace bf {
 
+class scalable_bloom_filter;
+
 /// The basic Bloom filter.
 ///
 /// @note This Bloom filter does not use partitioning because it results in
@@ -15,6 +17,8 @@ namespace bf {
 /// more 1s than non-partitioned filters.
 class basic_bloom_filter : public bloom_filter
 {
+  friend scalable_bloom_filter;
+
 public:
   /// Computes the number of cells based on a false-positive rate and capacity.
   ///
@@ -41,7 +45,10 @@ public:
   /// @param hasher The hasher to use.
   /// @param cells The number of cells in the bit vector.
   /// @param partition Whether to partition the bit vector per hash function.
-  basic_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells, bool partition = false);
+  /// @param mapping How digests map to bit positions.
+  basic_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells,
+                     bool partition = false,
+                     index_mapping mapping = index_mapping::modulo);
 
   /// Constructs a basic Bloom filter by given a desired false-positive
   /// probability and an expected number of elements. The implementation
@@ -57,8 +64,11 @@ public:
   /// hashing.
   ///
   /// @param partition Whether to partition the bit vector per hash function.
+  ///
+  /// @param mapping How digests map to bit positions.
   basic_bloom_filter(double fp, size_t capacity, size_t seed = 0,
-                     bool double_hashing = true, bool partition = true);
+                     bool double_hashing = true, bool partition = true,
+                     index_mapping mapping = index_mapping::modulo);
 
   /// Constructs a basic Bloom filter given a hasher and a bitvector.
   ///
@@ -75,6 +85,95 @@ public:
   virtual size_t lookup(object const& o) const override;
   virtual void clear() override;
 
+  /// Adds a sequence of elements. Hashes a batch of elements and prefetches
+  /// all of their bits before setting any of them.
+  /// @param objects The wrapped objects to add.
+  virtual void add_many(span<object const> objects) override;
+
+  /// Looks up a sequence of elements. Hashes a batch of elements and
+  /// prefetches all of their bits before testing any of them.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives 1 for each element in the filter and 0 otherwise.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
+  /// Adds a sequence of elements on several threads, e.g., to rebuild a large
+  /// filter from a key array. Each thread owns a contiguous range of the bit
+  /// vector. In rounds, all threads hash a slice of the elements and sort the
+  /// bit positions by owner, then each thread sets the positions in its
+  /// range. Since no two threads write the same block, the result is
+  /// bit-identical to adding the elements one by one, without atomic
+  /// instructions.
+  /// @param objects The wrapped objects to add.
+  /// @param threads The number of threads, 0 for one per core.
+  void bulk_build(span<object const> objects, size_t threads = 0);
+
+  /// Checks whether another Bloom filter maps elements to the same bits,
+  /// i.e., whether it has the same number of cells, partitioning, mapping,
+  /// and a hasher with the same serialized state.
+  /// @param other The other Bloom filter.
+  /// @return `true` if *other* can be merged or intersected with `*this`.
+  bool compatible(basic_bloom_filter const& other) const;
+
+  /// Adds the elements of another Bloom filter, e.g., one that another node
+  /// built. Afterwards, lookups find the elements of both filters.
+  /// @param other The filter to merge.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return `false` if *other* is not compatible().
+  bool merge(basic_bloom_filter const& other, size_t threads = 0);
+
+  /// Adds the elements of several Bloom filters in one pass over the bits.
+  /// @param others The filters to merge.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return `false`, without changing `*this`, if one of *others* is not
+  /// compatible().
+  bool merge(span<basic_bloom_filter const* const> others,
+             size_t threads = 0);
+
+  /// Keeps only the bits that another Bloom filter also has set. Afterwards,
+  /// lookups find the elements of both filters, with a higher false-positive
+  /// rate than a filter built from the common elements.
+  /// @param other The filter to intersect with.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return `false` if *other* is not compatible().
+  bool intersect(basic_bloom_filter const& other, size_t threads = 0);
+
+  /// Intersects with several Bloom filters in one pass over the bits.
+  /// @param others The filters to intersect with.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return `false`, without changing `*this`, if one of *others* is not
+  /// compatible().
+  bool intersect(span<basic_bloom_filter const* const> others,
+                 size_t threads = 0);
+
+  /// Estimates the number of distinct elements in the Bloom filter from the
+  /// fraction of bits set, with the formula of Swamidass and Baldi:
+  /// @f$n \approx -\frac{m}{k} \ln(1 - \frac{X}{m})@f$ for *X* of *m* bits
+  /// set by *k* hash functions. Unlike a counter of insertions, the estimate
+  /// ignores duplicates and remains valid after merge().
+  /// @return The estimated cardinality, infinity if all bits are set.
+  double estimate_cardinality() const;
+
+  /// Estimates the current false-positive probability as the chance that
+  /// *k* random bits are all set.
+  /// @return The estimated false-positive probability.
+  double estimate_fpr() const;
+
+  /// Estimates the number of distinct elements in the union of two Bloom
+  /// filters, without materializing it.
+  /// @param other The other Bloom filter.
+  /// @return The estimated cardinality of the union.
+  /// @pre `compatible(other)`
+  double estimate_union(basic_bloom_filter const& other) const;
+
+  /// Estimates the number of distinct elements that two Bloom filters have
+  /// in common, by inclusion-exclusion of the cardinality estimates.
+  /// @param other The other Bloom filter.
+  /// @return The estimated cardinality of the intersection, at least 0.
+  /// @pre `compatible(other)`
+  double estimate_intersection(basic_bloom_filter const& other) const;
+
   /// Removes an object from the Bloom filter.
   /// May introduce false negatives because the bitvector indices of the object
   /// to remove may be shared with other objects.
@@ -91,14 +190,48 @@ public:
 
   /// Returns the hasher of the Bloom filter.
   std::shared_ptr<base_hasher> const& hasher_function() const;
+
+  /// Returns how the Bloom filter maps digests to bit positions.
+  index_mapping mapping() const;
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
   int fromBuf(const char*buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+  /// Deserializes a Bloom filter like `fromBuf`, but looks up bits directly
+  /// in *buf* instead of copying them, e.g., from a `mapped_file`. The first
+  /// modification of the filter copies the bits.
+  /// @param buf The serialized Bloom filter.
+  /// @param len The size of the serialized Bloom filter.
+  /// @param owner Keeps *buf* alive as long as the filter refers to it.
+  /// @return 0 on success.
+  int viewBuf(const char* buf, unsigned int len,
+              std::shared_ptr<void const> owner);
+
+protected:
+  int deserialize(const char* buf, unsigned int len, bool view,
+                  std::shared_ptr<void const> owner);
+
+  /// Maps an object to its positions in the underlying bit vector.
+  /// @param o The object to map.
+  /// @param indices Receives the bit positions of *o*.
+  void find_indices(object const& o, digest_buffer& indices) const;
+
+  /// Maps digests to positions in the underlying bit vector.
+  /// @param indices The digests of an object, replaced by its bit positions.
+  void map_indices(digest_buffer& indices) const;
+
+  /// Maps a batch of objects to their bit positions and prefetches them.
+  /// @param objects At most `batch_size` objects.
+  /// @param indices Receives the bit positions of `objects[i]` at position
+  /// *i*.
+  void prefetch(span<object const> objects, digest_buffer* indices) const;
 
-private:
   std::shared_ptr<base_hasher> hasher_;
   bitvector bits_;
   bool partition_;
+  index_mapping mapping_ = index_mapping::modulo;
 };
 
 } // namespace bf
@@ -0,0 +1,123 @@
+#ifndef BF_BLOOM_FILTER_BINARY_FUSE_HPP
+#define BF_BLOOM_FILTER_BINARY_FUSE_HPP
+
+#include <bf/bitvector.hpp>
+#include <bf/bloom_filter.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A static 3-wise binary fuse filter after Graf and Lemire, which stores a
+/// fixed set of keys in about 9 bits per key at a false-positive probability
+/// of @f$2^{-8}@f$, or 18 bits at @f$2^{-16}@f$. A key maps to three slots
+/// in consecutive segments of the fingerprint array, and the filter contains
+/// the key if the fingerprints in its slots XOR to its own fingerprint.
+/// Hence a lookup touches exactly three cache lines, at most.
+///
+/// The filter is built once from all keys. Construction hashes the keys,
+/// sorts the hashes by segment and counts the keys per slot on several
+/// threads, each of which owns a range of the slots, then peels the slots
+/// with a single key and assigns their fingerprints sequentially. Elements
+/// cannot be added or removed afterwards.
+class binary_fuse_filter : public bloom_filter
+{
+public:
+  /// The number of construction attempts, each with a new seed, before
+  /// build() gives up. A single attempt fails with a probability well below
+  /// 1%, so in practice build() fails only for keys with equal hashes.
+  constexpr static size_t max_attempts = 100;
+
+  binary_fuse_filter() = default;
+
+  /// Constructs an empty binary fuse filter.
+  /// @param h The hasher, whose first digest determines the slots and the
+  /// fingerprint of a key.
+  /// @param fingerprint_bits The number of bits per fingerprint, 8 or 16.
+  /// @pre `fingerprint_bits == 8 || fingerprint_bits == 16`
+  binary_fuse_filter(std::shared_ptr<base_hasher> h,
+                     size_t fingerprint_bits = 8);
+
+  /// Constructs a binary fuse filter from a set of keys.
+  /// @param h The hasher.
+  /// @param keys The wrapped keys. Duplicates are fine.
+  /// @param fingerprint_bits The number of bits per fingerprint, 8 or 16.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @pre `fingerprint_bits == 8 || fingerprint_bits == 16`
+  binary_fuse_filter(std::shared_ptr<base_hasher> h, span<object const> keys,
+                     size_t fingerprint_bits = 8, size_t threads = 0);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  /// Fails, since the filter is static and would miss *o*; see build().
+  /// @throws std::logic_error always.
+  virtual void add(object const& o) override;
+
+  /// Retrieves the count of an element.
+  /// @param o The object to look up.
+  /// @return 1 if the filter contains *o* and 0 otherwise.
+  virtual size_t lookup(object const& o) const override;
+
+  /// Looks up a sequence of elements. Hashes a batch of elements and
+  /// prefetches their slots before probing the first.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives the frequency estimate of `objects[i]` at
+  /// position *i*.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
+  /// Removes all keys.
+  virtual void clear() override;
+
+  /// Replaces the keys of the filter.
+  /// @param keys The wrapped keys. Duplicates are fine.
+  /// @param threads The number of threads, 0 for one per core.
+  /// @return `false` if all attempts failed, in which case the filter is
+  /// empty.
+  bool build(span<object const> keys, size_t threads = 0);
+
+  /// Retrieves the number of distinct key hashes in the filter.
+  size_t size() const;
+
+  /// Retrieves the number of slots.
+  size_t slots() const;
+
+  /// Retrieves the number of bits per fingerprint.
+  size_t fingerprint_bits() const;
+
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  /// Sizes the segments and the array for a number of keys.
+  void layout(size_t keys);
+
+  /// Computes the hash of a key from which its slots and fingerprint derive.
+  uint64_t hash(object const& o) const;
+
+  /// Computes the three slots of a hash.
+  void locate(uint64_t hash, size_t* slots) const;
+
+  /// Computes the fingerprint of a hash.
+  uint64_t fingerprint(uint64_t hash) const;
+
+  /// Retrieves the fingerprint in a slot.
+  uint64_t get(size_t i) const;
+
+  /// Overwrites the fingerprint in a slot.
+  void set(size_t i, uint64_t fingerprint);
+
+  std::shared_ptr<base_hasher> hasher_;
+  bitvector fingerprints_;
+  size_t fingerprint_bits_ = 8;
+  /// Mixed into the digests, and changed on every construction attempt.
+  uint64_t seed_ = 0;
+  size_t segment_length_ = 0;
+  size_t segment_count_length_ = 0;
+  size_t size_ = 0;
+};
+
+} // namespace bf
+
+#endif
@@ -15,6 +15,8 @@ public:
   /// @param seed0 The seed for the first level.
   bitwise_bloom_filter(size_t k, size_t cells, size_t seed = 0);
 
+  bitwise_bloom_filter() = default;
+
   using bloom_filter::add;
   using bloom_filter::lookup;
 
@@ -25,15 +27,17 @@ public:
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
   int fromBuf(const char*buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
 
 private:
   /// Appends a new level.
   /// @post `levels_.size() += 1`
   void grow();
 
-  size_t k_;
-  size_t cells_;
-  size_t seed_;
+  size_t k_ = 0;
+  size_t cells_ = 0;
+  size_t seed_ = 0;
   std::vector<basic_bloom_filter> levels_;
 };
 
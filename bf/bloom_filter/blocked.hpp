@@ -0,0 +1,110 @@
+#ifndef BF_BLOOM_FILTER_BLOCKED_HPP
+#define BF_BLOOM_FILTER_BLOCKED_HPP
+
+#include <bf/bitvector.hpp>
+#include <bf/bloom_filter.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A cache-line blocked Bloom filter. The first digest of an element selects
+/// one block of `block_bits` bits, and all *k* bits of the element fall into
+/// that block. Each operation thus touches a single cache line, at the cost
+/// of a slightly higher false-positive rate than a basic Bloom filter with
+/// the same number of cells.
+class blocked_bloom_filter : public bloom_filter
+{
+public:
+  /// The number of bits per block, i.e., one cache line.
+  constexpr static size_t block_bits = cache_line_size * 8;
+
+  /// Computes the expected false-positive rate of a blocked Bloom filter.
+  /// The number of elements per block follows a Poisson distribution, which
+  /// overloads some blocks and makes the rate exceed the one of a basic Bloom
+  /// filter.
+  ///
+  /// @param cells The number of cells.
+  ///
+  /// @param capacity The number of elements.
+  ///
+  /// @param k The number of hash functions.
+  ///
+  /// @return The false-positive rate after adding *capacity* elements.
+  static double fp(size_t cells, size_t capacity, size_t k);
+
+  /// Computes the number of cells based on a false-positive rate and capacity,
+  /// accounting for the penalty of blocking.
+  ///
+  /// @param fp The desired false-positive rate
+  ///
+  /// @param capacity The maximum number of items.
+  ///
+  /// @return The number of cells, a multiple of `block_bits`, that guarantee
+  /// *fp* for *capacity* elements.
+  static size_t m(double fp, size_t capacity);
+
+  /// Computes the number of hash functions for a given number of cells and
+  /// capacity.
+  ///
+  /// @param cells The number of cells in the Bloom filter (aka. *m*)
+  ///
+  /// @param capacity The maximum number of elements.
+  ///
+  /// @return The number of hash functions for *cells* and *capacity*.
+  static size_t k(size_t cells, size_t capacity);
+
+  blocked_bloom_filter() = default;
+
+  /// Constructs a blocked Bloom filter.
+  /// @param h The hasher to use.
+  /// @param cells The number of cells, rounded up to a multiple of
+  /// `block_bits`.
+  blocked_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells);
+
+  /// Constructs a blocked Bloom filter by given a desired false-positive
+  /// probability and an expected number of elements.
+  ///
+  /// @param fp The desired false-positive probability.
+  ///
+  /// @param capacity The expected number of elements.
+  ///
+  /// @param seed The initial seed used to construct the hash functions.
+  ///
+  /// @param double_hashing Flag indicating whether to use default or double
+  /// hashing.
+  blocked_bloom_filter(double fp, size_t capacity, size_t seed = 0,
+                       bool double_hashing = true);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  virtual void add(object const& o) override;
+  virtual size_t lookup(object const& o) const override;
+  virtual void clear() override;
+
+  /// Returns the underlying storage of the Bloom filter.
+  bitvector const& storage() const;
+
+  /// Returns the hasher of the Bloom filter.
+  std::shared_ptr<base_hasher> const& hasher_function() const;
+
+  char* serialize(char* buf) override;
+  unsigned int serializedSize() const override;
+  int fromBuf(const char* buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  /// Computes the position of the first bit of the block for given digests.
+  size_t block(digest_buffer const& digests) const;
+
+  /// Computes the bit offset within a block for a digest.
+  static size_t offset(digest d);
+
+  std::shared_ptr<base_hasher> hasher_;
+  bitvector bits_;
+};
+
+} // namespace bf
+
+#endif
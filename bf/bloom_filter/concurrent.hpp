@@ -0,0 +1,154 @@
+#ifndef BF_BLOOM_FILTER_CONCURRENT_HPP
+#define BF_BLOOM_FILTER_CONCURRENT_HPP
+
+#include <bf/bloom_filter/basic.hpp>
+#include <bf/bloom_filter/counting.hpp>
+
+namespace bf {
+
+/// A basic Bloom filter that many threads can add to and query at the same
+/// time without locking. Insertions set bits with an atomic OR on the block
+/// that holds them, and lookups read blocks with atomic loads, so lookups
+/// are wait-free. Both use relaxed memory ordering: a lookup that runs
+/// concurrently with the insertion of the same element may or may not find
+/// it, but an element is never lost once its insertion completes.
+///
+/// Only `add`, `add_many`, `lookup` and `lookup_many` may run concurrently.
+/// The filter shares its serialization with basic_bloom_filter.
+class concurrent_bloom_filter : public basic_bloom_filter
+{
+public:
+  concurrent_bloom_filter() = default;
+
+  /// Constructs a concurrent Bloom filter.
+  /// @param hasher The hasher to use.
+  /// @param cells The number of cells in the bit vector.
+  /// @param partition Whether to partition the bit vector per hash function.
+  /// @param mapping How digests map to bit positions.
+  concurrent_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells,
+                          bool partition = false,
+                          index_mapping mapping = index_mapping::modulo);
+
+  /// Constructs a concurrent Bloom filter from a desired false-positive
+  /// probability and an expected number of elements.
+  /// @param fp The desired false-positive probability.
+  /// @param capacity The expected number of elements.
+  /// @param seed The initial seed used to construct the hash functions.
+  /// @param double_hashing Flag indicating whether to use default or double
+  /// hashing.
+  /// @param partition Whether to partition the bit vector per hash function.
+  /// @param mapping How digests map to bit positions.
+  concurrent_bloom_filter(double fp, size_t capacity, size_t seed = 0,
+                          bool double_hashing = true, bool partition = true,
+                          index_mapping mapping = index_mapping::modulo);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  /// Adds an element. Skips the atomic OR for blocks that already have all
+  /// bits of the element set, so that hot cache lines stay shared.
+  /// @param o The object to add.
+  virtual void add(object const& o) override;
+
+  /// Retrieves the count of an element.
+  /// @param o The object to look up.
+  /// @return 1 if all bits of *o* are set and 0 otherwise.
+  virtual size_t lookup(object const& o) const override;
+
+  virtual void add_many(span<object const> objects) override;
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
+  /// Resets all bits. Concurrent insertions may survive the reset.
+  virtual void clear() override;
+
+  /// Clearing bits of one element may remove others, and races with
+  /// concurrent insertions.
+  void remove(object const& o) = delete;
+
+  /// A view of read-only memory cannot take atomic updates.
+  int viewBuf(const char* buf, unsigned int len,
+              std::shared_ptr<void const> owner) = delete;
+
+  int read(container_reader& r) override;
+
+private:
+  /// Sets the bits at given positions atomically.
+  void set(digest_buffer const& indices);
+
+  /// Tests the bits at given positions atomically.
+  bool test(digest_buffer const& indices) const;
+};
+
+/// A counting Bloom filter that many threads can add to, remove from and
+/// query at the same time without locking. Counters stay packed in machine
+/// words, and each update replaces the word that holds the counter with a
+/// compare-and-swap, so that counters saturate exactly as in the sequential
+/// filter. Updates of a single element are atomic per counter, not across
+/// all of its counters: a lookup that runs concurrently with an insertion or
+/// removal of the same element may see some counters updated and others not.
+///
+/// The counter width must divide 64, so that no counter straddles two words.
+/// Only `add`, `add_many`, `remove`, `lookup` and `lookup_many` may run
+/// concurrently. The filter shares its serialization with
+/// counting_bloom_filter.
+class concurrent_counting_bloom_filter : public counting_bloom_filter
+{
+public:
+  concurrent_counting_bloom_filter() = default;
+
+  /// Constructs a concurrent counting Bloom filter.
+  /// @param h The hasher.
+  /// @param cells The number of cells.
+  /// @param width The number of bits per cell.
+  /// @param partition Whether to partition the bit vector per hash function.
+  /// @param mapping How digests map to cells.
+  /// @throws std::invalid_argument if *width* does not divide 64.
+  concurrent_counting_bloom_filter(
+    std::shared_ptr<base_hasher> h, size_t cells, size_t width,
+    bool partition = false, index_mapping mapping = index_mapping::modulo);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+  using counting_bloom_filter::remove;
+
+  virtual void add(object const& o) override;
+  virtual size_t lookup(object const& o) const override;
+  virtual void add_many(span<object const> objects) override;
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
+  /// Resets all counters. Concurrent updates may survive the reset.
+  virtual void clear() override;
+
+  /// Removes an element, also through a `counting_bloom_filter&`. Removing
+  /// an element that was never added decrements the counters of others, as
+  /// in counting_bloom_filter.
+  /// @param o The object whose cells to decrement by 1.
+  virtual void remove(object const& o) override;
+
+  /// Loads a filter from the legacy serialization. Fails for counter widths
+  /// that do not divide 64, like read().
+  int fromBuf(const char* buf, unsigned int len) override;
+
+  int read(container_reader& r) override;
+
+private:
+  /// Checks the counters of a loaded filter and copies them out of a
+  /// mapping if needed.
+  /// @return 0 if the width suits atomic updates.
+  int adopt();
+
+  /// Increments the counters at given positions atomically.
+  void increment(digest_buffer const& indices);
+
+  /// Decrements the counters at given positions atomically.
+  void decrement(digest_buffer const& indices);
+
+  /// Finds the minimum counter at given positions with atomic loads.
+  size_t find_minimum(digest_buffer const& indices) const;
+};
+
+} // namespace bf
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef BF_BLOOM_FILTER_COUNT_MIN_HPP
+#define BF_BLOOM_FILTER_COUNT_MIN_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <bf/bloom_filter.hpp>
+#include <bf/counter_vector.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A Count-Min sketch after Cormode and Muthukrishnan with conservative
+/// update. It has one row of *w* counters per digest of its hasher, and an
+/// element maps to one counter in each row. An insertion raises only those
+/// counters of an element that fall below its new estimate, and a lookup
+/// returns the minimum of its counters. With *d* rows, an estimate never
+/// falls below the true count and, with probability @f$1 - e^{-d}@f$,
+/// exceeds it by at most @f$e N / w@f$ after *N* insertions.
+///
+/// The sketch also tracks the *k* elements with the largest estimates in a
+/// min-heap. An insertion whose estimate does not exceed the smallest one of
+/// a full heap leaves the heap alone, so that only the few candidates in a
+/// skewed stream pay for a look at the heap. The heap identifies elements by
+/// their counters rather than their keys: elements with the same counters in
+/// all rows have the same estimate anyway, and the first of them keeps the
+/// entry.
+class count_min_sketch : public bloom_filter
+{
+public:
+  /// An element with a large estimate.
+  struct heavy_hitter
+  {
+    std::string key;
+    size_t count;
+  };
+
+  count_min_sketch() = default;
+
+  /// Constructs a Count-Min sketch.
+  /// @param h The hasher, whose *d* digests select the counters of the *d*
+  /// rows.
+  /// @param cells The number of counters per row.
+  /// @param width The number of bits per counter.
+  /// @param top The number of heavy hitters to track.
+  /// @pre `cells > 0 && width > 0 && width <= 64`
+  count_min_sketch(std::shared_ptr<base_hasher> h, size_t cells,
+                   size_t width = 32, size_t top = 0);
+
+  /// Constructs a Count-Min sketch from error bounds, with
+  /// @f$\lceil e / \epsilon \rceil@f$ counters of 32 bits per row and
+  /// @f$\lceil \ln(1 / \delta) \rceil@f$ rows.
+  /// @param epsilon The error relative to the number of insertions.
+  /// @param delta The probability that an estimate exceeds the error.
+  /// @param top The number of heavy hitters to track.
+  /// @param seed The seed of the hash function.
+  /// @pre `epsilon > 0 && delta > 0 && delta < 1`
+  count_min_sketch(double epsilon, double delta, size_t top = 0,
+                   size_t seed = 0);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  /// Adds one copy of an element.
+  /// @param o The object to add.
+  virtual void add(object const& o) override;
+
+  /// Estimates the count of an element.
+  /// @param o The object to look up.
+  /// @return The minimum of the counters of *o*.
+  virtual size_t lookup(object const& o) const override;
+
+  /// Adds a sequence of elements. Hashes a batch of elements and prefetches
+  /// all of their counters before updating any of them.
+  /// @param objects The wrapped objects to add.
+  virtual void add_many(span<object const> objects) override;
+
+  /// Looks up a sequence of elements. Hashes a batch of elements and
+  /// prefetches all of their counters before reading any of them.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives the frequency estimate of `objects[i]` at
+  /// position *i*.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
+  /// Resets all counters and forgets the heavy hitters, e.g., at the start
+  /// of a new time window.
+  virtual void clear() override;
+
+  /// Adds copies of an element. Counters saturate at their maximum.
+  /// @param o The object to add.
+  /// @param count The number of copies.
+  void insert(object const& o, size_t count = 1);
+
+  template <typename T>
+  void insert(T const& x, size_t count = 1)
+  {
+    insert(wrap(x), count);
+  }
+
+  /// Adds the counters of another sketch, e.g., one that another shard
+  /// built, and keeps the largest of the heavy hitters of both according
+  /// to the combined counters.
+  /// @param other A sketch with the same hasher, rows, and counters.
+  /// @return `false` if *other* is incompatible, in which case the sketch
+  /// remains unchanged.
+  bool merge(count_min_sketch const& other);
+
+  /// Retrieves the heavy hitters with their current estimates.
+  /// @return At most *top* elements, the largest estimate first.
+  std::vector<heavy_hitter> heavy_hitters() const;
+
+  /// Retrieves the number of rows.
+  size_t rows() const;
+
+  /// Retrieves the number of counters per row.
+  size_t cells() const;
+
+  /// Retrieves the number of heavy hitters to track.
+  size_t top() const;
+
+  /// Retrieves the total count of all insertions.
+  size_t total() const;
+
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  /// A heavy hitter and the identity of its counters.
+  struct entry
+  {
+    heavy_hitter item;
+    uint64_t id;
+  };
+
+  /// Maps an object to the indices of its counters, one per row.
+  void find_indices(object const& o, digest_buffer& indices) const;
+
+  /// Maps a batch of objects to their indices and prefetches the
+  /// corresponding counters.
+  /// @param objects At most `batch_size` objects.
+  /// @param indices Receives the indices of `objects[i]` at position *i*.
+  void prefetch(span<object const> objects, digest_buffer* indices) const;
+
+  /// Computes the identity of the counters at a list of indices.
+  static uint64_t identify(digest_buffer const& indices);
+
+  /// Finds the minimum of the counters at a list of indices.
+  size_t find_minimum(digest_buffer const& indices) const;
+
+  /// Adds copies of an element at known indices.
+  void update(object const& o, digest_buffer const& indices, size_t count);
+
+  /// Offers an element with a new estimate to the heavy hitters.
+  /// @param o The element.
+  /// @param indices The indices of the counters of *o*.
+  /// @param count The estimate of *o*.
+  void track(object const& o, digest_buffer const& indices, size_t count);
+
+  /// Restores the heap order upwards or downwards from a position.
+  void sift_up(size_t i);
+  void sift_down(size_t i);
+
+  /// Exchanges two heavy hitters in the heap.
+  void exchange(size_t i, size_t j);
+
+  std::shared_ptr<base_hasher> hasher_;
+  counter_vector counters_;
+  size_t cells_ = 0;
+  size_t top_ = 0;
+  size_t total_ = 0;
+  /// A min-heap of the heavy hitters by count.
+  std::vector<entry> heap_;
+  /// The position of each heavy hitter in the heap by its identity.
+  std::unordered_map<uint64_t, size_t> positions_;
+};
+
+} // namespace bf
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <bf/counter_vector.hpp>
 #include <bf/bloom_filter.hpp>
+#include <bf/container.hpp>
 #include <bf/hash.hpp>
 
 namespace bf {
@@ -23,8 +24,10 @@ public:
   /// @param cells The number of cells.
   /// @param width The number of bits per cell.
   /// @param partition Whether to partition the bit vector per hash function.
+  /// @param mapping How digests map to cells.
   counting_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells, size_t width,
-                        bool partition = false);
+                        bool partition = false,
+                        index_mapping mapping = index_mapping::modulo);
 
   /// Move-constructs a counting Bloom filter.
   //counting_bloom_filter(counting_bloom_filter&&) = default;
@@ -35,9 +38,23 @@ public:
   virtual size_t lookup(object const& o) const override;
   virtual void clear() override;
 
+  /// Adds a sequence of elements. Hashes a batch of elements and prefetches
+  /// all of their cells before incrementing any of them.
+  /// @param objects The wrapped objects to add.
+  virtual void add_many(span<object const> objects) override;
+
+  /// Looks up a sequence of elements. Hashes a batch of elements and
+  /// prefetches all of their cells before reading any of them.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives the frequency estimate of `objects[i]` at
+  /// position *i*.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
   /// Removes an element.
   /// @param o The object whose cells to decrement by 1.
-  void remove(object const& o);
+  virtual void remove(object const& o);
 
   template <typename T>
   void remove(T const& x)
@@ -45,35 +62,84 @@ public:
     remove(wrap(x));
   }
 
+  /// Returns how the Bloom filter maps digests to cells.
+  index_mapping mapping() const;
+
+  /// Checks whether another counting Bloom filter has the same hash
+  /// functions, cells, width, partitioning and mapping.
+  /// @param other The filter to compare with.
+  /// @return `true` if *other* can be merged or intersected with `*this`.
+  bool compatible(counting_bloom_filter const& other) const;
+
+  /// Adds the counters of another counting Bloom filter, e.g., one that
+  /// another shard built. Afterwards, lookups estimate the combined count.
+  /// Counters saturate at their maximum.
+  /// @param other The filter to merge.
+  /// @return `false` if *other* is not compatible(), in which case the
+  /// filter remains unchanged.
+  bool merge(counting_bloom_filter const& other);
+
+  /// Replaces each counter with its minimum of both filters. Afterwards,
+  /// lookups estimate the count an element has in both filters.
+  /// @param other The filter to intersect with.
+  /// @return `false` if *other* is not compatible(), in which case the
+  /// filter remains unchanged.
+  bool intersect(counting_bloom_filter const& other);
+
   virtual char* serialize(char* buf) override;
   virtual unsigned int serializedSize() const override;
   virtual int fromBuf(const char*buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
 
 protected:
+  /// Appends the state of a counting Bloom filter or a subclass.
+  /// @param w The container to append to.
+  /// @param type The type of the filter.
+  /// @param extra A parameter of the subclass.
+  void write_cells(container_writer& w, filter_type type,
+                   uint64_t extra) const;
+
+  /// Restores the state of a counting Bloom filter or a subclass.
+  /// @param r The container to read from.
+  /// @param type The type of the filter.
+  /// @param extra Receives the parameter of the subclass.
+  /// @return 0 on success.
+  int read_cells(container_reader& r, filter_type type, uint64_t& extra);
+
   /// Maps an object to the indices in the underlying counter vector.
   /// @param o The object to map.
-  /// @return The indices corresponding to the digests of *o*.
-  std::vector<size_t> find_indices(object const& o) const;
+  /// @param indices Receives the sorted and unique indices corresponding to
+  /// the digests of *o*.
+  void find_indices(object const& o, digest_buffer& indices) const;
+
+  /// Maps a batch of objects to their indices and prefetches the
+  /// corresponding cells.
+  /// @param objects At most `batch_size` objects.
+  /// @param indices Receives the indices of `objects[i]` at position *i*.
+  void prefetch(span<object const> objects, digest_buffer* indices) const;
 
   /// Finds the minimum value in a list of arbitrary indices.
   /// @param indices The indices over which to compute the minimum.
   /// @return The minimum counter value over *indices*.
-  size_t find_minimum(std::vector<size_t> const& indices) const;
+  size_t find_minimum(digest_buffer const& indices) const;
 
   /// Finds one or more minimum indices for a list of arbitrary indices.
   /// @param indices The indices over which to compute the minimum.
-  /// @return The indices corresponding to the minima in the counter vector.
-  std::vector<size_t> find_minima(std::vector<size_t> const& indices) const;
+  /// @param positions Receives the indices corresponding to the minima in the
+  /// counter vector.
+  void find_minima(digest_buffer const& indices,
+                   digest_buffer& positions) const;
 
   /// Increments a given set of indices in the underlying counter vector.
   /// @param indices The indices to increment.
   /// @return `true` iff no counter overflowed.
-  bool increment(std::vector<size_t> const& indices, size_t value = 1);
+  bool increment(digest_buffer const& indices, size_t value = 1);
 
   /// Decrements a given set of indices in the underlying counter vector.
   /// @param indices The indices to decrement.
   /// @return `true` iff no counter underflowed.
-  bool decrement(std::vector<size_t> const& indices, size_t value = 1);
+  bool decrement(digest_buffer const& indices, size_t value = 1);
 
   /// Retrieves the counter for given cell index.
   /// @param index The index of the counter vector.
@@ -83,6 +149,7 @@ protected:
   std::shared_ptr<base_hasher> hasher_;
   counter_vector cells_;
   bool partition_;
+  index_mapping mapping_ = index_mapping::modulo;
 };
 
 /// A spectral Bloom filter with minimum increase (MI) policy.
@@ -97,10 +164,15 @@ public:
   spectral_mi_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells, size_t width,
                            bool partition = false);
 
+  spectral_mi_bloom_filter() = default;
+
   using bloom_filter::add;
   using bloom_filter::lookup;
   using counting_bloom_filter::remove;
   virtual void add(object const& o) override;
+  virtual void add_many(span<object const> objects) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
 };
 
 /// A spectral Bloom filter with recurring minimum (RM) policy.
@@ -132,6 +204,8 @@ public:
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
   int fromBuf(const char*buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
 
 private:
   counting_bloom_filter first_;
@@ -0,0 +1,144 @@
+#ifndef BF_BLOOM_FILTER_CUCKOO_HPP
+#define BF_BLOOM_FILTER_CUCKOO_HPP
+
+#include <bf/bitvector.hpp>
+#include <bf/bloom_filter.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A cuckoo filter after Fan et al., which supports removal at a fraction of
+/// the memory of a counting Bloom filter. It stores a fingerprint of 8 or 16
+/// bits per element in one of two candidate buckets of four slots. The
+/// second bucket derives from the first and the fingerprint alone (partial-key
+/// cuckoo hashing), so that an insertion into a full bucket can relocate a
+/// fingerprint to its other bucket without knowing its element.
+///
+/// A lookup reads exactly two buckets and compares all eight slots against
+/// the fingerprint at once, with SSE2 where available. The false-positive
+/// probability is about @f$8 / 2^f@f$ for *f*-bit fingerprints, i.e.,
+/// 0.03 for 8 and 0.0001 for 16 bits.
+class cuckoo_filter : public bloom_filter
+{
+public:
+  /// The number of slots per bucket.
+  constexpr static size_t slots = 4;
+
+  /// The number of relocations after which an insertion gives up.
+  constexpr static size_t max_kicks = 500;
+
+  cuckoo_filter() = default;
+
+  /// Constructs a cuckoo filter.
+  /// @param h The hasher, whose first digest determines both the bucket and
+  /// the fingerprint of an element.
+  /// @param capacity The number of elements to hold. The filter rounds the
+  /// number of buckets up to a power of two, for a load of at most 95%.
+  /// @param fingerprint_bits The number of bits per fingerprint, 8 or 16.
+  /// @pre `capacity > 0 && (fingerprint_bits == 8 || fingerprint_bits == 16)`
+  cuckoo_filter(std::shared_ptr<base_hasher> h, size_t capacity,
+                size_t fingerprint_bits = 16);
+
+  /// Constructs a cuckoo filter from a desired false-positive probability,
+  /// with the narrowest fingerprints that achieve it.
+  /// @param fp The desired false-positive probability.
+  /// @param capacity The number of elements to hold.
+  /// @param seed The seed of the hash function.
+  /// @pre `fp >= 8.0 / 65536`
+  cuckoo_filter(double fp, size_t capacity, size_t seed = 0);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  /// Adds an element; see insert().
+  /// @param o The object to add.
+  /// @throws std::length_error if the filter is full() and would lose *o*.
+  virtual void add(object const& o) override;
+
+  /// Retrieves the count of an element.
+  /// @param o The object to look up.
+  /// @return 1 if the filter contains *o* and 0 otherwise.
+  virtual size_t lookup(object const& o) const override;
+
+  virtual void clear() override;
+
+  /// Adds an element, relocating up to max_kicks fingerprints to make room.
+  /// If the last relocated fingerprint finds no slot, the filter keeps it
+  /// aside and is full() until a removal makes room.
+  /// @param o The object to add.
+  /// @return `false` if the filter was already full.
+  bool insert(object const& o);
+
+  template <typename T>
+  bool insert(T const& x)
+  {
+    return insert(wrap(x));
+  }
+
+  /// Removes one copy of an element. Removing an element that was never
+  /// added may remove another element with the same fingerprint.
+  /// @param o The object to remove.
+  /// @return `true` if a fingerprint of *o* was found and removed.
+  bool remove(object const& o);
+
+  template <typename T>
+  bool remove(T const& x)
+  {
+    return remove(wrap(x));
+  }
+
+  /// Retrieves the number of fingerprints in the filter.
+  size_t size() const;
+
+  /// Retrieves the number of slots.
+  size_t capacity() const;
+
+  /// Retrieves the number of bits per fingerprint.
+  size_t fingerprint_bits() const;
+
+  /// Checks whether an insertion failed to find a slot.
+  bool full() const;
+
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  /// Computes the first bucket and the fingerprint of an element.
+  void locate(object const& o, size_t& bucket, uint64_t& fingerprint) const;
+
+  /// Computes the other candidate bucket of a fingerprint.
+  size_t alternate(size_t bucket, uint64_t fingerprint) const;
+
+  /// Retrieves the slots of a bucket as lanes of a word, slot 0 lowest.
+  uint64_t bucket(size_t i) const;
+
+  /// Overwrites a slot.
+  void store(size_t i, size_t slot, uint64_t fingerprint);
+
+  /// Finds a slot that holds a fingerprint, 0 for a free one.
+  /// @return The slot, or `slots` if there is none.
+  size_t find(size_t i, uint64_t fingerprint) const;
+
+  /// Stores a fingerprint in a free slot of a bucket.
+  /// @return `false` if the bucket is full.
+  bool put(size_t i, uint64_t fingerprint);
+
+  /// Stores a fingerprint in one of its buckets, relocating others if both
+  /// are full, and sets it aside as victim if that fails.
+  /// @param i One of the candidate buckets of *fingerprint*.
+  void place(size_t i, uint64_t fingerprint);
+
+  std::shared_ptr<base_hasher> hasher_;
+  bitvector buckets_;
+  size_t fingerprint_bits_ = 16;
+  size_t size_ = 0;
+  /// A fingerprint that found no slot, and its bucket.
+  uint64_t victim_ = 0;
+  size_t victim_bucket_ = 0;
+  /// Chooses the slot to relocate.
+  uint64_t kicks_ = 0;
+};
+
+} // namespace bf
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef BF_BLOOM_FILTER_QUOTIENT_HPP
+#define BF_BLOOM_FILTER_QUOTIENT_HPP
+
+#include <functional>
+
+#include <bf/bitvector.hpp>
+#include <bf/bloom_filter.hpp>
+#include <bf/counter_vector.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A counting quotient filter after Bender et al. and Pandey et al. It keeps
+/// a *p*-bit fingerprint of each element, split into a quotient of *q* bits,
+/// which selects one of @f$2^q@f$ canonical slots, and a remainder of the
+/// other @f$r = p - q@f$ bits, which the slot stores. The remainders of a
+/// quotient form a sorted *run* that starts at the canonical slot or, if
+/// earlier runs occupy it, shortly after; runs of neighboring quotients make
+/// up *clusters*. Three bits of metadata per slot plus one occupied bit per
+/// quotient suffice to find the run of any quotient.
+///
+/// The filter counts elements with counters of variable length: a remainder
+/// that occurs once takes one slot, and one that occurs more often is
+/// followed by as many *r*-bit digits of its count as it needs, in slots of
+/// its own. Unlike the counter encoding of Pandey et al., a metadata bit
+/// tells digits and remainders apart.
+///
+/// Since the slots hold the fingerprints in ascending order, the filter can
+/// enumerate them, double its number of slots without the original elements
+/// by moving a bit from the remainders to the quotients, and merge with
+/// another filter in a single sequential pass over both. The table has a
+/// few spare slots past the last canonical slot instead of wrapping around,
+/// so that slot order and fingerprint order agree.
+class quotient_filter : public bloom_filter
+{
+public:
+  /// The fraction of the canonical slots that insertions may fill.
+  constexpr static double max_load = 0.9;
+
+  quotient_filter() = default;
+
+  /// Constructs a quotient filter.
+  /// @param h The hasher, whose first digest determines the fingerprint of
+  /// an element.
+  /// @param quotient_bits The number of bits *q* of the quotient.
+  /// @param remainder_bits The number of bits *r* of the remainder.
+  /// @pre `quotient_bits > 0 && remainder_bits > 0`
+  /// @pre `quotient_bits + remainder_bits <= 64 && remainder_bits <= 61`
+  quotient_filter(std::shared_ptr<base_hasher> h, size_t quotient_bits,
+                  size_t remainder_bits);
+
+  /// Constructs a quotient filter from a desired false-positive
+  /// probability. The false-positive probability at load *a* is about
+  /// @f$a / 2^r@f$.
+  /// @param fp The desired false-positive probability.
+  /// @param capacity The number of distinct elements to hold.
+  /// @param seed The seed of the hash function.
+  /// @pre `fp > 0 && fp < 1 && capacity > 0`
+  quotient_filter(double fp, size_t capacity, size_t seed = 0);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  /// Adds an element, doubling the filter by resize() whenever it is full.
+  /// @param o The object to add.
+  /// @throws std::length_error if the filter is full and cannot resize().
+  virtual void add(object const& o) override;
+
+  /// Retrieves the count of an element.
+  /// @param o The object to look up.
+  /// @return The number of copies of *o* in the filter, up to false
+  /// positives.
+  virtual size_t lookup(object const& o) const override;
+
+  virtual void clear() override;
+
+  /// Adds copies of an element.
+  /// @param o The object to add.
+  /// @param count The number of copies.
+  /// @return `false` if the filter is too full to take *o*, in which case
+  /// it remains unchanged; see resize().
+  /// @pre `count > 0`
+  bool insert(object const& o, size_t count = 1);
+
+  template <typename T>
+  bool insert(T const& x, size_t count = 1)
+  {
+    return insert(wrap(x), count);
+  }
+
+  /// Removes one copy of an element. Removing an element that was never
+  /// added may remove another element with the same fingerprint.
+  /// @param o The object to remove.
+  /// @return `true` if a fingerprint of *o* was found and removed.
+  bool remove(object const& o);
+
+  template <typename T>
+  bool remove(T const& x)
+  {
+    return remove(wrap(x));
+  }
+
+  /// Doubles the number of canonical slots, moving the most significant bit
+  /// of each remainder to its quotient. The fingerprints stay the same, so
+  /// the false-positive probability at a given number of elements does too.
+  /// The fingerprints move into a new table, so the old and the new table,
+  /// about three times the current size, exist at the same time.
+  /// @return `false` if the remainders have only one bit left.
+  bool resize();
+
+  /// Adds all elements of another filter. The filter grows by resize() as
+  /// needed to take them, within the load limit of insertions. Like
+  /// resize(), the merge builds a new table next to the old one.
+  /// @param other A filter with the same hasher and fingerprint size.
+  /// @return `false` if *other* is incompatible or the elements of both do
+  /// not fit even at one bit per remainder, in which case the filter
+  /// remains unchanged.
+  bool merge(quotient_filter const& other);
+
+  /// Calls a function for each distinct fingerprint in ascending order.
+  /// @param f The function, which receives the fingerprint and its count.
+  void enumerate(std::function<void(uint64_t, size_t)> f) const;
+
+  /// Retrieves the number of elements, counting every copy.
+  size_t size() const;
+
+  /// Retrieves the number of slots in use.
+  size_t used() const;
+
+  /// Retrieves the number of canonical slots, @f$2^q@f$.
+  size_t capacity() const;
+
+  size_t quotient_bits() const;
+  size_t remainder_bits() const;
+
+  /// Computes the fingerprint of an element.
+  uint64_t fingerprint(object const& o) const;
+
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  /// Checks whether a slot is free.
+  bool empty(size_t i) const;
+
+  /// Finds the slot where the run of a quotient starts or would start.
+  size_t run_start(size_t quotient) const;
+
+  /// Reads the count that follows the remainder at a slot.
+  /// @param i The slot of the remainder, which receives the slot after the
+  /// last digit.
+  size_t read_count(size_t& i) const;
+
+  /// Stores the digits of a count after the remainder at a slot.
+  /// @param i The slot of the remainder.
+  /// @param count The count.
+  void write_count(size_t i, size_t count);
+
+  /// Frees a slot by moving the following entries of its cluster one slot
+  /// to the right, and marks it as taken until the caller fills it.
+  /// @return `false` if the table has no free slot at or after *i*.
+  bool insert_slot(size_t i);
+
+  /// Removes the entry at a slot by moving the following entries of its
+  /// cluster one slot to the left.
+  /// @param i The slot.
+  /// @param quotient The quotient of the run that contains slot *i*.
+  void remove_slot(size_t i, size_t quotient);
+
+  /// Counts the free slots at and after a slot, up to a limit.
+  size_t free_slots(size_t i, size_t limit) const;
+
+  /// Appends a fingerprint larger than all others to the table.
+  /// @param fingerprint The fingerprint.
+  /// @param count The number of its copies.
+  /// @param pos The first slot after the table, which receives the new one.
+  /// @return `false` if the table has no room left.
+  bool append(uint64_t fingerprint, size_t count, size_t& pos);
+
+  /// Reads the next fingerprint from the table.
+  /// @param pos The slot to continue at, initially 0.
+  /// @param quotient The quotient of the last run, initially npos.
+  /// @return `false` after the last fingerprint.
+  bool next(size_t& pos, size_t& quotient, uint64_t& fingerprint,
+            size_t& count) const;
+
+  /// Allocates an empty table.
+  void allocate(size_t quotient_bits, size_t remainder_bits);
+
+  /// Exchanges the tables of two filters.
+  void swap(quotient_filter& other);
+
+  std::shared_ptr<base_hasher> hasher_;
+  /// The remainder of each slot followed by three bits of metadata.
+  counter_vector slots_;
+  /// Marks the quotients that have a run.
+  bitvector occupieds_;
+  size_t quotient_bits_ = 0;
+  size_t remainder_bits_ = 0;
+  size_t size_ = 0;
+  size_t used_ = 0;
+};
+
+} // namespace bf
+
+#endif
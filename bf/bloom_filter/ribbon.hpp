@@ -0,0 +1,121 @@
+#ifndef BF_BLOOM_FILTER_RIBBON_HPP
+#define BF_BLOOM_FILTER_RIBBON_HPP
+
+#include <bf/bitvector.hpp>
+#include <bf/bloom_filter.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A static homogeneous Ribbon filter after Dillinger and Walzer. Each key
+/// maps to a random row of 128 coefficients that starts at some slot *s*,
+/// and the filter stores a matrix *Z* of *r*-bit rows such that the product
+/// of the row with *Z* is zero for every key, i.e., the rows of *Z* at the
+/// set coefficients, counted from *s*, XOR to zero. For any other element
+/// the product is about uniformly distributed, so the false-positive
+/// probability is close to @f$2^{-r}@f$ at about 4% more than *r* bits per
+/// key.
+///
+/// Construction sorts the keys by their start and inserts each row into a
+/// banded linear system by Gaussian elimination on the fly, which touches
+/// only the 128 slots from its start. Since the system is homogeneous, it
+/// always has a solution: back substitution picks one at random, and
+/// construction never fails. The filter stores *Z* column by column in
+/// blocks of 64 slots, so that a lookup reads *r* words each from three
+/// adjacent blocks. Elements cannot be added or removed afterwards.
+class ribbon_filter : public bloom_filter
+{
+public:
+  /// The number of slots per key beyond one. Fewer slots raise the
+  /// false-positive probability above @f$2^{-r}@f$, since rows that cross
+  /// crowded slots often depend on the rows of the keys.
+  constexpr static double overhead = 0.04;
+
+  ribbon_filter() = default;
+
+  /// Constructs an empty Ribbon filter.
+  /// @param h The hasher, whose first digest determines the start and the
+  /// coefficients of a key.
+  /// @param result_bits The number of bits *r* per slot.
+  /// @pre `result_bits > 0 && result_bits <= 32`
+  ribbon_filter(std::shared_ptr<base_hasher> h, size_t result_bits = 8);
+
+  /// Constructs a Ribbon filter from a set of keys.
+  /// @param h The hasher.
+  /// @param keys The wrapped keys. Duplicates are fine.
+  /// @param result_bits The number of bits *r* per slot.
+  /// @pre `result_bits > 0 && result_bits <= 32`
+  ribbon_filter(std::shared_ptr<base_hasher> h, span<object const> keys,
+                size_t result_bits = 8);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  /// Fails, since the filter is static and would miss *o*; see build().
+  /// @throws std::logic_error always.
+  virtual void add(object const& o) override;
+
+  /// Retrieves the count of an element.
+  /// @param o The object to look up.
+  /// @return 1 if the filter contains *o* and 0 otherwise.
+  virtual size_t lookup(object const& o) const override;
+
+  /// Looks up a sequence of elements. Hashes a batch of elements and
+  /// prefetches their blocks before probing the first.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives the frequency estimate of `objects[i]` at
+  /// position *i*.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override;
+
+  /// Removes all keys.
+  virtual void clear() override;
+
+  /// Replaces the keys of the filter.
+  /// @param keys The wrapped keys. Duplicates are fine.
+  void build(span<object const> keys);
+
+  /// Retrieves the number of keys the filter was built from.
+  size_t size() const;
+
+  /// Retrieves the number of slots.
+  size_t slots() const;
+
+  /// Retrieves the number of bits per slot.
+  size_t result_bits() const;
+
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+  /// The coefficients of a row.
+  typedef unsigned __int128 row_type;
+
+private:
+  /// Sizes the matrix for a number of keys.
+  void layout(size_t keys);
+
+  /// Computes the hash of a key from which its row derives.
+  uint64_t hash(object const& o) const;
+
+  /// Computes the start of the row of a hash.
+  size_t start(uint64_t hash) const;
+
+  /// Computes the coefficients of the row of a hash, bit *i* for slot
+  /// `start(hash) + i`.
+  row_type coefficients(uint64_t hash) const;
+
+  /// Checks whether the product of the row of a hash with the matrix is 0.
+  bool satisfies(uint64_t hash) const;
+
+  std::shared_ptr<base_hasher> hasher_;
+  /// Column *j* of the slots in block *b* resides in block `b * r + j`.
+  bitvector columns_;
+  size_t result_bits_ = 8;
+  size_t slots_ = 0;
+  size_t size_ = 0;
+};
+
+} // namespace bf
+
+#endif
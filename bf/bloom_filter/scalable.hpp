@@ -0,0 +1,110 @@
+#ifndef BF_BLOOM_FILTER_SCALABLE_HPP
+#define BF_BLOOM_FILTER_SCALABLE_HPP
+
+#include <bf/bloom_filter/basic.hpp>
+
+namespace bf {
+
+/// A scalable Bloom filter after Almeida et al., which grows with the number
+/// of elements instead of requiring a capacity up front. It chains
+/// partitioned basic Bloom filters, its *stages*. Stage *i* holds
+/// @f$n_0 s^i@f$ elements at a false-positive probability of
+/// @f$p_0 r^i@f$, with @f$p_0 = p(1 - r)@f$, so that the false-positive
+/// probability of all stages together stays below *p* however many stages
+/// there are.
+///
+/// Insertions of elements that no stage contains go to the newest stage,
+/// which tracks how many elements and bits it has. Once half of its bits
+/// are set, the fill ratio at which it reaches its target rate, or once it
+/// holds its capacity, a new stage starts. All stages use enhanced double
+/// hashing of the same 128-bit hash, and their hash functions are prefixes of
+/// those of the newest stage, so an operation hashes an element once for all
+/// stages. Lookups probe the newest stage first.
+class scalable_bloom_filter : public bloom_filter
+{
+public:
+  scalable_bloom_filter() = default;
+
+  /// Constructs a scalable Bloom filter.
+  /// @param fp The bound on the false-positive probability.
+  /// @param capacity The number of elements of the first stage.
+  /// @param growth The factor *s* by which the capacity of a stage exceeds
+  /// the one of its predecessor.
+  /// @param tightening The factor *r* by which the false-positive
+  /// probability of a stage falls below the one of its predecessor.
+  /// @param seed The seed of the hash function.
+  /// @pre `fp > 0 && fp < 1 && capacity > 0 && growth >= 1`
+  /// @pre `tightening > 0 && tightening < 1`
+  scalable_bloom_filter(double fp, size_t capacity, double growth = 2,
+                        double tightening = 0.85, uint64_t seed = 0);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  virtual void add(object const& o) override;
+
+  /// Retrieves the count of an element.
+  /// @param o The object to look up.
+  /// @return 1 if one of the stages contains *o* and 0 otherwise.
+  virtual size_t lookup(object const& o) const override;
+
+  /// Removes all elements and all stages but the first.
+  virtual void clear() override;
+
+  /// Retrieves the number of stages.
+  size_t stages() const;
+
+  /// Retrieves a stage.
+  /// @param i The index of the stage, 0 for the oldest.
+  /// @pre `i < stages()`
+  basic_bloom_filter const& stage(size_t i) const;
+
+  /// Retrieves the number of insertions of elements that no stage
+  /// contained, i.e., the number of distinct elements up to false
+  /// positives.
+  size_t elements() const;
+
+  /// Computes the false-positive probability that the current stages
+  /// guarantee together, at most the one given at construction.
+  double fpr_bound() const;
+
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  /// Appends a stage.
+  void grow();
+
+  /// Probes the stages for an element, newest first.
+  /// @param digests The digests of the element for the newest stage.
+  /// @param indices A buffer for the bit positions in a stage.
+  /// @return `true` if a stage contains the element.
+  bool find(digest_buffer const& digests, digest_buffer& indices) const;
+
+  /// Maps the digests of an element to the bit positions in a stage.
+  /// @param stage The stage.
+  /// @param digests The digests of the element for the newest stage.
+  /// @param indices Receives the bit positions.
+  static void stage_indices(basic_bloom_filter const& stage,
+                            digest_buffer const& digests,
+                            digest_buffer& indices);
+
+  /// Computes the false-positive probability of a stage.
+  /// @param i The index of the stage.
+  double stage_fp(size_t i) const;
+
+  double fp_ = 0;
+  size_t capacity_ = 0;
+  double growth_ = 2;
+  double tightening_ = 0.85;
+  uint64_t seed_ = 0;
+  std::vector<basic_bloom_filter> stages_;
+  /// The number of elements in each stage.
+  std::vector<size_t> elements_;
+  /// The number of bits set in the newest stage.
+  size_t ones_ = 0;
+};
+
+} // namespace bf
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef BF_BLOOM_FILTER_SHARDED_HPP
+#define BF_BLOOM_FILTER_SHARDED_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string.h>
+
+#include <bf/bloom_filter.hpp>
+#include <bf/container.hpp>
+#include <bf/hash.hpp>
+#include <bf/parallel.hpp>
+#include <bf/wyhash.hpp>
+
+namespace bf {
+
+/// A Bloom filter that routes each element to one of several independent
+/// inner filters, its *shards*. The high bits of a hash that is independent
+/// of the inner filters select the shard, so that threads adding different
+/// elements rarely touch the same shard and never the same cache lines.
+///
+/// Each shard has its own lock, so any number of threads may call `add`,
+/// `add_many`, `lookup` and `lookup_many` at once. A thread that owns a
+/// shard may also bypass the lock through shard(), routing its elements with
+/// shard_of(). Since every element lives in exactly one shard, a lookup in
+/// that shard answers for the whole filter.
+///
+/// @tparam F The type of the inner filters, any default-constructible
+/// subclass of bloom_filter.
+template <typename F>
+class sharded_bloom_filter : public bloom_filter
+{
+public:
+  /// Usage counters of a single shard since it was last cleared.
+  struct statistics
+  {
+    size_t adds = 0;      ///< The number of elements added.
+    size_t lookups = 0;   ///< The number of elements looked up.
+    size_t positives = 0; ///< The number of lookups with a nonzero count.
+  };
+
+  sharded_bloom_filter() = default;
+
+  /// Constructs a sharded Bloom filter.
+  /// @param shards The number of inner filters.
+  /// @param args The arguments to construct each inner filter with. Inner
+  /// filters may share hashers, whose digests are pure functions.
+  /// @pre `shards > 0`
+  template <typename... Args>
+  sharded_bloom_filter(size_t shards, Args const&... args)
+  {
+    assert(shards > 0);
+    for (size_t i = 0; i < shards; ++i)
+      shards_.emplace_back(new slot(args...));
+  }
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  virtual void add(object const& o) override
+  {
+    auto& s = *shards_[shard_of(o)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.filter.add(o);
+    ++s.stats.adds;
+  }
+
+  virtual size_t lookup(object const& o) const override
+  {
+    auto& s = *shards_[shard_of(o)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto count = s.filter.lookup(o);
+    ++s.stats.lookups;
+    if (count > 0)
+      ++s.stats.positives;
+    return count;
+  }
+
+  /// Adds a sequence of elements. Groups them by shard and takes the lock
+  /// of each shard once.
+  /// @param objects The wrapped objects to add.
+  virtual void add_many(span<object const> objects) override
+  {
+    std::vector<std::vector<object>> groups(shards_.size());
+    for (auto& o : objects)
+      groups[shard_of(o)].push_back(o);
+    for (size_t i = 0; i < groups.size(); ++i) {
+      if (groups[i].empty())
+        continue;
+      auto& s = *shards_[i];
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.filter.add_many(groups[i]);
+      s.stats.adds += groups[i].size();
+    }
+  }
+
+  /// Looks up a sequence of elements. Groups them by shard and takes the
+  /// lock of each shard once.
+  /// @param objects The wrapped objects to query.
+  /// @param counts Receives the frequency estimate of `objects[i]` at
+  /// position *i*.
+  /// @pre `counts.size() >= objects.size()`
+  virtual void lookup_many(span<object const> objects,
+                           span<size_t> counts) const override
+  {
+    assert(counts.size() >= objects.size());
+    std::vector<std::vector<object>> groups(shards_.size());
+    std::vector<std::vector<size_t>> positions(shards_.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+      auto j = shard_of(objects[i]);
+      groups[j].push_back(objects[i]);
+      positions[j].push_back(i);
+    }
+    std::vector<size_t> results;
+    for (size_t i = 0; i < groups.size(); ++i) {
+      if (groups[i].empty())
+        continue;
+      auto& s = *shards_[i];
+      results.resize(groups[i].size());
+      {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.filter.lookup_many(groups[i], results);
+        s.stats.lookups += results.size();
+        for (auto count : results)
+          if (count > 0)
+            ++s.stats.positives;
+      }
+      for (size_t j = 0; j < results.size(); ++j)
+        counts[positions[i][j]] = results[j];
+    }
+  }
+
+  /// Clears all shards in parallel.
+  virtual void clear() override
+  {
+    for_each_shard([this](size_t i) { clear(i); });
+  }
+
+  /// Clears a single shard and its statistics, e.g., to rebuild it.
+  /// @param i The index of the shard.
+  /// @pre `i < shards()`
+  void clear(size_t i)
+  {
+    auto& s = *shards_[i];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.filter.clear();
+    s.stats = {};
+  }
+
+  /// Retrieves the number of shards.
+  size_t shards() const
+  {
+    return shards_.size();
+  }
+
+  /// Determines the shard that holds an element.
+  /// @param o A wrapped object.
+  /// @return The index of the shard of *o*.
+  size_t shard_of(object const& o) const
+  {
+    auto h = mix(wyhash::hash(o.data(), o.size(), seed_));
+    return map_index(h, shards_.size(), index_mapping::fast_range);
+  }
+
+  template <typename T>
+  size_t shard_of(T const& x) const
+  {
+    return shard_of(wrap(x));
+  }
+
+  /// Accesses an inner filter without locking, for a thread that owns the
+  /// shard or while no other thread uses it.
+  /// @param i The index of the shard.
+  /// @pre `i < shards()`
+  F& shard(size_t i)
+  {
+    return shards_[i]->filter;
+  }
+
+  F const& shard(size_t i) const
+  {
+    return shards_[i]->filter;
+  }
+
+  /// Retrieves the usage counters of a shard. Operations through shard()
+  /// bypass them.
+  /// @param i The index of the shard.
+  /// @pre `i < shards()`
+  statistics stats(size_t i) const
+  {
+    auto& s = *shards_[i];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.stats;
+  }
+
+  /// Serializes all shards in parallel, each into a container of its own,
+  /// so that shards can be stored and rebuilt independently.
+  /// @return The containers of the shards in order.
+  std::vector<std::vector<char>> save_shards() const
+  {
+    std::vector<std::vector<char>> result(shards_.size());
+    for_each_shard([&](size_t i) {
+      auto& s = *shards_[i];
+      std::lock_guard<std::mutex> lock(s.mutex);
+      result[i] = bf::save(s.filter);
+    });
+    return result;
+  }
+
+  /// Replaces a shard with one from a container that save_shards() created.
+  /// @param i The index of the shard.
+  /// @param buf The container.
+  /// @param len The size of *buf* in bytes.
+  /// @return 0 on success.
+  /// @pre `i < shards()`
+  int load_shard(size_t i, char const* buf, uint64_t len)
+  {
+    container_reader r;
+    if (auto status = r.open(buf, len))
+      return status;
+    auto& s = *shards_[i];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.filter.read(r) != 0 || !r.done())
+      return 1;
+    s.stats = {};
+    return 0;
+  }
+
+  virtual char* serialize(char* buf) override
+  {
+    for (auto& s : shards_) {
+      unsigned int size = s->filter.serializedSize();
+      memmove(buf, &size, sizeof(size));
+      buf = s->filter.serialize(buf + sizeof(size));
+    }
+    return buf;
+  }
+
+  virtual unsigned int serializedSize() const override
+  {
+    unsigned int size = 0;
+    for (auto& s : shards_)
+      size += sizeof(unsigned int) + s->filter.serializedSize();
+    return size;
+  }
+
+  virtual int fromBuf(const char* buf, unsigned int len) override
+  {
+    auto end = buf + len;
+    for (auto& s : shards_) {
+      unsigned int size;
+      if (static_cast<size_t>(end - buf) < sizeof(size))
+        return 1;
+      memmove(&size, buf, sizeof(size));
+      buf += sizeof(size);
+      if (static_cast<size_t>(end - buf) < size
+          || s->filter.fromBuf(buf, size) != 0)
+        return 2;
+      buf += size;
+    }
+    return buf == end ? 0 : 3;
+  }
+
+  /// Appends all shards to a container. The sections reference the storage
+  /// of the shards, so writing the container itself does not copy them.
+  /// @param w The container to append to.
+  virtual void write(container_writer& w) const override
+  {
+    w.parameters(filter_type::sharded, {shards_.size(), seed_});
+    for (auto& s : shards_)
+      s->filter.write(w);
+  }
+
+  virtual int read(container_reader& r) override
+  {
+    std::vector<uint64_t> params;
+    if (r.parameters(filter_type::sharded, params) != 0 || params.size() != 2
+        || params[0] == 0)
+      return 1;
+    std::vector<std::unique_ptr<slot>> shards;
+    for (uint64_t i = 0; i < params[0]; ++i) {
+      shards.emplace_back(new slot);
+      if (shards.back()->filter.read(r) != 0)
+        return 2;
+    }
+    shards_ = std::move(shards);
+    seed_ = params[1];
+    return 0;
+  }
+
+private:
+  /// The seed of the routing hash. It lies outside the golden-ratio sequence
+  /// that wy_hasher steps its seeds through, and the routing digest goes
+  /// through mix() on top, so no inner hasher reproduces it: otherwise every
+  /// element of a shard would share the high bits of one of its digests.
+  static constexpr uint64_t default_seed = 0xc2b2ae3d27d4eb4fULL;
+
+  /// An inner filter with its lock and statistics.
+  struct slot
+  {
+    template <typename... Args>
+    slot(Args const&... args)
+      : filter(args...)
+    {
+    }
+
+    F filter;
+    mutable std::mutex mutex;
+    mutable statistics stats;
+  };
+
+  /// Applies a function to each shard index on up to one thread per core.
+  template <typename G>
+  void for_each_shard(G g) const
+  {
+    auto threads = std::min(concurrency(0), shards_.size());
+    parallel(threads, [&](size_t t) {
+      for (auto i = t; i < shards_.size(); i += threads)
+        g(i);
+    });
+  }
+
+  uint64_t seed_ = default_seed;
+  std::vector<std::unique_ptr<slot>> shards_;
+};
+
+template <typename F>
+constexpr uint64_t sharded_bloom_filter<F>::default_seed;
+
+} // namespace bf
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef BF_BLOOM_FILTER_SPLIT_BLOCK_HPP
+#define BF_BLOOM_FILTER_SPLIT_BLOCK_HPP
+
+#include <cstdint>
+#include <vector>
+#include <bf/aligned_allocator.hpp>
+#include <bf/bloom_filter.hpp>
+#include <bf/hash.hpp>
+
+namespace bf {
+
+/// A split-block Bloom filter. Each element maps to one 256-bit block of
+/// eight 32-bit words and sets exactly one bit in every word. The eight bit
+/// positions derive from a single digest by multiplying it with eight odd
+/// constants, which maps to a handful of AVX2 instructions. CPUs without AVX2
+/// use an equivalent scalar implementation.
+class split_block_bloom_filter : public bloom_filter
+{
+public:
+  /// The number of bits per block.
+  constexpr static size_t block_bits = 256;
+
+  /// Computes the expected false-positive rate of a split-block Bloom filter.
+  ///
+  /// @param cells The number of cells.
+  ///
+  /// @param capacity The number of elements.
+  ///
+  /// @return The false-positive rate after adding *capacity* elements.
+  static double fp(size_t cells, size_t capacity);
+
+  /// Computes the number of cells based on a false-positive rate and capacity.
+  ///
+  /// @param fp The desired false-positive rate
+  ///
+  /// @param capacity The maximum number of items.
+  ///
+  /// @return The number of cells, a multiple of `block_bits`, that guarantee
+  /// *fp* for *capacity* elements.
+  static size_t m(double fp, size_t capacity);
+
+  split_block_bloom_filter() = default;
+
+  /// Constructs a split-block Bloom filter.
+  /// @param h The hasher to use. Only the first digest of each element
+  /// matters, so a hasher with `k() == 1` suffices.
+  /// @param cells The number of cells, rounded up to a multiple of
+  /// `block_bits`.
+  /// @pre `cells / block_bits < 2^32`
+  split_block_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells);
+
+  /// Constructs a split-block Bloom filter by given a desired false-positive
+  /// probability and an expected number of elements.
+  ///
+  /// @param fp The desired false-positive probability.
+  ///
+  /// @param capacity The expected number of elements.
+  ///
+  /// @param seed The initial seed used to construct the hash function.
+  split_block_bloom_filter(double fp, size_t capacity, size_t seed = 0);
+
+  using bloom_filter::add;
+  using bloom_filter::lookup;
+
+  virtual void add(object const& o) override;
+  virtual size_t lookup(object const& o) const override;
+  virtual void clear() override;
+
+  /// Retrieves the number of cells.
+  /// @return The number of bits in the filter.
+  size_t size() const;
+
+  /// Returns the hasher of the Bloom filter.
+  std::shared_ptr<base_hasher> const& hasher_function() const;
+
+  char* serialize(char* buf) override;
+  unsigned int serializedSize() const override;
+  int fromBuf(const char* buf, unsigned int len) override;
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
+private:
+  constexpr static size_t words_per_block = block_bits / 32;
+
+  /// Computes the mixed digest of an object.
+  digest hash(object const& o) const;
+
+  /// Computes the first word of the block for a mixed digest.
+  uint32_t* block(digest h);
+  uint32_t const* block(digest h) const;
+
+  std::shared_ptr<base_hasher> hasher_;
+  std::vector<uint32_t, aligned_allocator<uint32_t>> words_;
+};
+
+} // namespace bf
+
+#endif
@@ -18,17 +18,29 @@ public:
   /// @pre `cells <= d`
   stable_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells, size_t width, size_t d);
 
+  stable_bloom_filter() = default;
+
   /// Adds an item to the stable Bloom filter.
   /// This invovles first decrementing *k* positions uniformly at random and
   /// then setting the counter of *o* to all 1s.
   /// @param o The object to add.
   virtual void add(object const& o) override;
 
+  /// Adds a sequence of elements one by one. The random decrements dominate
+  /// the cost of an insertion, so batching does not pay off.
+  /// @param objects The wrapped objects to add.
+  virtual void add_many(span<object const> objects) override;
+
   using bloom_filter::add;
   using bloom_filter::lookup;
 
+  /// Writes the cells and *d*, but not the state of the random number
+  /// generator.
+  void write(container_writer& w) const override;
+  int read(container_reader& r) override;
+
 private:
-  size_t d_;
+  size_t d_ = 0;
   std::mt19937 generator_;
   std::uniform_int_distribution<> unif_;
 };
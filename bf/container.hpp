@@ -0,0 +1,290 @@
+#ifndef BF_CONTAINER_HPP
+#define BF_CONTAINER_HPP
+
+#include <cstdint>
+#include <initializer_list>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bf {
+
+class base_hasher;
+class bloom_filter;
+
+/// Computes the CRC-32C (Castagnoli) checksum of a byte sequence, with the
+/// SSE 4.2 `crc32` instruction if the CPU supports it.
+/// @param data The bytes to checksum.
+/// @param size The number of bytes.
+/// @param crc The checksum of preceding bytes, to checksum in pieces.
+/// @return The checksum of all bytes so far.
+uint32_t crc32c(void const* data, uint64_t size, uint32_t crc = 0);
+
+/// Identifies the Bloom filter classes in a container.
+enum class filter_type : uint32_t
+{
+  basic = 1,
+  counting = 2,
+  spectral_mi = 3,
+  spectral_rm = 4,
+  stable = 5,
+  blocked = 6,
+  split_block = 7,
+  a2 = 8,
+  bitwise = 9,
+  sharded = 10,
+  scalable = 11,
+  cuckoo = 12,
+  quotient = 13,
+  binary_fuse = 14,
+  ribbon = 15,
+  count_min = 16,
+};
+
+/// The contents of a container section.
+enum class section_kind : uint32_t
+{
+  parameters = 1, ///< 64-bit values that describe a filter.
+  hasher = 2,     ///< A serialized hasher.
+  blocks = 3,     ///< The raw storage of a filter.
+};
+
+/// The container format stores a Bloom filter as a file that can be mapped
+/// into memory and used in place.
+///
+/// A container starts with a 64-byte header:
+///
+///   offset  size  field
+///        0     8  magic "LIBBF\r\n\x1a"
+///        8     4  format version (1)
+///       12     4  byte order mark 0x01020304
+///       16     4  filter type of the outermost filter
+///       20     4  CRC-32C of header and section table (this field as 0)
+///       24     8  number of sections
+///       32     8  size of the container in bytes
+///       40    24  reserved, 0
+///
+/// A table of 32-byte section entries follows the header:
+///
+///   offset  size  field
+///        0     4  section kind
+///        4     4  CRC-32C of the section payload
+///        8     8  offset of the payload from the start of the container
+///       16     8  size of the payload in bytes
+///       24     8  kind-specific count: the filter type of a parameters
+///                 section, the number of elements of a blocks section
+///
+/// Each payload starts at a multiple of 64 bytes, so that the blocks of a
+/// filter may serve as its storage right in a memory-mapped container.
+/// Integers have host byte order; readers reject containers from hosts with
+/// a different byte order.
+///
+/// A filter writes a parameters section tagged with its type, followed by
+/// the sections of its components in a fixed order.
+class container_writer
+{
+public:
+  /// Appends a section of parameters.
+  /// @param type The type of the filter that the parameters describe.
+  /// @param values The parameters.
+  void parameters(filter_type type, std::initializer_list<uint64_t> values);
+
+  /// Appends a variable number of parameters.
+  /// @param type The type of the filter that the parameters describe.
+  /// @param values The parameters.
+  void parameters(filter_type type, std::vector<uint64_t> const& values);
+
+  /// Appends a serialized hasher.
+  /// @param h The hasher to serialize.
+  void hasher(base_hasher& h);
+
+  /// Appends a section of raw storage without copying it.
+  /// @param data The storage, which must stay alive and unchanged until the
+  /// writer has written the container.
+  /// @param size The size of the storage in bytes.
+  /// @param count The number of elements in the storage.
+  void blocks(void const* data, uint64_t size, uint64_t count);
+
+  /// Retrieves the size of the container.
+  /// @return The number of bytes that `write` produces.
+  uint64_t size() const;
+
+  /// Writes the container.
+  /// @param buf The destination of `size()` bytes.
+  /// @return The end of the container in *buf*.
+  char* write(char* buf) const;
+
+  /// Writes the container to a stream. Writes the sections straight from the
+  /// storage of the filter, without an intermediate buffer.
+  /// @param out The stream to write to.
+  /// @return `true` on success.
+  bool write(std::ostream& out) const;
+
+  /// Writes the container to a file descriptor with `writev`, straight from
+  /// the storage of the filter.
+  /// @param fd The file descriptor to write to.
+  /// @return `true` on success, `false` with `errno` set otherwise.
+  bool write(int fd) const;
+
+private:
+  struct section
+  {
+    section_kind kind;
+    char const* data;
+    uint64_t size;
+    uint64_t count;
+  };
+
+  void add(section_kind kind, std::string bytes, uint64_t count);
+
+  /// Computes the header and the section table.
+  std::string header() const;
+
+  std::vector<section> sections_;
+  std::vector<std::unique_ptr<std::string>> owned_;
+  filter_type type_ = filter_type::basic;
+};
+
+/// Reads the sections of a container in order, either from memory or from a
+/// stream. From a stream, the reader copies each large section straight into
+/// the storage of the filter, so that reading needs no buffer of the size of
+/// the container.
+class container_reader
+{
+public:
+  /// The errors of `open`. All other member functions return 1 if the next
+  /// section does not match the expectation.
+  enum error
+  {
+    truncated = 2,
+    bad_magic = 3,
+    bad_version = 4,
+    bad_byte_order = 5,
+    bad_header_checksum = 6,
+    bad_section = 7,
+    bad_section_checksum = 8,
+    read_error = 9,
+  };
+
+  /// Validates a container.
+  /// @param buf The container.
+  /// @param len The size of *buf*.
+  /// @param owner Keeps *buf* alive. If set, filters may use storage in
+  /// *buf* in place instead of copying it.
+  /// @param verify Whether to verify the checksums of all sections.
+  /// Skipping them avoids reading the entire container up front.
+  /// @return 0 on success.
+  int open(char const* buf, uint64_t len,
+           std::shared_ptr<void const> owner = nullptr, bool verify = true);
+
+  /// Reads the header of a container from a stream. The reader consumes the
+  /// rest of the stream section by section and verifies each checksum when
+  /// it reads the section.
+  /// @param in The stream positioned at the start of the container.
+  /// @return 0 on success.
+  int open(std::istream& in);
+
+  /// Retrieves the type of the outermost filter.
+  filter_type type() const
+  {
+    return type_;
+  }
+
+  /// Retrieves the owner of the container memory.
+  /// @return The owner or `nullptr` if filters must copy their storage.
+  std::shared_ptr<void const> const& owner() const
+  {
+    return owner_;
+  }
+
+  /// Reads a section of parameters.
+  /// @param type The expected filter type.
+  /// @param values Receives the parameters.
+  /// @return 0 on success.
+  int parameters(filter_type type, std::vector<uint64_t>& values);
+
+  /// Reads a hasher.
+  /// @param h Receives the hasher.
+  /// @return 0 on success.
+  int hasher(std::shared_ptr<base_hasher>& h);
+
+  /// Advances to a section of raw storage. Afterwards, either use the
+  /// storage in place with `data()` or copy it with `copy()`.
+  /// @param size Receives the size of the storage in bytes.
+  /// @param count Receives the number of elements.
+  /// @return 0 on success.
+  int blocks(uint64_t& size, uint64_t& count);
+
+  /// Retrieves the storage of the current section in place.
+  /// @return The storage, aligned to 64 bytes, or `nullptr` for a reader of
+  /// a stream.
+  char const* data() const
+  {
+    return data_;
+  }
+
+  /// Copies the storage of the current section.
+  /// @param dst The destination of `size` bytes, as returned by `blocks()`.
+  /// @return 0 on success.
+  int copy(void* dst);
+
+  /// Checks whether all sections have been read.
+  bool done() const
+  {
+    return next_ == sections_;
+  }
+
+private:
+  /// Validates header and section table.
+  int check(char const* header, uint64_t len);
+
+  /// Advances to the next section of a given kind.
+  /// @return The table entry of the section or `nullptr`.
+  char const* next(section_kind kind, uint64_t& size, uint64_t& count);
+
+  /// Reads the payload of a section from the stream.
+  int read(char* dst, char const* entry);
+
+  /// Retrieves the payload of a small section.
+  char const* payload(char const* entry);
+
+  char const* buf_ = nullptr;
+  std::istream* in_ = nullptr;
+  uint64_t pos_ = 0;
+  std::string table_;
+  std::string small_;
+  char const* entries_ = nullptr;
+  char const* current_ = nullptr;
+  char const* data_ = nullptr;
+  uint64_t sections_ = 0;
+  uint64_t next_ = 0;
+  filter_type type_ = filter_type::basic;
+  std::shared_ptr<void const> owner_;
+};
+
+/// Writes a Bloom filter into a container.
+/// @param bf The filter to write.
+/// @return The container.
+std::vector<char> save(bloom_filter const& bf);
+
+/// Reads a Bloom filter of any type from a container.
+/// @param buf The container.
+/// @param len The size of *buf*.
+/// @param bf Receives the filter.
+/// @param owner Keeps *buf* alive, e.g., a `mapped_file`. If set, filters
+/// use storage in *buf* in place until their first modification.
+/// @param verify Whether to verify the checksums of all sections.
+/// @return 0 on success.
+int load(char const* buf, uint64_t len, std::unique_ptr<bloom_filter>& bf,
+         std::shared_ptr<void const> owner = nullptr, bool verify = true);
+
+/// Reads a Bloom filter of any type from a stream.
+/// @param in The stream positioned at the start of a container.
+/// @param bf Receives the filter.
+/// @return 0 on success.
+int load(std::istream& in, std::unique_ptr<bloom_filter>& bf);
+
+} // namespace bf
+
+#endif
@@ -8,7 +8,11 @@
 namespace bf {
 
 /// The *fixed width* storage policy implements a bit vector where each
-/// cell represents a counter having a fixed number of bits.
+/// cell represents a counter having a fixed number of bits. Counters are
+/// packed LSB first and accessed a machine word at a time. For widths that
+/// divide the block size (1, 2, 4, 8, 16, 32, 64) no counter straddles two
+/// blocks, and the lane-wise operations process all counters of a block at
+/// once.
 class counter_vector
 {
   /// Generates a string representation of a counter vector.
@@ -34,14 +38,44 @@ public:
   /// @pre `cells > 0 && width > 0`
   explicit counter_vector(size_t cells, size_t width);
 
-  /// Merges this counter vector with another counter vector.
+  /// Merges this counter vector with another counter vector by adding their
+  /// counters. Equivalent to add().
   /// @param other The other counter vector.
   /// @return A reference to `*this`.
   /// @pre `size() == other.size() && width() == other.width()`
   counter_vector& operator|=(counter_vector const& other);
 
-  /// Increments a cell counter by a given value. If the value is larger 
-  /// than or equal to max(), all bits are set to 1.
+  //
+  // Lane-wise operations. For widths 4, 8 and 16, they run on AVX2 if
+  // available, and on whole blocks for any width that divides the block size.
+  //
+
+  /// Adds the counters of another counter vector, saturating at max().
+  /// @param other The other counter vector.
+  /// @return A reference to `*this`.
+  /// @pre `size() == other.size() && width() == other.width()`
+  counter_vector& add(counter_vector const& other);
+
+  /// Subtracts the counters of another counter vector, saturating at 0.
+  /// @param other The other counter vector.
+  /// @return A reference to `*this`.
+  /// @pre `size() == other.size() && width() == other.width()`
+  counter_vector& subtract(counter_vector const& other);
+
+  /// Replaces each counter with its minimum of both counter vectors.
+  /// @param other The other counter vector.
+  /// @return A reference to `*this`.
+  /// @pre `size() == other.size() && width() == other.width()`
+  counter_vector& minimum(counter_vector const& other);
+
+  /// Replaces each counter with its maximum of both counter vectors.
+  /// @param other The other counter vector.
+  /// @return A reference to `*this`.
+  /// @pre `size() == other.size() && width() == other.width()`
+  counter_vector& maximum(counter_vector const& other);
+
+  /// Increments a cell counter by a given value. If the sum exceeds max(),
+  /// the counter saturates at max().
   ///
   /// @param cell The cell index.
   ///
@@ -53,12 +87,15 @@ public:
   /// @pre `cell < size()`
   bool increment(size_t cell, size_t value = 1);
 
-  /// Decrements a cell counter.
+  /// Decrements a cell counter. If *value* exceeds the counter, the counter
+  /// saturates at 0.
   ///
   /// @param cell The cell index.
   ///
-  /// @return `true` if decrementing succeeded, `false` if all bits in the
-  /// cell were already 0.
+  /// @param value The value that is subtracted from the current cell value.
+  ///
+  /// @return `true` if decrementing succeeded, `false` if the counter was
+  /// smaller than *value*.
   ///
   /// @pre `cell < size()`
   bool decrement(size_t cell, size_t value = 1);
@@ -72,6 +109,47 @@ public:
   /// @pre `cell < size()`
   size_t count(size_t cell) const;
 
+  //
+  // Atomic operations. They update the block that holds a cell with a
+  // compare-and-swap loop, so that many threads can modify cells of the same
+  // block at once. They require a width that divides the block size and
+  // storage that the counter vector owns, i.e., no view of a mapping.
+  //
+
+  /// Atomically increments a cell counter, saturating at max().
+  /// @param cell The cell index.
+  /// @param value The value that is added to the current cell value.
+  /// @return `true` if the increment succeeded, `false` if the counter
+  /// saturated.
+  /// @pre `cell < size() && bitvector::bits_per_block % width() == 0`
+  bool increment_atomic(size_t cell, size_t value = 1);
+
+  /// Atomically decrements a cell counter, saturating at 0.
+  /// @param cell The cell index.
+  /// @param value The value that is subtracted from the current cell value.
+  /// @return `true` if decrementing succeeded, `false` if the counter was
+  /// smaller than *value*.
+  /// @pre `cell < size() && bitvector::bits_per_block % width() == 0`
+  bool decrement_atomic(size_t cell, size_t value = 1);
+
+  /// Atomically retrieves the counter of a cell.
+  /// @param cell The cell index.
+  /// @return The counter associated with *cell*.
+  /// @pre `cell < size() && bitvector::bits_per_block % width() == 0`
+  size_t count_atomic(size_t cell) const;
+
+  /// Atomically sets all counter values to 0.
+  void clear_atomic();
+
+  /// Hints the CPU to fetch the bits of a cell into the cache.
+  /// @param cell The cell index.
+  /// @pre `cell < size()`
+  void prefetch(size_t cell) const
+  {
+    bits_.prefetch(cell * width_);
+    bits_.prefetch(cell * width_ + width_ - 1);
+  }
+
   /// Sets a cell to a given value.
   /// @param cell The cell whose value changes.
   /// @param value The new value of the cell.
@@ -97,6 +175,17 @@ public:
   unsigned int serializedSize() const;
   int fromBuf(const char* buf, unsigned len);
 
+  /// Appends the cells to a container without copying them. The owner of
+  /// the counter vector records the width.
+  /// @param w The container to append to.
+  void write(container_writer& w) const;
+
+  /// Reads the cells from the next section of a container.
+  /// @param r The container to read from.
+  /// @param width The number of bits per cell.
+  /// @return 0 on success.
+  int read(container_reader& r, size_t width);
+
 private:
   bitvector bits_;
   size_t width_;
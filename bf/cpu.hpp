@@ -0,0 +1,21 @@
+#ifndef BF_CPU_HPP
+#define BF_CPU_HPP
+
+namespace bf {
+
+/// The CPU features that vectorized code paths may use.
+struct cpu_features
+{
+  bool popcnt = false;
+  bool sse42 = false;
+  bool avx2 = false;
+};
+
+/// The features of the executing CPU, detected via CPUID at startup. All
+/// kernels fall back to portable scalar code for cleared flags, so clearing
+/// a flag (e.g., in a test) is always safe.
+extern cpu_features cpu;
+
+} // namespace bf
+
+#endif
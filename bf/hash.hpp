@@ -2,20 +2,153 @@
 #define BF_HASH_POLICY_HPP
 #include <bf/h3.hpp>
 #include <bf/object.hpp>
+#include <bf/wyhash.hpp>
+#include <algorithm>
 #include <functional>
 #include <memory>
+#include <vector>
 
 namespace bf {
 
 /// The hash digest type.
 typedef size_t digest;
 
+/// Specifies how a filter maps a digest to one of its *n* cells.
+enum class index_mapping : uint8_t
+{
+  /// `d % n`. Uses all bits of the digest, but costs a 64-bit division.
+  modulo = 0,
+  /// `(d * n) >> 64`, Lemire's multiply-shift "fast range" reduction. Costs
+  /// one multiplication and relies on the high-order bits of the digest. For
+  /// a power-of-two *n* it reduces to a shift.
+  fast_range = 1,
+};
+
 /// The hash function type.
 typedef std::function<digest(object const&)> hash_function;
 
+/// Maps a digest to a cell index.
+/// @param d The digest.
+/// @param n The number of cells.
+/// @param mapping The reduction to use.
+/// @return An index in `[0, n)`.
+/// @pre `n > 0`
+inline size_t map_index(digest d, size_t n, index_mapping mapping)
+{
+  if (mapping == index_mapping::fast_range)
+    return static_cast<size_t>((static_cast<unsigned __int128>(d) * n) >> 64);
+  return d % n;
+}
+
+/// Mixes the bits of a digest with the finalizer of MurmurHash3. The mixing
+/// is a bijection, so distinct digests stay distinct.
+/// @param d The digest.
+/// @return The mixed digest.
+inline digest mix(digest d)
+{
+  d ^= d >> 33;
+  d *= 0xff51afd7ed558ccdULL;
+  d ^= d >> 33;
+  d *= 0xc4ceb9fe1a85ec53ULL;
+  d ^= d >> 33;
+  return d;
+}
+
 /// A function that hashes an object *k* times.
 typedef std::function<std::vector<digest>(object const&)> hasher;
 
+/// A buffer of digests with inline storage. As long as no more than
+/// `inline_size` digests are requested, filling a digest buffer never touches
+/// the heap.
+class digest_buffer
+{
+  digest_buffer(digest_buffer const&) = delete;
+  digest_buffer& operator=(digest_buffer const&) = delete;
+
+public:
+  /// The number of digests that fit into the inline storage.
+  constexpr static size_t inline_size = 16;
+
+  /// Constructs a buffer holding *n* digests.
+  /// @param n The initial number of digests.
+  explicit digest_buffer(size_t n = 0) : data_(inline_), size_(0)
+  {
+    resize(n);
+  }
+
+  /// Changes the number of digests. Existing digests are preserved up to the
+  /// new size.
+  /// @param n The new number of digests.
+  void resize(size_t n)
+  {
+    if (n > capacity_) {
+      std::unique_ptr<digest[]> heap(new digest[n]);
+      std::copy(data_, data_ + size_, heap.get());
+      heap_ = std::move(heap);
+      data_ = heap_.get();
+      capacity_ = n;
+    }
+    size_ = n;
+  }
+
+  digest* data()
+  {
+    return data_;
+  }
+
+  digest const* data() const
+  {
+    return data_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+
+  digest& operator[](size_t i)
+  {
+    return data_[i];
+  }
+
+  digest operator[](size_t i) const
+  {
+    return data_[i];
+  }
+
+  digest* begin()
+  {
+    return data_;
+  }
+
+  digest* end()
+  {
+    return data_ + size_;
+  }
+
+  digest const* begin() const
+  {
+    return data_;
+  }
+
+  digest const* end() const
+  {
+    return data_ + size_;
+  }
+
+private:
+  digest inline_[inline_size];
+  std::unique_ptr<digest[]> heap_;
+  digest* data_;
+  size_t size_;
+  size_t capacity_ = inline_size;
+};
+
 class default_hash_function
 {
 public:
@@ -38,7 +171,36 @@ private:
 class base_hasher{
 public:
   base_hasher()=default;
-  virtual std::vector<digest> operator()(object const& o) const = 0;
+  virtual ~base_hasher() = default;
+
+  /// Retrieves the number of digests the hasher computes per object.
+  /// @return The number of hash functions *k*.
+  virtual size_t k() const = 0;
+
+  /// Hashes an object *k* times into caller-provided storage.
+  /// @param o The object to hash.
+  /// @param digests Storage for at least `k()` digests.
+  virtual void operator()(object const& o, digest* digests) const = 0;
+
+  /// Hashes an object *k* times into a digest buffer.
+  /// @param o The object to hash.
+  /// @param digests The buffer to resize to `k()` and fill.
+  void operator()(object const& o, digest_buffer& digests) const
+  {
+    digests.resize(k());
+    (*this)(o, digests.data());
+  }
+
+  /// Hashes an object *k* times.
+  /// @param o The object to hash.
+  /// @return The *k* digests of *o*.
+  std::vector<digest> operator()(object const& o) const
+  {
+    std::vector<digest> d(k());
+    (*this)(o, d.data());
+    return d;
+  }
+
   virtual char* serialize(char* buf) = 0;
   virtual unsigned int serializedSize() const = 0;
   virtual int fromBuf(const char*, unsigned int) = 0;
@@ -48,7 +210,9 @@ class ap_hasher : public base_hasher {
 public:
   ap_hasher() = default;
   ap_hasher(unsigned short idx_);
-  std::vector<digest> operator()(object const& o) const override;
+  using base_hasher::operator();
+  size_t k() const override;
+  void operator()(object const& o, digest* digests) const override;
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
   int fromBuf(const char*, unsigned int len) override;
@@ -63,7 +227,9 @@ public:
   default_hasher()=default;
   default_hasher(std::vector<std::shared_ptr<default_hash_function>>& fns);
 
-  std::vector<digest> operator()(object const& o) const override;
+  using base_hasher::operator();
+  size_t k() const override;
+  void operator()(object const& o, digest* digests) const override;
 
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
@@ -81,7 +247,9 @@ public:
   double_hasher(size_t k, std::shared_ptr<default_hash_function>& h1,
                 std::shared_ptr<default_hash_function>& h2);
 
-  std::vector<digest> operator()(object const& o) const override;
+  using base_hasher::operator();
+  size_t k() const override;
+  void operator()(object const& o, digest* digests) const override;
 
   char* serialize(char* buf) override;
   unsigned int serializedSize() const override;
@@ -93,6 +261,60 @@ private:
   std::shared_ptr<default_hash_function>  h2_;
 };
 
+/// A hasher which evaluates *k* differently seeded wyhash functions. Unlike
+/// the ::default_hash_function, it accepts objects of any size and needs no
+/// tables, so its state consists of *k* and a seed.
+class wy_hasher : public base_hasher
+{
+public:
+  wy_hasher() = default;
+
+  /// Constructs a wyhash hasher.
+  /// @param k The number of hash functions.
+  /// @param seed The seed from which the *k* functions derive.
+  wy_hasher(size_t k, uint64_t seed);
+
+  using base_hasher::operator();
+  size_t k() const override;
+  void operator()(object const& o, digest* digests) const override;
+
+  char* serialize(char* buf) override;
+  unsigned int serializedSize() const override;
+  int fromBuf(const char*, unsigned int len) override;
+
+private:
+  size_t k_ = 0;
+  uint64_t seed_ = 0;
+};
+
+/// A hasher which computes a single 128-bit wyhash per object and derives *k*
+/// digests from its two halves by enhanced double hashing (Kirsch and
+/// Mitzenmacher; Dillinger and Manolios): @f$g_i = h_1 + i h_2 + (i^3-i)/6@f$.
+/// The cubic term keeps the digests distinct even when @f$h_2@f$ degenerates
+/// modulo the filter size. Hashing reads the object once, independent of *k*.
+class enhanced_double_hasher : public base_hasher
+{
+public:
+  enhanced_double_hasher() = default;
+
+  /// Constructs an enhanced double hasher.
+  /// @param k The number of digests per object.
+  /// @param seed The seed of the underlying hash function.
+  enhanced_double_hasher(size_t k, uint64_t seed);
+
+  using base_hasher::operator();
+  size_t k() const override;
+  void operator()(object const& o, digest* digests) const override;
+
+  char* serialize(char* buf) override;
+  unsigned int serializedSize() const override;
+  int fromBuf(const char*, unsigned int len) override;
+
+private:
+  size_t k_ = 0;
+  uint64_t seed_ = 0;
+};
+
 class hasher_factory {
 public:
   static std::shared_ptr<base_hasher> createHasher(const char* type) {
@@ -103,25 +325,38 @@ public:
         return std::make_shared<double_hasher>();
       case 2:
         return std::make_shared<ap_hasher>();
+      case 3:
+        return std::make_shared<wy_hasher>();
+      case 4:
+        return std::make_shared<enhanced_double_hasher>();
       default:
         return nullptr;
     }
   }
 };
-/// Creates a default or double hasher with the default hash function, using
-/// seeds from a linear congruential PRNG.
+/// Creates a hasher for *k* digests per object.
 ///
 /// @param k The number of hash functions to use.
 ///
-/// @param seed The initial seed of the PRNG.
+/// @param seed The seed of the hash function.
 ///
-/// @param double_hashing If `true`, the function constructs a ::double_hasher
-/// and a ::default_hasher otherwise.
+/// @param double_hashing If `true`, the function constructs an
+/// ::enhanced_double_hasher, which hashes each object once. Otherwise it
+/// constructs an ::ap_hasher, which hashes each object *k* times.
 ///
 /// @return A ::hasher with the *k* hash functions.
 ///
 /// @pre `k > 0`
-std::shared_ptr<base_hasher> make_hasher(size_t k, size_t seed = 0, bool double_hashing = false);
+std::shared_ptr<base_hasher> make_hasher(size_t k, size_t seed = 0,
+                                         bool double_hashing = true);
+
+/// Checks whether two hashers compute the same digests, i.e., whether they
+/// serialize to the same bytes.
+/// @param x The first hasher.
+/// @param y The second hasher.
+/// @return `true` iff both exist and agree.
+bool same_hasher(std::shared_ptr<base_hasher> const& x,
+                 std::shared_ptr<base_hasher> const& y);
 } // namespace bf
 
 #endif
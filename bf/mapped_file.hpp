@@ -0,0 +1,49 @@
+#ifndef BF_MAPPED_FILE_HPP
+#define BF_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace bf {
+
+/// A read-only, shared memory mapping of a whole file. Processes that map the
+/// same file share its pages through the page cache, and pages load lazily on
+/// first access.
+class mapped_file
+{
+public:
+  /// Maps a file into memory.
+  /// @param path The file to map.
+  /// @return The mapping or `nullptr` if the file cannot be opened or mapped,
+  /// in which case `errno` describes the error.
+  static std::shared_ptr<mapped_file> open(std::string const& path);
+
+  mapped_file(mapped_file const&) = delete;
+  mapped_file& operator=(mapped_file const&) = delete;
+
+  ~mapped_file();
+
+  /// Retrieves the first byte of the file. The mapping starts at a page
+  /// boundary.
+  char const* data() const
+  {
+    return data_;
+  }
+
+  /// Retrieves the size of the file in bytes.
+  size_t size() const
+  {
+    return size_;
+  }
+
+private:
+  mapped_file(char const* data, size_t size);
+
+  char const* data_;
+  size_t size_;
+};
+
+} // namespace bf
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BF_PARALLEL_HPP
+#define BF_PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace bf {
+
+/// Resolves a requested number of threads.
+/// @param threads The requested number of threads, 0 for one per core.
+/// @return The number of threads to use, at least 1.
+inline size_t concurrency(size_t threads)
+{
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  return threads == 0 ? 1 : threads;
+}
+
+/// Runs a function on several threads at once and waits for all of them.
+/// The calling thread takes part as the first one.
+/// @param threads The number of threads.
+/// @param f The function to call with each thread index in `[0, threads)`.
+template <typename F>
+void parallel(size_t threads, F f)
+{
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; ++t)
+    workers.emplace_back([&f, t] { f(t); });
+  if (threads > 0)
+    f(0);
+  for (auto& w : workers)
+    w.join();
+}
+
+/// Sorts uniformly distributed hashes on several threads. Distributes them
+/// into small buckets by their high bits, then sorts the buckets in parallel.
+/// @param xs The hashes.
+/// @param threads The number of threads.
+inline void sort_hashes(std::vector<uint64_t>& xs, size_t threads)
+{
+  size_t bits = 1;
+  while (bits < 16 && (size_t(64) << bits) < xs.size())
+    ++bits;
+  auto buckets = size_t(1) << bits;
+  std::vector<size_t> offsets(buckets + 1);
+  for (auto x : xs)
+    ++offsets[(x >> (64 - bits)) + 1];
+  for (size_t b = 0; b < buckets; ++b)
+    offsets[b + 1] += offsets[b];
+  std::vector<uint64_t> sorted(xs.size());
+  auto next = offsets;
+  for (auto x : xs)
+    sorted[next[x >> (64 - bits)]++] = x;
+  parallel(threads, [&](size_t t) {
+    auto last = buckets * (t + 1) / threads;
+    for (auto b = buckets * t / threads; b < last; ++b)
+      std::sort(sorted.begin() + offsets[b], sorted.begin() + offsets[b + 1]);
+  });
+  xs.swap(sorted);
+}
+
+} // namespace bf
+
+#endif
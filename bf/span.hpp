@@ -0,0 +1,100 @@
+#ifndef BF_SPAN_HPP
+#define BF_SPAN_HPP
+
+#include <cstddef>
+#include <type_traits>
+
+namespace bf {
+
+/// A non-owning view of a contiguous sequence of objects.
+/// @tparam T The element type, `const`-qualified for read-only views.
+template <typename T>
+class span
+{
+public:
+  span() = default;
+
+  /// Constructs a span from a pointer and a length.
+  /// @param data The first element.
+  /// @param size The number of elements.
+  span(T* data, size_t size)
+    : data_(data), size_(size)
+  {
+  }
+
+  /// Constructs a span over a contiguous container, such as a `std::vector`
+  /// or another span.
+  /// @param c The container to view.
+  template <
+    typename Container,
+    typename = typename std::enable_if<
+      std::is_convertible<
+        decltype(std::declval<Container&>().data()), T*
+      >::value
+    >::type
+  >
+  span(Container& c)
+    : data_(c.data()), size_(c.size())
+  {
+  }
+
+  template <
+    typename Container,
+    typename = typename std::enable_if<
+      std::is_convertible<
+        decltype(std::declval<Container const&>().data()), T*
+      >::value
+    >::type
+  >
+  span(Container const& c)
+    : data_(c.data()), size_(c.size())
+  {
+  }
+
+  T* data() const
+  {
+    return data_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+
+  T& operator[](size_t i) const
+  {
+    return data_[i];
+  }
+
+  T* begin() const
+  {
+    return data_;
+  }
+
+  T* end() const
+  {
+    return data_ + size_;
+  }
+
+  /// Retrieves a subsequence.
+  /// @param offset The index of the first element.
+  /// @param count The number of elements.
+  /// @pre `offset + count <= size()`
+  span subspan(size_t offset, size_t count) const
+  {
+    return {data_ + offset, count};
+  }
+
+private:
+  T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+} // namespace bf
+
+#endif
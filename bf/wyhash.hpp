@@ -0,0 +1,131 @@
+#ifndef BF_WYHASH_HPP
+#define BF_WYHASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+
+namespace bf {
+
+/// An implementation of wyhash (final version 4) by Wang Yi, a fast 64-bit
+/// hash function for keys of arbitrary length. It consumes 16 or 48 bytes per
+/// step with 64x64->128-bit multiplications and needs no tables.
+class wyhash
+{
+public:
+  /// The default secret of the reference implementation.
+  constexpr static uint64_t secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL};
+
+  /// Hashes a sequence of bytes.
+  /// @param data The bytes to hash.
+  /// @param size The number of bytes.
+  /// @param seed The seed that selects a function of the family.
+  /// @return The 64-bit digest of *data*.
+  static uint64_t hash(void const* data, size_t size, uint64_t seed)
+  {
+    uint64_t a, b;
+    absorb(data, size, seed, a, b);
+    return mix(a ^ secret[0] ^ size, b ^ secret[1]);
+  }
+
+  /// Hashes a sequence of bytes to 128 bits. The low half equals `hash()`,
+  /// the high half finalizes the same state with the other two secrets.
+  /// @param data The bytes to hash.
+  /// @param size The number of bytes.
+  /// @param seed The seed that selects a function of the family.
+  /// @param lo Receives the low 64 bits of the digest.
+  /// @param hi Receives the high 64 bits of the digest.
+  static void hash128(void const* data, size_t size, uint64_t seed,
+                      uint64_t& lo, uint64_t& hi)
+  {
+    uint64_t a, b;
+    absorb(data, size, seed, a, b);
+    lo = mix(a ^ secret[0] ^ size, b ^ secret[1]);
+    hi = mix(a ^ secret[2] ^ size, b ^ secret[3]);
+  }
+
+private:
+  /// Consumes the input and leaves the two state words before finalization.
+  static void absorb(void const* data, size_t size, uint64_t seed,
+                     uint64_t& a, uint64_t& b)
+  {
+    auto p = static_cast<unsigned char const*>(data);
+    seed ^= mix(seed ^ secret[0], secret[1]);
+    if (size <= 16) {
+      if (size >= 4) {
+        a = (read4(p) << 32) | read4(p + ((size >> 3) << 2));
+        b = (read4(p + size - 4) << 32)
+            | read4(p + size - 4 - ((size >> 3) << 2));
+      } else if (size > 0) {
+        a = read3(p, size);
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      auto i = size;
+      if (i >= 48) {
+        auto see1 = seed;
+        auto see2 = seed;
+        do {
+          seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+          see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+          see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+          p += 48;
+          i -= 48;
+        } while (i >= 48);
+        seed ^= see1 ^ see2;
+      }
+      while (i > 16) {
+        seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+        i -= 16;
+        p += 16;
+      }
+      a = read8(p + i - 16);
+      b = read8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    multiply(a, b);
+  }
+
+  /// Replaces *a* and *b* with the low and high half of their product.
+  static void multiply(uint64_t& a, uint64_t& b)
+  {
+    auto r = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+  }
+
+  static uint64_t mix(uint64_t a, uint64_t b)
+  {
+    multiply(a, b);
+    return a ^ b;
+  }
+
+  static uint64_t read8(unsigned char const* p)
+  {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+  }
+
+  static uint64_t read4(unsigned char const* p)
+  {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+  }
+
+  static uint64_t read3(unsigned char const* p, size_t size)
+  {
+    return (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8)
+           | p[size - 1];
+  }
+};
+
+} // namespace bf
+
+#endif
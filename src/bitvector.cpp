@@ -4,6 +4,15 @@
 #include <cassert>
 #include <string.h>
 
+#include <bf/container.hpp>
+#include <bf/cpu.hpp>
+#include <bf/parallel.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BF_X86 1
+#include <immintrin.h>
+#endif
+
 namespace bf {
 
 typedef bitvector::size_type size_type;
@@ -11,17 +20,194 @@ typedef bitvector::block_type block_type;
 
 namespace {
 
-uint8_t count_table[] = {
-  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3,
-  3, 4, 3, 4, 4, 5, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4,
-  3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4,
-  4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5,
-  3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 1, 2,
-  2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5,
-  4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5,
-  5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5,
-  5, 6, 5, 6, 6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8};
+/// How the blocks of two bit vectors combine.
+enum class combine { first, and_, or_, xor_, and_not };
+
+template <combine C>
+block_type apply(block_type x, block_type y) {
+  switch (C) {
+    case combine::first:
+      return x;
+    case combine::and_:
+      return x & y;
+    case combine::or_:
+      return x | y;
+    case combine::xor_:
+      return x ^ y;
+    case combine::and_not:
+      return x & ~y;
+  }
+  return x;
+}
+
+/// Counts the 1-bits in the combination of *n* blocks without the POPCNT
+/// instruction.
+template <combine C>
+size_type count_portable(block_type const* x, block_type const* y, size_t n) {
+  size_type result = 0;
+  for (size_t i = 0; i < n; ++i)
+    result += __builtin_popcountll(apply<C>(x[i], y ? y[i] : 0));
+  return result;
+}
+
+#ifdef BF_X86
+
+template <combine C>
+__attribute__((target("popcnt"))) size_type
+count_popcnt(block_type const* x, block_type const* y, size_t n) {
+  size_type result = 0;
+  for (size_t i = 0; i < n; ++i)
+    result += __builtin_popcountll(apply<C>(x[i], y ? y[i] : 0));
+  return result;
+}
+
+template <combine C>
+__attribute__((target("avx2"))) __m256i load(block_type const* x,
+                                             block_type const* y, size_t i) {
+  auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(x) + i);
+  if (C == combine::first)
+    return a;
+  auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(y) + i);
+  switch (C) {
+    case combine::first:
+    case combine::and_:
+      return _mm256_and_si256(a, b);
+    case combine::or_:
+      return _mm256_or_si256(a, b);
+    case combine::xor_:
+      return _mm256_xor_si256(a, b);
+    case combine::and_not:
+      return _mm256_andnot_si256(b, a);
+  }
+  return a;
+}
+
+/// Counts the bits in each byte with a nibble lookup table and sums them up
+/// per 64-bit lane.
+__attribute__((target("avx2"))) __m256i popcount(__m256i v) {
+  auto table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  auto nibble = _mm256_set1_epi8(0x0f);
+  auto lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+  auto hi = _mm256_shuffle_epi8(
+    table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+/// A carry-save adder over 256 bits.
+__attribute__((target("avx2"))) void csa(__m256i& h, __m256i& l, __m256i a,
+                                         __m256i b, __m256i c) {
+  auto u = _mm256_xor_si256(a, b);
+  h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  l = _mm256_xor_si256(u, c);
+}
+
+/// Counts the 1-bits in the combination of *n* blocks with the Harley-Seal
+/// algorithm (Mula, Kurz and Lemire): a tree of carry-save adders reduces 16
+/// vectors to one whose bits each weigh 16, so only one in 16 vectors needs
+/// an actual population count.
+template <combine C>
+__attribute__((target("avx2"))) size_type
+count_avx2(block_type const* x, block_type const* y, size_t n) {
+  constexpr size_t step = sizeof(__m256i) / sizeof(block_type);
+  auto vectors = n / step;
+  auto zero = _mm256_setzero_si256();
+  auto total = zero, ones = zero, twos = zero, fours = zero, eights = zero;
+  __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+  size_t i = 0;
+  for (; i + 16 <= vectors; i += 16) {
+    csa(twos_a, ones, ones, load<C>(x, y, i), load<C>(x, y, i + 1));
+    csa(twos_b, ones, ones, load<C>(x, y, i + 2), load<C>(x, y, i + 3));
+    csa(fours_a, twos, twos, twos_a, twos_b);
+    csa(twos_a, ones, ones, load<C>(x, y, i + 4), load<C>(x, y, i + 5));
+    csa(twos_b, ones, ones, load<C>(x, y, i + 6), load<C>(x, y, i + 7));
+    csa(fours_b, twos, twos, twos_a, twos_b);
+    csa(eights_a, fours, fours, fours_a, fours_b);
+    csa(twos_a, ones, ones, load<C>(x, y, i + 8), load<C>(x, y, i + 9));
+    csa(twos_b, ones, ones, load<C>(x, y, i + 10), load<C>(x, y, i + 11));
+    csa(fours_a, twos, twos, twos_a, twos_b);
+    csa(twos_a, ones, ones, load<C>(x, y, i + 12), load<C>(x, y, i + 13));
+    csa(twos_b, ones, ones, load<C>(x, y, i + 14), load<C>(x, y, i + 15));
+    csa(fours_b, twos, twos, twos_a, twos_b);
+    csa(eights_b, fours, fours, fours_a, fours_b);
+    csa(sixteens, eights, eights, eights_a, eights_b);
+    total = _mm256_add_epi64(total, popcount(sixteens));
+  }
+  total = _mm256_slli_epi64(total, 4);
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount(eights), 3));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount(fours), 2));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount(twos), 1));
+  total = _mm256_add_epi64(total, popcount(ones));
+  for (; i < vectors; ++i)
+    total = _mm256_add_epi64(total, popcount(load<C>(x, y, i)));
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+  auto result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  auto rest = vectors * step;
+  return result + count_popcnt<C>(x + rest, y ? y + rest : y, n - rest);
+}
+
+/// Combines *n* blocks of *y* into *x*.
+template <combine C>
+__attribute__((target("avx2"))) void apply_avx2(block_type* x,
+                                                block_type const* y,
+                                                size_t n) {
+  constexpr size_t step = sizeof(__m256i) / sizeof(block_type);
+  size_t i = 0;
+  for (; i + step <= n; i += step)
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + i),
+                        load<C>(x + i, y + i, 0));
+  for (; i < n; ++i)
+    x[i] = apply<C>(x[i], y[i]);
+}
+
+#endif // BF_X86
+
+/// Counts the 1-bits in the combination of *n* blocks with the fastest
+/// available instructions.
+template <combine C>
+size_type count(block_type const* x, block_type const* y, size_t n) {
+#ifdef BF_X86
+  if (cpu.avx2)
+    return count_avx2<C>(x, y, n);
+  if (cpu.popcnt)
+    return count_popcnt<C>(x, y, n);
+#endif
+  return count_portable<C>(x, y, n);
+}
+
+/// Combines *n* blocks of *y* into *x*.
+template <combine C>
+void apply(block_type* x, block_type const* y, size_t n) {
+#ifdef BF_X86
+  if (cpu.avx2)
+    return apply_avx2<C>(x, y, n);
+#endif
+  for (size_t i = 0; i < n; ++i)
+    x[i] = apply<C>(x[i], y[i]);
+}
+
+/// Combines *n* blocks of several block arrays into *x* on several threads.
+template <combine C>
+void apply(block_type* x, std::vector<block_type const*> const& ys, size_t n,
+           size_t threads) {
+  // 16 KiB of *x* stay in L1 while the chunks of all *ys* stream through.
+  constexpr size_t chunk = 2048;
+  // Ranges start at cache line boundaries, so that threads never write the
+  // same line.
+  constexpr size_t line = 64 / sizeof(block_type);
+  threads = std::max(size_t(1), std::min(concurrency(threads), n / chunk));
+  auto range = ((n + threads - 1) / threads + line - 1) / line * line;
+  parallel(threads, [&](size_t t) {
+    auto first = std::min(n, t * range);
+    auto last = std::min(n, first + range);
+    for (auto i = first; i < last; i += chunk) {
+      auto len = std::min(chunk, last - i);
+      for (auto y : ys)
+        apply<C>(x + i, y + i, len);
+    }
+  });
+}
 
 } // namespace <anonymous>
 
@@ -84,13 +270,26 @@ bitvector::bitvector(size_type size, bool value)
     : bits_(bits_to_blocks(size), value ? ~block_type(0) : 0), num_bits_(size) {
 }
 
+bitvector::bitvector(block_type const* blocks, size_type size,
+                     std::shared_ptr<void const> owner)
+    : num_bits_(size), view_(blocks), owner_(std::move(owner)) {
+  assert(reinterpret_cast<uintptr_t>(blocks) % alignof(block_type) == 0);
+}
+
 bitvector::bitvector(bitvector const& other)
-    : bits_(other.bits_), num_bits_(other.num_bits_) {
+    : bits_(other.bits_),
+      num_bits_(other.num_bits_),
+      view_(other.view_),
+      owner_(other.owner_) {
 }
 
 bitvector::bitvector(bitvector&& other)
-    : bits_(std::move(other.bits_)), num_bits_(other.num_bits_) {
+    : bits_(std::move(other.bits_)),
+      num_bits_(other.num_bits_),
+      view_(other.view_),
+      owner_(std::move(other.owner_)) {
   other.num_bits_ = 0;
+  other.view_ = nullptr;
 }
 
 bitvector bitvector::operator~() const {
@@ -108,6 +307,8 @@ void swap(bitvector& x, bitvector& y) {
   using std::swap;
   swap(x.bits_, y.bits_);
   swap(x.num_bits_, y.num_bits_);
+  swap(x.view_, y.view_);
+  swap(x.owner_, y.owner_);
 }
 
 bitvector bitvector::operator<<(size_type n) const {
@@ -125,6 +326,7 @@ bitvector& bitvector::operator<<=(size_type n) {
     return reset();
 
   if (n > 0) {
+    detach();
     auto last = blocks() - 1;
     auto div = n / bits_per_block;
     auto r = bit_index(n);
@@ -154,6 +356,7 @@ bitvector& bitvector::operator>>=(size_type n) {
     return reset();
 
   if (n > 0) {
+    detach();
     auto last = blocks() - 1;
     auto div = n / bits_per_block;
     auto r = bit_index(n);
@@ -178,29 +381,53 @@ bitvector& bitvector::operator>>=(size_type n) {
 
 bitvector& bitvector::operator&=(bitvector const& other) {
   assert(size() >= other.size());
-  for (size_type i = 0; i < blocks(); ++i)
-    bits_[i] &= other.bits_[i];
+  detach();
+  apply<combine::and_>(bits_.data(), other.data(), blocks());
   return *this;
 }
 
 bitvector& bitvector::operator|=(bitvector const& other) {
   assert(size() >= other.size());
-  for (size_type i = 0; i < blocks(); ++i)
-    bits_[i] |= other.bits_[i];
+  detach();
+  apply<combine::or_>(bits_.data(), other.data(), blocks());
   return *this;
 }
 
 bitvector& bitvector::operator^=(bitvector const& other) {
   assert(size() >= other.size());
-  for (size_type i = 0; i < blocks(); ++i)
-    bits_[i] ^= other.bits_[i];
+  detach();
+  apply<combine::xor_>(bits_.data(), other.data(), blocks());
   return *this;
 }
 
 bitvector& bitvector::operator-=(bitvector const& other) {
   assert(size() >= other.size());
-  for (size_type i = 0; i < blocks(); ++i)
-    bits_[i] &= ~other.bits_[i];
+  detach();
+  apply<combine::and_not>(bits_.data(), other.data(), blocks());
+  return *this;
+}
+
+bitvector& bitvector::merge(span<bitvector const* const> others,
+                            size_t threads) {
+  std::vector<block_type const*> ys;
+  for (auto other : others) {
+    assert(other->size() == size());
+    ys.push_back(other->data());
+  }
+  detach();
+  apply<combine::or_>(bits_.data(), ys, blocks(), threads);
+  return *this;
+}
+
+bitvector& bitvector::intersect(span<bitvector const* const> others,
+                                size_t threads) {
+  std::vector<block_type const*> ys;
+  for (auto other : others) {
+    assert(other->size() == size());
+    ys.push_back(other->data());
+  }
+  detach();
+  apply<combine::and_>(bits_.data(), ys, blocks(), threads);
   return *this;
 }
 
@@ -225,7 +452,8 @@ bitvector operator-(bitvector const& x, bitvector const& y) {
 }
 
 bool operator==(bitvector const& x, bitvector const& y) {
-  return x.num_bits_ == y.num_bits_ && x.bits_ == y.bits_;
+  return x.num_bits_ == y.num_bits_
+         && std::equal(x.data(), x.data() + x.blocks(), y.data());
 }
 
 bool operator!=(bitvector const& x, bitvector const& y) {
@@ -236,15 +464,16 @@ bool operator<(bitvector const& x, bitvector const& y) {
   assert(x.size() == y.size());
   for (size_type r = x.blocks(); r > 0; --r) {
     auto i = r - 1;
-    if (x.bits_[i] < y.bits_[i])
+    if (x.data()[i] < y.data()[i])
       return true;
-    else if (x.bits_[i] > y.bits_[i])
+    else if (x.data()[i] > y.data()[i])
       return false;
   }
   return false;
 }
 
 void bitvector::resize(size_type n, bool value) {
+  detach();
   auto old = blocks();
   auto required = bits_to_blocks(n);
   auto block_value = value ? ~block_type(0) : block_type(0);
@@ -262,6 +491,8 @@ void bitvector::resize(size_type n, bool value) {
 void bitvector::clear() noexcept {
   bits_.clear();
   num_bits_ = 0;
+  view_ = nullptr;
+  owner_.reset();
 }
 
 void bitvector::push_back(bool bit) {
@@ -271,6 +502,7 @@ void bitvector::push_back(bool bit) {
 }
 
 void bitvector::append(block_type block) {
+  detach();
   auto excess = extra_bits();
   if (excess) {
     assert(!bits_.empty());
@@ -284,6 +516,7 @@ void bitvector::append(block_type block) {
 
 bitvector& bitvector::set(size_type i, bool bit) {
   assert(i < num_bits_);
+  detach();
 
   if (bit)
     bits_[block_index(i)] |= bit_mask(i);
@@ -294,6 +527,7 @@ bitvector& bitvector::set(size_type i, bool bit) {
 }
 
 bitvector& bitvector::set() {
+  detach();
   std::fill(bits_.begin(), bits_.end(), ~block_type(0));
   zero_unused_bits();
   return *this;
@@ -301,22 +535,26 @@ bitvector& bitvector::set() {
 
 bitvector& bitvector::reset(size_type i) {
   assert(i < num_bits_);
+  detach();
   bits_[block_index(i)] &= ~bit_mask(i);
   return *this;
 }
 
 bitvector& bitvector::reset() {
+  detach();
   std::fill(bits_.begin(), bits_.end(), block_type(0));
   return *this;
 }
 
 bitvector& bitvector::flip(size_type i) {
   assert(i < num_bits_);
+  detach();
   bits_[block_index(i)] ^= bit_mask(i);
   return *this;
 }
 
 bitvector& bitvector::flip() {
+  detach();
   for (size_type i = 0; i < blocks(); ++i)
     bits_[i] = ~bits_[i];
   zero_unused_bits();
@@ -325,33 +563,21 @@ bitvector& bitvector::flip() {
 
 bool bitvector::operator[](size_type i) const {
   assert(i < num_bits_);
-  return (bits_[block_index(i)] & bit_mask(i)) != 0;
+  return (data()[block_index(i)] & bit_mask(i)) != 0;
 }
 
 bitvector::reference bitvector::operator[](size_type i) {
   assert(i < num_bits_);
+  detach();
   return {bits_[block_index(i)], bit_index(i)};
 }
 
 size_type bitvector::count() const {
-  auto first = bits_.begin();
-  size_t n = 0;
-  auto length = blocks();
-  while (length) {
-    auto block = *first;
-    while (block) {
-      // TODO: use __popcnt if available.
-      n += count_table[block & ((1u << 8) - 1)];
-      block >>= 8;
-    }
-    ++first;
-    --length;
-  }
-  return n;
+  return bf::count<combine::first>(data(), nullptr, blocks());
 }
 
 size_type bitvector::blocks() const {
-  return bits_.size();
+  return view_ ? bits_to_blocks(num_bits_) : bits_.size();
 }
 
 size_type bitvector::size() const {
@@ -359,7 +585,7 @@ size_type bitvector::size() const {
 }
 
 bool bitvector::empty() const {
-  return bits_.empty();
+  return blocks() == 0;
 }
 
 size_type bitvector::find_first() const {
@@ -371,7 +597,7 @@ size_type bitvector::find_next(size_type i) const {
     return npos;
   ++i;
   auto bi = block_index(i);
-  auto block = bits_[bi] & (~block_type(0) << bit_index(i));
+  auto block = data()[bi] & (~block_type(0) << bit_index(i));
   return block ? bi * bits_per_block + lowest_bit(block) : find_from(bi + 1);
 }
 
@@ -393,11 +619,35 @@ void bitvector::zero_unused_bits() {
 }
 
 size_type bitvector::find_from(size_type i) const {
-  while (i < blocks() && bits_[i] == 0)
+  auto b = data();
+  while (i < blocks() && b[i] == 0)
     ++i;
   if (i >= blocks())
     return npos;
-  return i * bits_per_block + lowest_bit(bits_[i]);
+  return i * bits_per_block + lowest_bit(b[i]);
+}
+
+void bitvector::detach() {
+  if (!view_)
+    return;
+  bits_.assign(view_, view_ + bits_to_blocks(num_bits_));
+  view_ = nullptr;
+  owner_.reset();
+}
+
+size_type count_and(bitvector const& x, bitvector const& y) {
+  assert(x.size() == y.size());
+  return count<combine::and_>(x.data(), y.data(), x.blocks());
+}
+
+size_type count_or(bitvector const& x, bitvector const& y) {
+  assert(x.size() == y.size());
+  return count<combine::or_>(x.data(), y.data(), x.blocks());
+}
+
+size_type count_xor(bitvector const& x, bitvector const& y) {
+  assert(x.size() == y.size());
+  return count<combine::xor_>(x.data(), y.data(), x.blocks());
 }
 
 std::string to_string(bitvector const& b, bool msb_to_lsb, bool all,
@@ -421,21 +671,23 @@ std::string to_string(bitvector const& b, bool msb_to_lsb, bool all,
 }
 
 char* bitvector::serialize(char* buf) {
-  unsigned int sz = bits_.size() * sizeof(block_type);
+  unsigned int sz = blocks() * sizeof(block_type);
   *reinterpret_cast<unsigned int*>(buf) = htobe32(sz);
   buf += sizeof(sz);
-  memmove(buf, bits_.data(), sz);
+  memmove(buf, data(), sz);
   buf += sz;
   *reinterpret_cast<size_type *>(buf) = htobe64(num_bits_);
   return buf + sizeof(num_bits_);
 }
 
 unsigned int bitvector::serializedSize() const {
-  unsigned int sz = bits_.size() * sizeof(block_type);
+  unsigned int sz = blocks() * sizeof(block_type);
   return sizeof(unsigned int) + sz + sizeof(num_bits_);
 }
 
 int bitvector::fromBuf(const char* buf, unsigned int len) {
+  view_ = nullptr;
+  owner_.reset();
   auto start_buf = buf;
   auto sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
   buf += sizeof(unsigned int);
@@ -448,4 +700,52 @@ int bitvector::fromBuf(const char* buf, unsigned int len) {
     return 1;
   return 0;
 }
+
+int bitvector::viewBuf(const char* buf, unsigned int len,
+                       std::shared_ptr<void const> owner) {
+  auto blocks = buf + sizeof(unsigned int);
+  if (reinterpret_cast<uintptr_t>(blocks) % alignof(block_type) != 0)
+    return fromBuf(buf, len);
+  if (len < sizeof(unsigned int) + sizeof(num_bits_))
+    return 1;
+  auto sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
+  if (len != sizeof(unsigned int) + sz + sizeof(num_bits_))
+    return 1;
+  size_type size;
+  memcpy(&size, blocks + sz, sizeof(size));
+  size = be64toh(size);
+  if (bits_to_blocks(size) * sizeof(block_type) != sz)
+    return 1;
+  bitvector view(reinterpret_cast<const block_type*>(blocks), size,
+                 std::move(owner));
+  swap(*this, view);
+  return 0;
+}
+
+void bitvector::write(container_writer& w) const {
+  w.blocks(data(), blocks() * sizeof(block_type), num_bits_);
+}
+
+int bitvector::read(container_reader& r) {
+  uint64_t size, bits;
+  if (r.blocks(size, bits) != 0)
+    return 1;
+  if (size != bits_to_blocks(bits) * sizeof(block_type))
+    return 1;
+  auto blocks = r.data();
+  if (blocks && r.owner()
+      && reinterpret_cast<uintptr_t>(blocks) % alignof(block_type) == 0) {
+    bitvector view(reinterpret_cast<const block_type*>(blocks), bits,
+                   r.owner());
+    swap(*this, view);
+    return 0;
+  }
+  clear();
+  bits_.resize(bits_to_blocks(bits));
+  if (r.copy(bits_.data()) != 0)
+    return 1;
+  num_bits_ = bits;
+  return 0;
+}
+
 } // namespace bf
@@ -2,6 +2,8 @@
 
 #include <cassert>
 
+#include <bf/container.hpp>
+
 namespace bf {
 
 size_t a2_bloom_filter::k(double fp) {
@@ -50,4 +52,24 @@ unsigned int a2_bloom_filter::serializedSize() const {
 int a2_bloom_filter::fromBuf(const char*buf, unsigned int len){
   return 0;
 }
+
+void a2_bloom_filter::write(container_writer& w) const {
+  w.parameters(filter_type::a2, {items_, capacity_});
+  first_.write(w);
+  second_.write(w);
+}
+
+int a2_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::a2, params) != 0 || params.size() != 2)
+    return 1;
+  if (first_.read(r) != 0)
+    return 2;
+  if (second_.read(r) != 0)
+    return 3;
+  items_ = params[0];
+  capacity_ = params[1];
+  return 0;
+}
+
 } // namespace bf
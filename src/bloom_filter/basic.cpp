@@ -1,7 +1,11 @@
 #include <bf/bloom_filter/basic.hpp>
+#include <bf/container.hpp>
+#include <bf/parallel.hpp>
+#include <algorithm>
 #include <memory>
 #include <cassert>
 #include <cmath>
+#include <limits>
 
 namespace bf {
 
@@ -15,13 +19,19 @@ size_t basic_bloom_filter::k(size_t cells, size_t capacity) {
   return std::ceil(frac * std::log(2));
 }
 
-basic_bloom_filter::basic_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells, bool partition)
-    : hasher_(std::move(h)), bits_(cells), partition_(partition) {
+basic_bloom_filter::basic_bloom_filter(std::shared_ptr<base_hasher> h,
+                                       size_t cells, bool partition,
+                                       index_mapping mapping)
+    : hasher_(std::move(h)),
+      bits_(cells),
+      partition_(partition),
+      mapping_(mapping) {
 }
 
 basic_bloom_filter::basic_bloom_filter(double fp, size_t capacity, size_t seed,
-                                       bool double_hashing, bool partition)
-    : partition_(partition) {
+                                       bool double_hashing, bool partition,
+                                       index_mapping mapping)
+    : partition_(partition), mapping_(mapping) {
   auto required_cells = m(fp, capacity);
   auto optimal_k = k(required_cells, capacity);
   if (partition_)
@@ -35,39 +45,206 @@ basic_bloom_filter::basic_bloom_filter(std::shared_ptr<base_hasher> h, bitvector
 }
 
 basic_bloom_filter::basic_bloom_filter(basic_bloom_filter&& other)
-    : hasher_(std::move(other.hasher_)), bits_(std::move(other.bits_)) ,partition_(other.partition_){
+    : hasher_(std::move(other.hasher_)), bits_(std::move(other.bits_)) ,partition_(other.partition_), mapping_(other.mapping_){
 }
 
-basic_bloom_filter::basic_bloom_filter(const basic_bloom_filter& other): hasher_(other.hasher_), bits_(other.bits_),  partition_(other.partition_){
+basic_bloom_filter::basic_bloom_filter(const basic_bloom_filter& other): hasher_(other.hasher_), bits_(other.bits_),  partition_(other.partition_), mapping_(other.mapping_){
 }
 void basic_bloom_filter::add(object const& o) {
-  auto digests = (*hasher_)(o);
-  if (partition_) {
-    assert(bits_.size() % digests.size() == 0);
-    auto parts = bits_.size() / digests.size();
-    for (size_t i = 0; i < digests.size(); ++i)
-      bits_.set(i * parts + (digests[i] % parts));
-  } else {
-    for (auto d : digests)
-      bits_.set(d % bits_.size());
-  }
+  digest_buffer indices;
+  find_indices(o, indices);
+  for (auto i : indices)
+    bits_.set(i);
 }
 
 size_t basic_bloom_filter::lookup(object const& o) const {
-  auto digests = (*hasher_)(o);
+  digest_buffer indices;
+  find_indices(o, indices);
+  for (auto i : indices)
+    if (!bits_[i])
+      return 0;
+  return 1;
+}
+
+void basic_bloom_filter::add_many(span<object const> objects) {
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      for (auto j : indices[i])
+        bits_.set(j);
+  }
+}
+
+void basic_bloom_filter::bulk_build(span<object const> objects,
+                                    size_t threads) {
+  typedef bitvector::block_type block_type;
+  constexpr size_t block_bits = bitvector::bits_per_block;
+  // Elements per thread and round. The positions of a round take about
+  // 0.5 MiB per hash function and thread.
+  constexpr size_t slice = size_t(1) << 16;
+  threads = std::min(concurrency(threads), bits_.blocks());
+  if (threads <= 1 || objects.size() < 2 * batch_size * threads) {
+    add_many(objects);
+    return;
+  }
+  // Copy the storage of a view before threads write to it.
+  auto blocks = bits_.data();
+  auto const range = (bits_.blocks() + threads - 1) / threads;
+  // positions[t][o] holds the positions that thread t found for owner o.
+  std::vector<std::vector<std::vector<digest>>> positions(
+    threads, std::vector<std::vector<digest>>(threads));
+  for (size_t first = 0; first < objects.size(); first += slice * threads) {
+    auto round = objects.subspan(
+      first, std::min(objects.size() - first, slice * threads));
+    parallel(threads, [&](size_t t) {
+      auto& out = positions[t];
+      digest_buffer indices;
+      for (auto i = round.size() * t / threads;
+           i < round.size() * (t + 1) / threads; ++i) {
+        find_indices(round[i], indices);
+        for (auto j : indices)
+          out[j / block_bits / range].push_back(j);
+      }
+    });
+    parallel(threads, [&](size_t o) {
+      for (auto& out : positions) {
+        for (auto j : out[o])
+          blocks[j / block_bits] |= block_type(1) << (j % block_bits);
+        out[o].clear();
+      }
+    });
+  }
+}
+
+bool basic_bloom_filter::compatible(basic_bloom_filter const& other) const {
+  return bits_.size() == other.bits_.size() && partition_ == other.partition_
+         && mapping_ == other.mapping_ && same_hasher(hasher_, other.hasher_);
+}
+
+bool basic_bloom_filter::merge(basic_bloom_filter const& other,
+                               size_t threads) {
+  basic_bloom_filter const* others[] = {&other};
+  return merge(span<basic_bloom_filter const* const>(others, 1), threads);
+}
+
+bool basic_bloom_filter::merge(span<basic_bloom_filter const* const> others,
+                               size_t threads) {
+  std::vector<bitvector const*> bits;
+  for (auto other : others) {
+    if (!compatible(*other))
+      return false;
+    bits.push_back(&other->bits_);
+  }
+  bits_.merge(bits, threads);
+  return true;
+}
+
+bool basic_bloom_filter::intersect(basic_bloom_filter const& other,
+                                   size_t threads) {
+  basic_bloom_filter const* others[] = {&other};
+  return intersect(span<basic_bloom_filter const* const>(others, 1), threads);
+}
+
+bool basic_bloom_filter::intersect(
+  span<basic_bloom_filter const* const> others, size_t threads) {
+  std::vector<bitvector const*> bits;
+  for (auto other : others) {
+    if (!compatible(*other))
+      return false;
+    bits.push_back(&other->bits_);
+  }
+  bits_.intersect(bits, threads);
+  return true;
+}
+
+namespace {
+
+/// Estimates the number of elements that set *x* of *m* bits with *k* hash
+/// functions.
+double cardinality(size_t x, size_t m, size_t k) {
+  if (x >= m)
+    return std::numeric_limits<double>::infinity();
+  return -(static_cast<double>(m) / k)
+         * std::log1p(-static_cast<double>(x) / m);
+}
+
+} // namespace <anonymous>
+
+double basic_bloom_filter::estimate_cardinality() const {
+  return cardinality(bits_.count(), bits_.size(), hasher_->k());
+}
+
+double basic_bloom_filter::estimate_fpr() const {
+  if (bits_.size() == 0)
+    return 1;
+  auto fill = static_cast<double>(bits_.count()) / bits_.size();
+  return std::pow(fill, hasher_->k());
+}
+
+double basic_bloom_filter::estimate_union(
+  basic_bloom_filter const& other) const {
+  assert(compatible(other));
+  return cardinality(count_or(bits_, other.bits_), bits_.size(),
+                     hasher_->k());
+}
+
+double basic_bloom_filter::estimate_intersection(
+  basic_bloom_filter const& other) const {
+  auto n = estimate_cardinality() + other.estimate_cardinality()
+           - estimate_union(other);
+  // Saturated filters make the difference of infinities undefined.
+  return n > 0 ? n : 0;
+}
+
+void basic_bloom_filter::lookup_many(span<object const> objects,
+                                     span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      size_t count = 1;
+      for (auto j : indices[i])
+        if (!bits_[j]) {
+          count = 0;
+          break;
+        }
+      counts[first + i] = count;
+    }
+  }
+}
+
+void basic_bloom_filter::find_indices(object const& o,
+                                      digest_buffer& indices) const {
+  (*hasher_)(o, indices);
+  map_indices(indices);
+}
+
+void basic_bloom_filter::map_indices(digest_buffer& indices) const {
   if (partition_) {
-    assert(bits_.size() % digests.size() == 0);
-    auto parts = bits_.size() / digests.size();
-    for (size_t i = 0; i < digests.size(); ++i)
-      if (!bits_[i * parts + (digests[i] % parts)])
-        return 0;
+    assert(bits_.size() % indices.size() == 0);
+    auto parts = bits_.size() / indices.size();
+    for (size_t i = 0; i < indices.size(); ++i)
+      indices[i] = i * parts + map_index(indices[i], parts, mapping_);
   } else {
-    for (auto d : digests)
-      if (!bits_[d % bits_.size()])
-        return 0;
+    for (auto& i : indices)
+      i = map_index(i, bits_.size(), mapping_);
   }
+}
 
-  return 1;
+void basic_bloom_filter::prefetch(span<object const> objects,
+                                  digest_buffer* indices) const {
+  assert(objects.size() <= batch_size);
+  for (size_t i = 0; i < objects.size(); ++i) {
+    find_indices(objects[i], indices[i]);
+    for (auto j : indices[i])
+      bits_.prefetch(j);
+  }
 }
 
 void basic_bloom_filter::clear() {
@@ -75,14 +252,18 @@ void basic_bloom_filter::clear() {
 }
 
 void basic_bloom_filter::remove(object const& o) {
-  for (auto d : (*hasher_)(o))
-    bits_.reset(d % bits_.size());
+  digest_buffer indices;
+  find_indices(o, indices);
+  for (auto i : indices)
+    bits_.reset(i);
 }
 
 void basic_bloom_filter::swap(basic_bloom_filter& other) {
   using std::swap;
   swap(hasher_, other.hasher_);
   swap(bits_, other.bits_);
+  swap(partition_, other.partition_);
+  swap(mapping_, other.mapping_);
 }
 
 bitvector const& basic_bloom_filter::storage() const {
@@ -92,6 +273,10 @@ std::shared_ptr<base_hasher> const& basic_bloom_filter::hasher_function() const
   return hasher_;
 }
 
+index_mapping basic_bloom_filter::mapping() const {
+  return mapping_;
+}
+
 char* basic_bloom_filter::serialize(char* buf) {
   auto hasher_sz = hasher_->serializedSize();
   *reinterpret_cast<uint32_t*>(buf) = htobe32(hasher_sz);
@@ -102,13 +287,29 @@ char* basic_bloom_filter::serialize(char* buf) {
   buf += sizeof(bits_sz);
   buf = bits_.serialize(buf);
   *buf++ = partition_;
+  // Filters with modulo mapping omit the trailing mapping byte, so that they
+  // remain readable by older versions.
+  if (mapping_ != index_mapping::modulo)
+    *buf++ = static_cast<char>(mapping_);
   return buf;
 }
 unsigned int basic_bloom_filter::serializedSize() const {
   return sizeof(unsigned int) * 2 + hasher_->serializedSize()
-         + bits_.serializedSize() + sizeof(partition_);
+         + bits_.serializedSize() + sizeof(partition_)
+         + (mapping_ != index_mapping::modulo ? sizeof(mapping_) : 0);
 }
 int basic_bloom_filter::fromBuf(const char* buf, unsigned int len) {
+  return deserialize(buf, len, false, nullptr);
+}
+
+int basic_bloom_filter::viewBuf(const char* buf, unsigned int len,
+                                std::shared_ptr<void const> owner) {
+  return deserialize(buf, len, true, std::move(owner));
+}
+
+int basic_bloom_filter::deserialize(const char* buf, unsigned int len,
+                                    bool view,
+                                    std::shared_ptr<void const> owner) {
   auto buf_start = buf;
   auto hasher_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
   buf += sizeof(unsigned int);
@@ -120,12 +321,50 @@ int basic_bloom_filter::fromBuf(const char* buf, unsigned int len) {
   buf += hasher_sz;
   auto cells_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
   buf += sizeof(unsigned int);
-  if (bits_.fromBuf(buf, cells_sz) != 0)
+  auto status = view ? bits_.viewBuf(buf, cells_sz, std::move(owner))
+                     : bits_.fromBuf(buf, cells_sz);
+  if (status != 0)
     return 3;
   buf += cells_sz;
   partition_ = *buf++;
+  mapping_ = index_mapping::modulo;
+  if (static_cast<unsigned int>(buf - buf_start) < len) {
+    mapping_ = static_cast<index_mapping>(*buf++);
+    if (mapping_ != index_mapping::fast_range)
+      return 5;
+  }
   if (buf - buf_start != len)
     return 4;
   return 0;
 }
+
+void basic_bloom_filter::write(container_writer& w) const {
+  w.parameters(filter_type::basic,
+               {partition_, static_cast<uint64_t>(mapping_)});
+  w.hasher(*hasher_);
+  bits_.write(w);
+}
+
+int basic_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::basic, params) != 0 || params.size() != 2
+      || params[1] > static_cast<uint64_t>(index_mapping::fast_range))
+    return 1;
+  std::shared_ptr<base_hasher> h;
+  if (r.hasher(h) != 0 || h->k() == 0)
+    return 2;
+  bitvector bits;
+  if (bits.read(r) != 0)
+    return 3;
+  // Lookups map digests into the bits, or into k partitions of them.
+  auto partition = params[0] != 0;
+  if (bits.size() == 0 || (partition && bits.size() % h->k() != 0))
+    return 4;
+  hasher_ = std::move(h);
+  bits_ = std::move(bits);
+  partition_ = partition;
+  mapping_ = static_cast<index_mapping>(params[1]);
+  return 0;
+}
+
 } // namespace bf
@@ -0,0 +1,314 @@
+#include <bf/bloom_filter/binary_fuse.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string.h>
+
+#include <bf/container.hpp>
+#include <bf/parallel.hpp>
+
+namespace bf {
+
+namespace {
+
+constexpr size_t arity = 3;
+
+/// The number of keys below which another thread does not pay off.
+constexpr size_t keys_per_thread = 1 << 16;
+
+} // namespace <anonymous>
+
+binary_fuse_filter::binary_fuse_filter(std::shared_ptr<base_hasher> h,
+                                       size_t fingerprint_bits)
+    : hasher_(std::move(h)), fingerprint_bits_(fingerprint_bits) {
+  assert(fingerprint_bits == 8 || fingerprint_bits == 16);
+  assert(hasher_->k() > 0);
+  layout(0);
+}
+
+binary_fuse_filter::binary_fuse_filter(std::shared_ptr<base_hasher> h,
+                                       span<object const> keys,
+                                       size_t fingerprint_bits,
+                                       size_t threads)
+    : binary_fuse_filter(std::move(h), fingerprint_bits) {
+  build(keys, threads);
+}
+
+void binary_fuse_filter::add(object const&) {
+  throw std::logic_error("binary fuse filters are static; use build()");
+}
+
+size_t binary_fuse_filter::lookup(object const& o) const {
+  if (size_ == 0)
+    return 0;
+  auto h = hash(o);
+  size_t s[arity];
+  locate(h, s);
+  return (fingerprint(h) ^ get(s[0]) ^ get(s[1]) ^ get(s[2])) == 0 ? 1 : 0;
+}
+
+void binary_fuse_filter::lookup_many(span<object const> objects,
+                                     span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  if (size_ == 0) {
+    std::fill_n(counts.data(), objects.size(), size_t(0));
+    return;
+  }
+  size_t slots[batch_size][arity];
+  uint64_t fingerprints[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto n = std::min(objects.size() - first, size_t(batch_size));
+    for (size_t i = 0; i < n; ++i) {
+      auto h = hash(objects[first + i]);
+      locate(h, slots[i]);
+      fingerprints[i] = fingerprint(h);
+      for (auto j : slots[i])
+        fingerprints_.prefetch(j * fingerprint_bits_);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      auto s = slots[i];
+      auto x = fingerprints[i] ^ get(s[0]) ^ get(s[1]) ^ get(s[2]);
+      counts[first + i] = x == 0 ? 1 : 0;
+    }
+  }
+}
+
+void binary_fuse_filter::clear() {
+  layout(0);
+  size_ = 0;
+}
+
+bool binary_fuse_filter::build(span<object const> keys, size_t threads) {
+  threads = std::min(concurrency(threads), keys.size() / keys_per_thread);
+  threads = std::max(threads, size_t(1));
+  // Hash every key once; the attempts only mix in a new seed.
+  std::vector<uint64_t> digests(keys.size());
+  parallel(threads, [&](size_t t) {
+    digest_buffer d;
+    auto last = keys.size() * (t + 1) / threads;
+    for (auto i = keys.size() * t / threads; i < last; ++i) {
+      (*hasher_)(keys[i], d);
+      digests[i] = d[0];
+    }
+  });
+  size_t n = 0;
+  size_t slots = 0;
+  // Per slot, the number of keys times 4 plus the XOR of the indices of the
+  // slot among the three slots of each key, and the XOR of their hashes.
+  std::vector<uint8_t> counts;
+  std::vector<uint64_t> xors;
+  std::vector<uint64_t> hashes(keys.size());
+  std::vector<uint64_t> order;
+  std::vector<uint8_t> found;
+  std::vector<size_t> alone;
+  for (size_t attempt = 0; attempt < max_attempts; ++attempt) {
+    seed_ = attempt * 0x9e3779b97f4a7c15ULL;
+    hashes.resize(digests.size());
+    parallel(threads, [&](size_t t) {
+      auto last = digests.size() * (t + 1) / threads;
+      for (auto i = digests.size() * t / threads; i < last; ++i)
+        hashes[i] = mix(digests[i] + seed_);
+    });
+    // Sorted hashes visit the slots in order, segment by segment. Since
+    // mixing is a bijection, equal hashes stem from equal digests, which
+    // would never peel, so keep only one.
+    sort_hashes(hashes, threads);
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    if (attempt == 0) {
+      n = hashes.size();
+      layout(n);
+      slots = fingerprints_.size() / fingerprint_bits_;
+      counts.resize(slots);
+      xors.resize(slots);
+    }
+    std::fill(counts.begin(), counts.end(), 0);
+    std::fill(xors.begin(), xors.end(), 0);
+    // Each thread counts the keys of its own range of slots. Since the first
+    // slot of a key grows with its hash and the others lie at most two
+    // segments further, the keys of a range are contiguous.
+    std::vector<uint8_t> overflow(threads);
+    parallel(threads, [&](size_t t) {
+      auto lo = slots * t / threads;
+      auto hi = slots * (t + 1) / threads;
+      auto reach = arity * segment_length_;
+      auto bound = lo > reach ? lo - reach : 0;
+      auto first = std::partition_point(
+        hashes.begin(), hashes.end(), [&](uint64_t h) {
+          return map_index(h, segment_count_length_,
+                           index_mapping::fast_range) < bound;
+        });
+      size_t s[arity];
+      for (auto i = first; i != hashes.end(); ++i) {
+        locate(*i, s);
+        if (s[0] >= hi)
+          break;
+        for (size_t j = 0; j < arity; ++j)
+          if (s[j] >= lo && s[j] < hi) {
+            counts[s[j]] += 4;
+            counts[s[j]] ^= j;
+            xors[s[j]] ^= *i;
+            // More than 63 keys in a slot wrap the count.
+            if (counts[s[j]] < 4)
+              overflow[t] = 1;
+          }
+      }
+    });
+    if (std::find(overflow.begin(), overflow.end(), 1) != overflow.end())
+      continue;
+    // Peel slots with a single key until no key is left.
+    alone.clear();
+    order.clear();
+    found.clear();
+    for (size_t i = 0; i < slots; ++i)
+      if (counts[i] >> 2 == 1)
+        alone.push_back(i);
+    while (!alone.empty()) {
+      auto i = alone.back();
+      alone.pop_back();
+      if (counts[i] >> 2 != 1)
+        continue;
+      auto h = xors[i];
+      size_t j = counts[i] & 3;
+      order.push_back(h);
+      found.push_back(j);
+      size_t s[arity];
+      locate(h, s);
+      for (size_t k = 0; k < arity; ++k) {
+        counts[s[k]] -= 4;
+        counts[s[k]] ^= k;
+        xors[s[k]] ^= h;
+        if (counts[s[k]] >> 2 == 1)
+          alone.push_back(s[k]);
+      }
+    }
+    if (order.size() != n)
+      continue;
+    // Assign fingerprints in reverse peeling order, so that every key sets
+    // the one of its slots that no later key uses.
+    for (auto i = n; i-- > 0;) {
+      auto h = order[i];
+      auto j = found[i];
+      size_t s[arity];
+      locate(h, s);
+      set(s[j], fingerprint(h) ^ get(s[(j + 1) % arity])
+                  ^ get(s[(j + 2) % arity]));
+    }
+    size_ = n;
+    return true;
+  }
+  clear();
+  return false;
+}
+
+size_t binary_fuse_filter::size() const {
+  return size_;
+}
+
+size_t binary_fuse_filter::slots() const {
+  return fingerprints_.size() / fingerprint_bits_;
+}
+
+size_t binary_fuse_filter::fingerprint_bits() const {
+  return fingerprint_bits_;
+}
+
+void binary_fuse_filter::write(container_writer& w) const {
+  w.parameters(filter_type::binary_fuse,
+               {fingerprint_bits_, seed_, segment_length_,
+                segment_count_length_, size_});
+  w.hasher(*hasher_);
+  fingerprints_.write(w);
+}
+
+int binary_fuse_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::binary_fuse, params) != 0
+      || params.size() != 5 || (params[0] != 8 && params[0] != 16))
+    return 1;
+  auto segment_length = params[2];
+  auto segment_count_length = params[3];
+  if (segment_length == 0 || (segment_length & (segment_length - 1)) != 0
+      || segment_count_length == 0
+      || segment_count_length % segment_length != 0)
+    return 1;
+  std::shared_ptr<base_hasher> h;
+  if (r.hasher(h) != 0 || h->k() == 0)
+    return 2;
+  bitvector fingerprints;
+  if (fingerprints.read(r) != 0)
+    return 3;
+  auto slots = segment_count_length + (arity - 1) * segment_length;
+  if (fingerprints.size() != slots * params[0])
+    return 4;
+  hasher_ = std::move(h);
+  swap(fingerprints_, fingerprints);
+  fingerprint_bits_ = params[0];
+  seed_ = params[1];
+  segment_length_ = segment_length;
+  segment_count_length_ = segment_count_length;
+  size_ = params[4];
+  return 0;
+}
+
+void binary_fuse_filter::layout(size_t keys) {
+  // The sizes that Graf and Lemire give for arity 3: segments grow with the
+  // logarithm of the number of keys, and small sets need relatively more
+  // slots.
+  auto n = static_cast<double>(keys);
+  size_t shift = 2;
+  if (keys > 1)
+    shift = static_cast<size_t>(std::floor(std::log(n) / std::log(3.33)
+                                           + 2.25));
+  segment_length_ = size_t(1) << std::min(shift, size_t(18));
+  auto factor = keys <= 1 ? 0.0
+    : std::max(1.125, 0.875 + 0.25 * std::log(1e6) / std::log(n));
+  auto capacity = static_cast<size_t>(std::round(n * factor));
+  auto segments = (capacity + segment_length_ - 1) / segment_length_;
+  segments = segments <= arity - 1 ? 1 : segments - (arity - 1);
+  segment_count_length_ = segments * segment_length_;
+  auto slots = segment_count_length_ + (arity - 1) * segment_length_;
+  fingerprints_ = bitvector(slots * fingerprint_bits_);
+}
+
+uint64_t binary_fuse_filter::hash(object const& o) const {
+  digest_buffer d;
+  (*hasher_)(o, d);
+  return mix(d[0] + seed_);
+}
+
+void binary_fuse_filter::locate(uint64_t hash, size_t* slots) const {
+  // The first slot lies in any but the last two segments, the others in the
+  // two segments after it.
+  auto mask = segment_length_ - 1;
+  auto h0 = map_index(hash, segment_count_length_, index_mapping::fast_range);
+  slots[0] = h0;
+  slots[1] = (h0 + segment_length_) ^ ((hash >> 18) & mask);
+  slots[2] = (h0 + 2 * segment_length_) ^ (hash & mask);
+}
+
+uint64_t binary_fuse_filter::fingerprint(uint64_t hash) const {
+  return (hash ^ (hash >> 32)) & ((uint64_t(1) << fingerprint_bits_) - 1);
+}
+
+uint64_t binary_fuse_filter::get(size_t i) const {
+  auto bytes = reinterpret_cast<char const*>(fingerprints_.data());
+  if (fingerprint_bits_ == 8)
+    return static_cast<uint8_t>(bytes[i]);
+  uint16_t x;
+  memcpy(&x, bytes + 2 * i, sizeof(x));
+  return x;
+}
+
+void binary_fuse_filter::set(size_t i, uint64_t fingerprint) {
+  auto bytes = reinterpret_cast<char*>(fingerprints_.data());
+  if (fingerprint_bits_ == 8) {
+    bytes[i] = static_cast<char>(fingerprint);
+    return;
+  }
+  auto x = static_cast<uint16_t>(fingerprint);
+  memcpy(bytes + 2 * i, &x, sizeof(x));
+}
+
+} // namespace bf
@@ -1,5 +1,7 @@
 #include <bf/bloom_filter/bitwise.hpp>
 
+#include <bf/container.hpp>
+
 namespace bf {
 
 bitwise_bloom_filter::bitwise_bloom_filter(size_t k, size_t cells, size_t seed)
@@ -60,4 +62,32 @@ unsigned int bitwise_bloom_filter::serializedSize() const {
 int bitwise_bloom_filter::fromBuf(const char*buf, unsigned int len){
   return 0;
 }
+
+void bitwise_bloom_filter::write(container_writer& w) const {
+  w.parameters(filter_type::bitwise, {k_, cells_, seed_, levels_.size()});
+  for (auto& level : levels_)
+    level.write(w);
+}
+
+int bitwise_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::bitwise, params) != 0 || params.size() != 4
+      || params[3] == 0)
+    return 1;
+  // The count comes from the container, so allocate only for levels that
+  // actually follow.
+  std::vector<basic_bloom_filter> levels;
+  for (uint64_t i = 0; i < params[3]; ++i) {
+    basic_bloom_filter level;
+    if (level.read(r) != 0)
+      return 2;
+    levels.push_back(std::move(level));
+  }
+  k_ = params[0];
+  cells_ = params[1];
+  seed_ = params[2];
+  levels_ = std::move(levels);
+  return 0;
+}
+
 } // namespace bf
@@ -0,0 +1,163 @@
+#include <bf/bloom_filter/blocked.hpp>
+
+#include <cassert>
+#include <cmath>
+
+#include <bf/bloom_filter/basic.hpp>
+#include <bf/container.hpp>
+
+namespace bf {
+
+constexpr size_t blocked_bloom_filter::block_bits;
+
+double blocked_bloom_filter::fp(size_t cells, size_t capacity, size_t k) {
+  auto blocks = std::max<size_t>(cells / block_bits, 1);
+  auto lambda = static_cast<double>(capacity) / blocks;
+  if (lambda == 0)
+    return 0;
+  // Sum the false-positive rate of a basic Bloom filter of one block over the
+  // Poisson-distributed number of elements per block.
+  auto log_lambda = std::log(lambda);
+  auto last = static_cast<size_t>(lambda + 10 * std::sqrt(lambda) + 10);
+  auto empty = std::log1p(-1.0 / block_bits);
+  double result = 0;
+  for (size_t i = 0; i <= last; ++i) {
+    auto p = std::exp(i * log_lambda - lambda - std::lgamma(i + 1.0));
+    result += p * std::pow(1 - std::exp(empty * k * i), k);
+  }
+  return result;
+}
+
+size_t blocked_bloom_filter::m(double fp, size_t capacity) {
+  auto round_up = [](size_t cells) {
+    return (cells + block_bits - 1) / block_bits * block_bits;
+  };
+  auto cells = round_up(std::max<size_t>(basic_bloom_filter::m(fp, capacity),
+                                         block_bits));
+  // Grow in small steps until the blocking penalty is compensated.
+  for (int i = 0; i < 1000; ++i) {
+    if (blocked_bloom_filter::fp(cells, capacity, k(cells, capacity)) <= fp)
+      break;
+    cells = round_up(cells + cells / 64);
+  }
+  return cells;
+}
+
+size_t blocked_bloom_filter::k(size_t cells, size_t capacity) {
+  return std::max<size_t>(basic_bloom_filter::k(cells, capacity), 1);
+}
+
+blocked_bloom_filter::blocked_bloom_filter(std::shared_ptr<base_hasher> h,
+                                           size_t cells)
+    : hasher_(std::move(h)),
+      bits_((cells + block_bits - 1) / block_bits * block_bits) {
+  assert(cells > 0);
+}
+
+blocked_bloom_filter::blocked_bloom_filter(double fp, size_t capacity,
+                                           size_t seed, bool double_hashing) {
+  auto required_cells = m(fp, capacity);
+  bits_.resize(required_cells);
+  hasher_ = make_hasher(k(required_cells, capacity), seed, double_hashing);
+}
+
+void blocked_bloom_filter::add(object const& o) {
+  digest_buffer digests;
+  (*hasher_)(o, digests);
+  auto first = block(digests);
+  for (auto d : digests)
+    bits_.set(first + offset(d));
+}
+
+size_t blocked_bloom_filter::lookup(object const& o) const {
+  digest_buffer digests;
+  (*hasher_)(o, digests);
+  auto first = block(digests);
+  for (auto d : digests)
+    if (!bits_[first + offset(d)])
+      return 0;
+  return 1;
+}
+
+void blocked_bloom_filter::clear() {
+  bits_.reset();
+}
+
+bitvector const& blocked_bloom_filter::storage() const {
+  return bits_;
+}
+
+std::shared_ptr<base_hasher> const&
+blocked_bloom_filter::hasher_function() const {
+  return hasher_;
+}
+
+size_t blocked_bloom_filter::block(digest_buffer const& digests) const {
+  return digests[0] % (bits_.size() / block_bits) * block_bits;
+}
+
+size_t blocked_bloom_filter::offset(digest d) {
+  // The block index consumes the low-order bits of the first digest, so mix
+  // the high-order bits down to pick the position within the block.
+  return ((d * 0x9e3779b97f4a7c15ULL) >> 32) % block_bits;
+}
+
+char* blocked_bloom_filter::serialize(char* buf) {
+  auto hasher_sz = hasher_->serializedSize();
+  *reinterpret_cast<uint32_t*>(buf) = htobe32(hasher_sz);
+  buf += sizeof(hasher_sz);
+  buf = hasher_->serialize(buf);
+  auto bits_sz = bits_.serializedSize();
+  *reinterpret_cast<uint32_t*>(buf) = htobe32(bits_sz);
+  buf += sizeof(bits_sz);
+  return bits_.serialize(buf);
+}
+
+unsigned int blocked_bloom_filter::serializedSize() const {
+  return sizeof(unsigned int) * 2 + hasher_->serializedSize()
+         + bits_.serializedSize();
+}
+
+int blocked_bloom_filter::fromBuf(const char* buf, unsigned int len) {
+  auto buf_start = buf;
+  auto hasher_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
+  buf += sizeof(unsigned int);
+  hasher_ = hasher_factory::createHasher(buf);
+  if (!hasher_)
+    return 1;
+  if (hasher_->fromBuf(buf, hasher_sz) != 0)
+    return 2;
+  buf += hasher_sz;
+  auto cells_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
+  buf += sizeof(unsigned int);
+  if (bits_.fromBuf(buf, cells_sz) != 0)
+    return 3;
+  buf += cells_sz;
+  if (bits_.size() == 0 || bits_.size() % block_bits != 0)
+    return 4;
+  if (buf - buf_start != len)
+    return 5;
+  return 0;
+}
+
+
+void blocked_bloom_filter::write(container_writer& w) const {
+  w.parameters(filter_type::blocked, {});
+  w.hasher(*hasher_);
+  bits_.write(w);
+}
+
+int blocked_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::blocked, params) != 0)
+    return 1;
+  if (r.hasher(hasher_) != 0)
+    return 2;
+  if (bits_.read(r) != 0)
+    return 3;
+  if (bits_.size() == 0 || bits_.size() % block_bits != 0)
+    return 4;
+  return 0;
+}
+
+} // namespace bf
@@ -0,0 +1,205 @@
+#include <bf/bloom_filter/concurrent.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace bf {
+
+namespace {
+
+typedef bitvector::block_type block_type;
+
+constexpr size_t block_bits = bitvector::bits_per_block;
+
+} // namespace <anonymous>
+
+concurrent_bloom_filter::concurrent_bloom_filter(
+  std::shared_ptr<base_hasher> h, size_t cells, bool partition,
+  index_mapping mapping)
+    : basic_bloom_filter(std::move(h), cells, partition, mapping) {
+}
+
+concurrent_bloom_filter::concurrent_bloom_filter(double fp, size_t capacity,
+                                                 size_t seed,
+                                                 bool double_hashing,
+                                                 bool partition,
+                                                 index_mapping mapping)
+    : basic_bloom_filter(fp, capacity, seed, double_hashing, partition,
+                         mapping) {
+}
+
+void concurrent_bloom_filter::add(object const& o) {
+  digest_buffer indices;
+  find_indices(o, indices);
+  set(indices);
+}
+
+size_t concurrent_bloom_filter::lookup(object const& o) const {
+  digest_buffer indices;
+  find_indices(o, indices);
+  return test(indices) ? 1 : 0;
+}
+
+void concurrent_bloom_filter::add_many(span<object const> objects) {
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      set(indices[i]);
+  }
+}
+
+void concurrent_bloom_filter::lookup_many(span<object const> objects,
+                                          span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      counts[first + i] = test(indices[i]) ? 1 : 0;
+  }
+}
+
+void concurrent_bloom_filter::clear() {
+  auto blocks = bits_.data();
+  for (size_t i = 0; i < bits_.blocks(); ++i)
+    __atomic_store_n(&blocks[i], block_type(0), __ATOMIC_RELAXED);
+}
+
+int concurrent_bloom_filter::read(container_reader& r) {
+  if (auto status = basic_bloom_filter::read(r))
+    return status;
+  // Copy storage viewed in a mapping now, not racily on the first insertion.
+  bits_.data();
+  return 0;
+}
+
+void concurrent_bloom_filter::set(digest_buffer const& indices) {
+  auto blocks = bits_.data();
+  for (auto i : indices) {
+    auto& block = blocks[i / block_bits];
+    auto mask = block_type(1) << (i % block_bits);
+    // Writing a cache line takes it exclusive and invalidates it in all other
+    // cores, so skip the write if the bit is already set, as it is for most
+    // bits of a well-filled filter.
+    if ((__atomic_load_n(&block, __ATOMIC_RELAXED) & mask) == 0)
+      __atomic_fetch_or(&block, mask, __ATOMIC_RELAXED);
+  }
+}
+
+bool concurrent_bloom_filter::test(digest_buffer const& indices) const {
+  auto blocks = bits_.data();
+  for (auto i : indices) {
+    auto mask = block_type(1) << (i % block_bits);
+    if ((__atomic_load_n(&blocks[i / block_bits], __ATOMIC_RELAXED) & mask)
+        == 0)
+      return false;
+  }
+  return true;
+}
+
+concurrent_counting_bloom_filter::concurrent_counting_bloom_filter(
+  std::shared_ptr<base_hasher> h, size_t cells, size_t width, bool partition,
+  index_mapping mapping)
+    : counting_bloom_filter(std::move(h), cells, width, partition, mapping) {
+  // The compare-and-swap replaces one word, which must hold all of a counter.
+  if (width == 0 || block_bits % width != 0)
+    throw std::invalid_argument("counter width must divide 64");
+}
+
+void concurrent_counting_bloom_filter::add(object const& o) {
+  digest_buffer indices;
+  find_indices(o, indices);
+  increment(indices);
+}
+
+size_t concurrent_counting_bloom_filter::lookup(object const& o) const {
+  digest_buffer indices;
+  find_indices(o, indices);
+  return find_minimum(indices);
+}
+
+void concurrent_counting_bloom_filter::add_many(span<object const> objects) {
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      increment(indices[i]);
+  }
+}
+
+void concurrent_counting_bloom_filter::lookup_many(span<object const> objects,
+                                                   span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      counts[first + i] = find_minimum(indices[i]);
+  }
+}
+
+void concurrent_counting_bloom_filter::clear() {
+  cells_.clear_atomic();
+}
+
+void concurrent_counting_bloom_filter::remove(object const& o) {
+  digest_buffer indices;
+  find_indices(o, indices);
+  decrement(indices);
+}
+
+int concurrent_counting_bloom_filter::fromBuf(const char* buf,
+                                              unsigned int len) {
+  if (auto status = counting_bloom_filter::fromBuf(buf, len))
+    return status;
+  return adopt();
+}
+
+int concurrent_counting_bloom_filter::read(container_reader& r) {
+  if (auto status = counting_bloom_filter::read(r))
+    return status;
+  return adopt();
+}
+
+int concurrent_counting_bloom_filter::adopt() {
+  if (block_bits % cells_.width() != 0)
+    return 1;
+  // Copy storage viewed in a mapping now, not racily on the first update.
+  cells_.set(0, cells_.count(0));
+  return 0;
+}
+
+void concurrent_counting_bloom_filter::increment(
+  digest_buffer const& indices) {
+  for (auto i : indices)
+    cells_.increment_atomic(i);
+}
+
+void concurrent_counting_bloom_filter::decrement(
+  digest_buffer const& indices) {
+  for (auto i : indices)
+    cells_.decrement_atomic(i);
+}
+
+size_t concurrent_counting_bloom_filter::find_minimum(
+  digest_buffer const& indices) const {
+  auto min = cells_.max();
+  for (auto i : indices) {
+    auto cnt = cells_.count_atomic(i);
+    if (cnt < min)
+      min = cnt;
+  }
+  return min;
+}
+
+} // namespace bf
@@ -0,0 +1,308 @@
+#include <bf/bloom_filter/count_min.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string.h>
+
+#include <bf/container.hpp>
+
+namespace bf {
+
+namespace {
+
+size_t cells_for(double epsilon) {
+  return static_cast<size_t>(std::ceil(std::exp(1.0) / epsilon));
+}
+
+size_t rows_for(double delta) {
+  return std::max(1, static_cast<int>(std::ceil(std::log(1 / delta))));
+}
+
+/// Maps an object to the indices of its counters, one per row.
+void locate(base_hasher& h, size_t cells, object const& o,
+            digest_buffer& indices) {
+  h(o, indices);
+  for (size_t i = 0; i < indices.size(); ++i)
+    indices[i] = i * cells
+                 + map_index(indices[i], cells, index_mapping::fast_range);
+}
+
+} // namespace <anonymous>
+
+count_min_sketch::count_min_sketch(std::shared_ptr<base_hasher> h,
+                                   size_t cells, size_t width, size_t top)
+    : hasher_(std::move(h)),
+      counters_(hasher_->k() * cells, width),
+      cells_(cells),
+      top_(top) {
+  assert(cells > 0);
+}
+
+count_min_sketch::count_min_sketch(double epsilon, double delta, size_t top,
+                                   size_t seed)
+    : count_min_sketch(make_hasher(rows_for(delta), seed), cells_for(epsilon),
+                       32, top) {
+  assert(epsilon > 0 && delta > 0 && delta < 1);
+}
+
+void count_min_sketch::add(object const& o) {
+  insert(o);
+}
+
+size_t count_min_sketch::lookup(object const& o) const {
+  digest_buffer indices;
+  find_indices(o, indices);
+  return find_minimum(indices);
+}
+
+void count_min_sketch::add_many(span<object const> objects) {
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      update(batch[i], indices[i], 1);
+  }
+}
+
+void count_min_sketch::lookup_many(span<object const> objects,
+                                   span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      counts[first + i] = find_minimum(indices[i]);
+  }
+}
+
+void count_min_sketch::clear() {
+  counters_.clear();
+  total_ = 0;
+  heap_.clear();
+  positions_.clear();
+}
+
+void count_min_sketch::insert(object const& o, size_t count) {
+  digest_buffer indices;
+  find_indices(o, indices);
+  update(o, indices, count);
+}
+
+bool count_min_sketch::merge(count_min_sketch const& other) {
+  if (cells_ != other.cells_ || counters_.size() != other.counters_.size()
+      || counters_.width() != other.counters_.width()
+      || !same_hasher(hasher_, other.hasher_))
+    return false;
+  counters_.add(other.counters_);
+  total_ += other.total_;
+  // Any heavy hitter of the union may make the cut, with its estimate from
+  // the combined counters.
+  auto candidates = std::move(heap_);
+  candidates.insert(candidates.end(), other.heap_.begin(), other.heap_.end());
+  heap_.clear();
+  positions_.clear();
+  digest_buffer indices;
+  for (auto& c : candidates) {
+    object o{c.item.key.data(), c.item.key.size()};
+    find_indices(o, indices);
+    track(o, indices, find_minimum(indices));
+  }
+  return true;
+}
+
+std::vector<count_min_sketch::heavy_hitter>
+count_min_sketch::heavy_hitters() const {
+  std::vector<heavy_hitter> result;
+  for (auto& x : heap_)
+    result.push_back({x.item.key, lookup(wrap(x.item.key))});
+  std::sort(result.begin(), result.end(),
+            [](heavy_hitter const& x, heavy_hitter const& y) {
+              return x.count != y.count ? x.count > y.count : x.key < y.key;
+            });
+  return result;
+}
+
+size_t count_min_sketch::rows() const {
+  return cells_ == 0 ? 0 : counters_.size() / cells_;
+}
+
+size_t count_min_sketch::cells() const {
+  return cells_;
+}
+
+size_t count_min_sketch::top() const {
+  return top_;
+}
+
+size_t count_min_sketch::total() const {
+  return total_;
+}
+
+void count_min_sketch::write(container_writer& w) const {
+  w.parameters(filter_type::count_min,
+               {cells_, counters_.width(), top_, total_});
+  w.hasher(*hasher_);
+  counters_.write(w);
+  // The heavy hitters follow as their counts, the lengths of their keys,
+  // and the keys packed into words.
+  std::vector<uint64_t> heavy;
+  for (auto& x : heap_) {
+    heavy.push_back(x.item.count);
+    heavy.push_back(x.item.key.size());
+    auto first = heavy.size();
+    heavy.resize(first + (x.item.key.size() + 7) / 8);
+    memcpy(heavy.data() + first, x.item.key.data(), x.item.key.size());
+  }
+  w.parameters(filter_type::count_min, heavy);
+}
+
+int count_min_sketch::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::count_min, params) != 0 || params.size() != 4
+      || params[0] == 0 || params[1] == 0 || params[1] > 64)
+    return 1;
+  std::shared_ptr<base_hasher> h;
+  if (r.hasher(h) != 0 || h->k() == 0)
+    return 2;
+  counter_vector counters;
+  if (counters.read(r, params[1]) != 0
+      || counters.size() != h->k() * params[0])
+    return 3;
+  std::vector<uint64_t> heavy;
+  if (r.parameters(filter_type::count_min, heavy) != 0)
+    return 4;
+  std::vector<entry> heap;
+  for (size_t i = 0; i < heavy.size();) {
+    if (heavy.size() - i < 2 || heap.size() == params[2])
+      return 4;
+    auto count = heavy[i++];
+    auto length = heavy[i++];
+    auto words = (length + 7) / 8;
+    if (length > 8 * (heavy.size() - i))
+      return 4;
+    auto key = reinterpret_cast<char const*>(heavy.data() + i);
+    heap.push_back({{std::string(key, length), count}, 0});
+    i += words;
+  }
+  std::unordered_map<uint64_t, size_t> positions;
+  digest_buffer indices;
+  for (size_t i = 0; i < heap.size(); ++i) {
+    locate(*h, params[0], wrap(heap[i].item.key), indices);
+    heap[i].id = identify(indices);
+    if (!positions.emplace(heap[i].id, i).second
+        || (i > 0 && heap[(i - 1) / 2].item.count > heap[i].item.count))
+      return 4;
+  }
+  hasher_ = std::move(h);
+  counters_ = std::move(counters);
+  cells_ = params[0];
+  top_ = params[2];
+  total_ = params[3];
+  heap_ = std::move(heap);
+  positions_ = std::move(positions);
+  return 0;
+}
+
+void count_min_sketch::find_indices(object const& o,
+                                    digest_buffer& indices) const {
+  locate(*hasher_, cells_, o, indices);
+}
+
+void count_min_sketch::prefetch(span<object const> objects,
+                                digest_buffer* indices) const {
+  assert(objects.size() <= batch_size);
+  for (size_t i = 0; i < objects.size(); ++i) {
+    find_indices(objects[i], indices[i]);
+    for (auto j : indices[i])
+      counters_.prefetch(j);
+  }
+}
+
+uint64_t count_min_sketch::identify(digest_buffer const& indices) {
+  uint64_t id = 0;
+  for (auto i : indices)
+    id = mix(id ^ i);
+  return id;
+}
+
+size_t count_min_sketch::find_minimum(digest_buffer const& indices) const {
+  auto min = counters_.max();
+  for (auto i : indices)
+    min = std::min(min, counters_.count(i));
+  return min;
+}
+
+void count_min_sketch::update(object const& o, digest_buffer const& indices,
+                              size_t count) {
+  // Conservative update: raise each counter to the new estimate at most.
+  auto min = find_minimum(indices);
+  auto max = counters_.max();
+  auto estimate = count > max - min ? max : min + count;
+  for (auto i : indices)
+    if (counters_.count(i) < estimate)
+      counters_.set(i, estimate);
+  total_ += count;
+  track(o, indices, estimate);
+}
+
+void count_min_sketch::track(object const& o, digest_buffer const& indices,
+                             size_t count) {
+  // An element in the heap had an estimate of at least the minimum before,
+  // and its estimate only grows, so a smaller one means a new element.
+  if (top_ == 0 || (heap_.size() == top_ && count <= heap_[0].item.count))
+    return;
+  auto id = identify(indices);
+  auto i = positions_.find(id);
+  if (i != positions_.end()) {
+    heap_[i->second].item.count = count;
+    sift_down(i->second);
+    return;
+  }
+  entry e{{std::string{static_cast<char const*>(o.data()), o.size()}, count},
+          id};
+  if (heap_.size() < top_) {
+    positions_.emplace(id, heap_.size());
+    heap_.push_back(std::move(e));
+    sift_up(heap_.size() - 1);
+  } else {
+    positions_.erase(heap_[0].id);
+    positions_.emplace(id, 0);
+    heap_[0] = std::move(e);
+    sift_down(0);
+  }
+}
+
+void count_min_sketch::sift_up(size_t i) {
+  while (i > 0 && heap_[(i - 1) / 2].item.count > heap_[i].item.count) {
+    exchange(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+void count_min_sketch::sift_down(size_t i) {
+  for (;;) {
+    auto min = i;
+    for (auto child : {2 * i + 1, 2 * i + 2})
+      if (child < heap_.size()
+          && heap_[child].item.count < heap_[min].item.count)
+        min = child;
+    if (min == i)
+      return;
+    exchange(i, min);
+    i = min;
+  }
+}
+
+void count_min_sketch::exchange(size_t i, size_t j) {
+  using std::swap;
+  swap(heap_[i], heap_[j]);
+  positions_[heap_[i].id] = i;
+  positions_[heap_[j].id] = j;
+}
+
+} // namespace bf
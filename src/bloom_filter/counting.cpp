@@ -7,22 +7,48 @@
 namespace bf {
 
 counting_bloom_filter::counting_bloom_filter(std::shared_ptr<base_hasher> h, size_t cells,
-                                             size_t width, bool partition)
-    : hasher_(std::move(h)), cells_(cells, width), partition_(partition) {
+                                             size_t width, bool partition,
+                                             index_mapping mapping)
+    : hasher_(std::move(h)),
+      cells_(cells, width),
+      partition_(partition),
+      mapping_(mapping) {
 }
 
 void counting_bloom_filter::add(object const& o) {
-  increment(find_indices(o));
+  digest_buffer indices;
+  find_indices(o, indices);
+  increment(indices);
 }
 
 size_t counting_bloom_filter::lookup(object const& o) const {
-  auto min = cells_.max();
-  for (auto i : find_indices(o)) {
-    auto cnt = cells_.count(i);
-    if (cnt < min)
-      min = cnt;
+  digest_buffer indices;
+  find_indices(o, indices);
+  return find_minimum(indices);
+}
+
+void counting_bloom_filter::add_many(span<object const> objects) {
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      increment(indices[i]);
+  }
+}
+
+void counting_bloom_filter::lookup_many(span<object const> objects,
+                                        span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  digest_buffer indices[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i)
+      counts[first + i] = find_minimum(indices[i]);
   }
-  return min;
 }
 
 void counting_bloom_filter::clear() {
@@ -30,28 +56,38 @@ void counting_bloom_filter::clear() {
 }
 
 void counting_bloom_filter::remove(object const& o) {
-  decrement(find_indices(o));
+  digest_buffer indices;
+  find_indices(o, indices);
+  decrement(indices);
 }
 
-std::vector<size_t> counting_bloom_filter::find_indices(object const& o) const {
-  auto digests = (*hasher_)(o);
-  std::vector<size_t> indices(digests.size());
+void counting_bloom_filter::find_indices(object const& o,
+                                         digest_buffer& indices) const {
+  (*hasher_)(o, indices);
   if (partition_) {
-    assert(cells_.size() % digests.size() == 0);
-    auto const parts = cells_.size() / digests.size();
+    assert(cells_.size() % indices.size() == 0);
+    auto const parts = cells_.size() / indices.size();
     for (size_t i = 0; i < indices.size(); ++i)
-      indices[i] = (i * parts) + digests[i] % parts;
+      indices[i] = (i * parts) + map_index(indices[i], parts, mapping_);
   } else {
     for (size_t i = 0; i < indices.size(); ++i)
-      indices[i] = digests[i] % cells_.size();
+      indices[i] = map_index(indices[i], cells_.size(), mapping_);
   }
   std::sort(indices.begin(), indices.end());
-  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
-  return indices;
-};
+  indices.resize(std::unique(indices.begin(), indices.end()) - indices.begin());
+}
+
+void counting_bloom_filter::prefetch(span<object const> objects,
+                                     digest_buffer* indices) const {
+  assert(objects.size() <= batch_size);
+  for (size_t i = 0; i < objects.size(); ++i) {
+    find_indices(objects[i], indices[i]);
+    for (auto j : indices[i])
+      cells_.prefetch(j);
+  }
+}
 
-size_t
-counting_bloom_filter::find_minimum(std::vector<size_t> const& indices) const {
+size_t counting_bloom_filter::find_minimum(digest_buffer const& indices) const {
   auto min = cells_.max();
   for (auto i : indices) {
     auto cnt = cells_.count(i);
@@ -61,24 +97,25 @@ counting_bloom_filter::find_minimum(std::vector<size_t> const& indices) const {
   return min;
 }
 
-std::vector<size_t>
-counting_bloom_filter::find_minima(std::vector<size_t> const& indices) const {
+void counting_bloom_filter::find_minima(digest_buffer const& indices,
+                                        digest_buffer& positions) const {
   auto min = cells_.max();
-  std::vector<size_t> positions;
+  positions.resize(indices.size());
+  size_t n = 0;
   for (auto i : indices) {
     auto cnt = cells_.count(i);
     if (cnt == min) {
-      positions.push_back(i);
+      positions[n++] = i;
     } else if (cnt < min) {
       min = cnt;
-      positions.clear();
-      positions.push_back(i);
+      n = 0;
+      positions[n++] = i;
     }
   }
-  return positions;
+  positions.resize(n);
 }
 
-bool counting_bloom_filter::increment(std::vector<size_t> const& indices,
+bool counting_bloom_filter::increment(digest_buffer const& indices,
                                       size_t value) {
   auto status = true;
   for (auto i : indices)
@@ -87,7 +124,7 @@ bool counting_bloom_filter::increment(std::vector<size_t> const& indices,
   return status;
 }
 
-bool counting_bloom_filter::decrement(std::vector<size_t> const& indices,
+bool counting_bloom_filter::decrement(digest_buffer const& indices,
                                       size_t value) {
   auto status = true;
   for (auto i : indices)
@@ -100,6 +137,32 @@ size_t counting_bloom_filter::count(size_t index) const {
   return cells_.count(index);
 }
 
+index_mapping counting_bloom_filter::mapping() const {
+  return mapping_;
+}
+
+bool counting_bloom_filter::compatible(
+  counting_bloom_filter const& other) const {
+  return cells_.size() == other.cells_.size()
+         && cells_.width() == other.cells_.width()
+         && partition_ == other.partition_ && mapping_ == other.mapping_
+         && same_hasher(hasher_, other.hasher_);
+}
+
+bool counting_bloom_filter::merge(counting_bloom_filter const& other) {
+  if (!compatible(other))
+    return false;
+  cells_.add(other.cells_);
+  return true;
+}
+
+bool counting_bloom_filter::intersect(counting_bloom_filter const& other) {
+  if (!compatible(other))
+    return false;
+  cells_.minimum(other.cells_);
+  return true;
+}
+
 char* counting_bloom_filter::serialize(char* buf) {
   unsigned int hasher_sz = hasher_->serializedSize();
   memmove(buf, &hasher_sz, sizeof(hasher_sz));
@@ -110,12 +173,20 @@ char* counting_bloom_filter::serialize(char* buf) {
   buf += sizeof(cells_sz);
   buf = cells_.serialize(buf);
   memmove(buf, &partition_, sizeof(partition_));
-  return buf + sizeof(partition_);
+  buf += sizeof(partition_);
+  // Filters with modulo mapping omit the trailing mapping byte, so that they
+  // remain readable by older versions.
+  if (mapping_ != index_mapping::modulo) {
+    memmove(buf, &mapping_, sizeof(mapping_));
+    buf += sizeof(mapping_);
+  }
+  return buf;
 }
 
 unsigned int counting_bloom_filter::serializedSize() const {
   return sizeof(unsigned int) * 2 + hasher_->serializedSize()
-         + cells_.serializedSize() + sizeof(partition_);
+         + cells_.serializedSize() + sizeof(partition_)
+         + (mapping_ != index_mapping::modulo ? sizeof(mapping_) : 0);
 }
 
 int counting_bloom_filter::fromBuf(const char* buf, unsigned int len) {
@@ -136,6 +207,13 @@ int counting_bloom_filter::fromBuf(const char* buf, unsigned int len) {
   buf += *cells_sz;
   memmove(&partition_, buf, sizeof(partition_));
   buf += sizeof(partition_);
+  mapping_ = index_mapping::modulo;
+  if (static_cast<unsigned int>(buf - buf_start) < len) {
+    memmove(&mapping_, buf, sizeof(mapping_));
+    buf += sizeof(mapping_);
+    if (mapping_ != index_mapping::fast_range)
+      return 5;
+  }
   if (buf - buf_start != len)
     return 4;
   return 0;
@@ -147,7 +225,23 @@ spectral_mi_bloom_filter::spectral_mi_bloom_filter(std::shared_ptr<base_hasher>
 }
 
 void spectral_mi_bloom_filter::add(object const& o) {
-  increment(find_minima(find_indices(o)));
+  digest_buffer indices, minima;
+  find_indices(o, indices);
+  find_minima(indices, minima);
+  increment(minima);
+}
+
+void spectral_mi_bloom_filter::add_many(span<object const> objects) {
+  digest_buffer indices[batch_size], minima;
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto batch = objects.subspan(
+      first, std::min(objects.size() - first, size_t(batch_size)));
+    prefetch(batch, indices);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      find_minima(indices[i], minima);
+      increment(minima);
+    }
+  }
 }
 
 spectral_rm_bloom_filter::spectral_rm_bloom_filter(std::shared_ptr<base_hasher> h1, size_t cells1,
@@ -164,13 +258,15 @@ spectral_rm_bloom_filter::spectral_rm_bloom_filter(std::shared_ptr<base_hasher>
 // its counters, otherwise add x to the secondary SBF, with an initial value
 // that equals its minimal value from the primary SBF."
 void spectral_rm_bloom_filter::add(object const& o) {
-  auto indices1 = first_.find_indices(o);
+  digest_buffer indices1, mins1;
+  first_.find_indices(o, indices1);
   first_.increment(indices1);
-  auto mins1 = first_.find_minima(indices1);
+  first_.find_minima(indices1, mins1);
   if (mins1.size() > 1)
     return;
 
-  auto indices2 = second_.find_indices(o);
+  digest_buffer indices2;
+  second_.find_indices(o, indices2);
   auto min1 = first_.count(mins1[0]);
   auto min2 = second_.find_minimum(indices2);
 
@@ -185,11 +281,14 @@ void spectral_rm_bloom_filter::add(object const& o) {
 // secondary SBF. If [the] returned value is greater than 0, return it.
 // Otherwise, return minimum from primary SBF."
 size_t spectral_rm_bloom_filter::lookup(object const& o) const {
-  auto mins1 = first_.find_minima(first_.find_indices(o));
+  digest_buffer indices, mins1;
+  first_.find_indices(o, indices);
+  first_.find_minima(indices, mins1);
   auto min1 = first_.count(mins1[0]);
   if (mins1.size() > 1)
     return min1;
-  auto min2 = second_.find_minimum(second_.find_indices(o));
+  second_.find_indices(o, indices);
+  auto min2 = second_.find_minimum(indices);
   return min2 > 0 ? min2 : min1;
 }
 
@@ -202,13 +301,15 @@ void spectral_rm_bloom_filter::clear() {
 // minimum (or if it exists in Bf) decrease its counters in the secondary SBF,
 // unless at least one of them is 0."
 void spectral_rm_bloom_filter::remove(object const& o) {
-  auto indices1 = first_.find_indices(o);
+  digest_buffer indices1, mins1;
+  first_.find_indices(o, indices1);
   first_.decrement(indices1);
-  auto mins1 = first_.find_minima(indices1);
+  first_.find_minima(indices1, mins1);
   if (mins1.size() > 1)
     return;
 
-  auto indices2 = second_.find_indices(o);
+  digest_buffer indices2;
+  second_.find_indices(o, indices2);
   if (second_.find_minimum(indices2) > 0)
     second_.decrement(indices2);
 }
@@ -245,4 +346,65 @@ int spectral_rm_bloom_filter::fromBuf(const char* buf, unsigned int len) {
   return 0;
 }
 
+
+void counting_bloom_filter::write(container_writer& w) const {
+  write_cells(w, filter_type::counting, 0);
+}
+
+int counting_bloom_filter::read(container_reader& r) {
+  uint64_t extra;
+  return read_cells(r, filter_type::counting, extra);
+}
+
+void counting_bloom_filter::write_cells(container_writer& w,
+                                        filter_type type,
+                                        uint64_t extra) const {
+  w.parameters(type, {partition_, static_cast<uint64_t>(mapping_),
+                      cells_.width(), extra});
+  w.hasher(*hasher_);
+  cells_.write(w);
+}
+
+int counting_bloom_filter::read_cells(container_reader& r, filter_type type,
+                                      uint64_t& extra) {
+  std::vector<uint64_t> params;
+  if (r.parameters(type, params) != 0 || params.size() != 4
+      || params[1] > static_cast<uint64_t>(index_mapping::fast_range))
+    return 1;
+  if (r.hasher(hasher_) != 0)
+    return 2;
+  if (cells_.read(r, params[2]) != 0)
+    return 3;
+  partition_ = params[0] != 0;
+  mapping_ = static_cast<index_mapping>(params[1]);
+  extra = params[3];
+  return 0;
+}
+
+void spectral_mi_bloom_filter::write(container_writer& w) const {
+  write_cells(w, filter_type::spectral_mi, 0);
+}
+
+int spectral_mi_bloom_filter::read(container_reader& r) {
+  uint64_t extra;
+  return read_cells(r, filter_type::spectral_mi, extra);
+}
+
+void spectral_rm_bloom_filter::write(container_writer& w) const {
+  w.parameters(filter_type::spectral_rm, {});
+  first_.write(w);
+  second_.write(w);
+}
+
+int spectral_rm_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::spectral_rm, params) != 0)
+    return 1;
+  if (first_.read(r) != 0)
+    return 2;
+  if (second_.read(r) != 0)
+    return 3;
+  return 0;
+}
+
 } // namespace bf
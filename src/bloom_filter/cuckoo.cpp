@@ -0,0 +1,255 @@
+#include <bf/bloom_filter/cuckoo.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+#include <bf/container.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BF_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bf {
+
+namespace {
+
+typedef bitvector::block_type block_type;
+
+/// Repeats a value in every lane of a bucket.
+uint64_t broadcast(uint64_t x, size_t width) {
+  return x * (width == 8 ? 0x01010101ULL : 0x0001000100010001ULL);
+}
+
+/// Marks the most significant bit of each lane of a bucket that is 0.
+uint64_t zero_lanes(uint64_t x, size_t width) {
+  auto low = broadcast(width == 8 ? 0x7f : 0x7fff, width);
+  auto high = broadcast(width == 8 ? 0x80 : 0x8000, width);
+  // Adding the low bits sets the high bit of a lane unless they are all 0,
+  // without a carry into the next lane.
+  return ~(((x & low) + low) | x | low) & high;
+}
+
+} // namespace <anonymous>
+
+cuckoo_filter::cuckoo_filter(std::shared_ptr<base_hasher> h, size_t capacity,
+                             size_t fingerprint_bits)
+    : hasher_(std::move(h)), fingerprint_bits_(fingerprint_bits) {
+  assert(capacity > 0);
+  assert(fingerprint_bits == 8 || fingerprint_bits == 16);
+  assert(hasher_->k() > 0);
+  auto needed = static_cast<size_t>(std::ceil(capacity / (slots * 0.95)));
+  size_t n = 1;
+  while (n < needed)
+    n *= 2;
+  buckets_.resize(n * slots * fingerprint_bits_);
+}
+
+cuckoo_filter::cuckoo_filter(double fp, size_t capacity, size_t seed)
+    : cuckoo_filter(make_hasher(1, seed), capacity,
+                    fp >= 8.0 / 256 ? 8 : 16) {
+  assert(fp >= 8.0 / 65536);
+}
+
+void cuckoo_filter::add(object const& o) {
+  if (!insert(o))
+    throw std::length_error("cuckoo filter is full");
+}
+
+size_t cuckoo_filter::lookup(object const& o) const {
+  size_t i;
+  uint64_t fp;
+  locate(o, i, fp);
+  auto j = alternate(i, fp);
+  if (victim_ == fp && (victim_bucket_ == i || victim_bucket_ == j))
+    return 1;
+  auto x = bucket(i);
+  auto y = bucket(j);
+#if defined(BF_X86) && defined(__SSE2__)
+  // Compare the eight slots of both buckets at once. With 8-bit
+  // fingerprints, the upper halves of both words are 0 and never match.
+  auto v = _mm_set_epi64x(static_cast<long long>(y),
+                          static_cast<long long>(x));
+  auto eq = fingerprint_bits_ == 8
+    ? _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(fp)))
+    : _mm_cmpeq_epi16(v, _mm_set1_epi16(static_cast<short>(fp)));
+  return _mm_movemask_epi8(eq) != 0 ? 1 : 0;
+#else
+  auto pattern = broadcast(fp, fingerprint_bits_);
+  return (zero_lanes(x ^ pattern, fingerprint_bits_)
+          | zero_lanes(y ^ pattern, fingerprint_bits_)) != 0 ? 1 : 0;
+#endif
+}
+
+void cuckoo_filter::clear() {
+  buckets_.reset();
+  size_ = 0;
+  victim_ = 0;
+  victim_bucket_ = 0;
+}
+
+bool cuckoo_filter::insert(object const& o) {
+  if (victim_ != 0)
+    return false;
+  size_t i;
+  uint64_t fp;
+  locate(o, i, fp);
+  place(i, fp);
+  return true;
+}
+
+bool cuckoo_filter::remove(object const& o) {
+  size_t i;
+  uint64_t fp;
+  locate(o, i, fp);
+  auto j = alternate(i, fp);
+  if (victim_ == fp && (victim_bucket_ == i || victim_bucket_ == j)) {
+    victim_ = 0;
+    --size_;
+    return true;
+  }
+  for (auto b : {i, j}) {
+    auto slot = find(b, fp);
+    if (slot == slots)
+      continue;
+    store(b, slot, 0);
+    --size_;
+    // The freed slot may make room for the victim.
+    if (victim_ != 0) {
+      auto victim = victim_;
+      victim_ = 0;
+      --size_;
+      place(victim_bucket_, victim);
+    }
+    return true;
+  }
+  return false;
+}
+
+size_t cuckoo_filter::size() const {
+  return size_;
+}
+
+size_t cuckoo_filter::capacity() const {
+  return buckets_.size() / fingerprint_bits_;
+}
+
+size_t cuckoo_filter::fingerprint_bits() const {
+  return fingerprint_bits_;
+}
+
+bool cuckoo_filter::full() const {
+  return victim_ != 0;
+}
+
+void cuckoo_filter::write(container_writer& w) const {
+  w.parameters(filter_type::cuckoo,
+               {fingerprint_bits_, size_, victim_, victim_bucket_});
+  w.hasher(*hasher_);
+  buckets_.write(w);
+}
+
+int cuckoo_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::cuckoo, params) != 0 || params.size() != 4
+      || (params[0] != 8 && params[0] != 16))
+    return 1;
+  std::shared_ptr<base_hasher> h;
+  if (r.hasher(h) != 0 || h->k() == 0)
+    return 2;
+  bitvector buckets;
+  if (buckets.read(r) != 0)
+    return 3;
+  auto n = buckets.size() / (slots * params[0]);
+  if (n == 0 || (n & (n - 1)) != 0 || buckets.size() != n * slots * params[0]
+      || params[3] >= n || params[2] >> params[0] != 0)
+    return 4;
+  hasher_ = std::move(h);
+  swap(buckets_, buckets);
+  fingerprint_bits_ = params[0];
+  size_ = params[1];
+  victim_ = params[2];
+  victim_bucket_ = params[3];
+  return 0;
+}
+
+void cuckoo_filter::locate(object const& o, size_t& bucket,
+                           uint64_t& fingerprint) const {
+  digest_buffer digests;
+  (*hasher_)(o, digests);
+  auto d = static_cast<uint64_t>(digests[0]);
+  // The bucket comes from the low bits and the fingerprint from the high
+  // bits of the digest. A fingerprint of 0 marks a free slot.
+  auto n = buckets_.size() / (slots * fingerprint_bits_);
+  bucket = d & (n - 1);
+  fingerprint = d >> (64 - fingerprint_bits_);
+  if (fingerprint == 0)
+    fingerprint = 1;
+}
+
+size_t cuckoo_filter::alternate(size_t bucket, uint64_t fingerprint) const {
+  // Since the mask keeps the bucket a power of two, alternate() is its own
+  // inverse. Hashing the fingerprint spreads the buckets of similar
+  // fingerprints.
+  auto n = buckets_.size() / (slots * fingerprint_bits_);
+  return (bucket ^ (fingerprint * 0x5bd1e995)) & (n - 1);
+}
+
+uint64_t cuckoo_filter::bucket(size_t i) const {
+  auto blocks = buckets_.data();
+  if (fingerprint_bits_ == 16)
+    return blocks[i];
+  return (blocks[i / 2] >> (32 * (i % 2))) & 0xffffffff;
+}
+
+void cuckoo_filter::store(size_t i, size_t slot, uint64_t fingerprint) {
+  auto bits = slot * fingerprint_bits_;
+  auto blocks = buckets_.data();
+  if (fingerprint_bits_ == 8) {
+    bits += 32 * (i % 2);
+    i /= 2;
+  }
+  auto mask = ((block_type(1) << fingerprint_bits_) - 1) << bits;
+  blocks[i] = (blocks[i] & ~mask) | (block_type(fingerprint) << bits);
+}
+
+size_t cuckoo_filter::find(size_t i, uint64_t fingerprint) const {
+  auto x = bucket(i) ^ broadcast(fingerprint, fingerprint_bits_);
+  auto lanes = zero_lanes(x, fingerprint_bits_);
+  if (lanes == 0)
+    return slots;
+  return __builtin_ctzll(lanes) / fingerprint_bits_;
+}
+
+bool cuckoo_filter::put(size_t i, uint64_t fingerprint) {
+  auto slot = find(i, 0);
+  if (slot == slots)
+    return false;
+  store(i, slot, fingerprint);
+  return true;
+}
+
+void cuckoo_filter::place(size_t i, uint64_t fingerprint) {
+  ++size_;
+  auto j = alternate(i, fingerprint);
+  if (put(i, fingerprint) || put(j, fingerprint))
+    return;
+  // Evict fingerprints along a random walk. Alternating the starting bucket
+  // and rotating the evicted slot suffices to avoid cycles in practice.
+  i = kicks_ % 2 == 0 ? i : j;
+  for (size_t n = 0; n < max_kicks; ++n) {
+    auto slot = (kicks_++ >> 1) % slots;
+    auto evicted = bucket(i) >> (slot * fingerprint_bits_)
+                   & ((uint64_t(1) << fingerprint_bits_) - 1);
+    store(i, slot, fingerprint);
+    fingerprint = evicted;
+    i = alternate(i, fingerprint);
+    if (put(i, fingerprint))
+      return;
+  }
+  victim_ = fingerprint;
+  victim_bucket_ = i;
+}
+
+} // namespace bf
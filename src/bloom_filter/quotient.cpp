@@ -0,0 +1,465 @@
+#include <bf/bloom_filter/quotient.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+#include <bf/container.hpp>
+
+namespace bf {
+
+namespace {
+
+// The metadata bits below the remainder of a slot.
+constexpr uint64_t continuation = 1; ///< Not the first entry of its run.
+constexpr uint64_t shifted = 2;      ///< Not in its canonical slot.
+constexpr uint64_t digit = 4;        ///< A digit of a count.
+constexpr size_t flag_bits = 3;
+
+constexpr size_t npos = bitvector::npos;
+
+/// Computes the number of slots past the canonical ones. Clusters rarely
+/// reach further than a small multiple of the square root of the number of
+/// slots beyond their start.
+size_t spare_slots(size_t quotient_bits) {
+  return 64 + static_cast<size_t>(10 * std::ldexp(1.0, quotient_bits / 2));
+}
+
+/// Computes the number of digits of a count.
+size_t digits(size_t count, size_t remainder_bits) {
+  size_t n = 0;
+  for (auto x = count - 1; x != 0; x >>= remainder_bits)
+    ++n;
+  return n;
+}
+
+size_t quotient_bits_for(size_t capacity) {
+  auto q = std::ceil(std::log2(capacity / quotient_filter::max_load));
+  return std::max(1, static_cast<int>(q));
+}
+
+size_t remainder_bits_for(double fp) {
+  return std::max(1, static_cast<int>(std::ceil(-std::log2(fp))));
+}
+
+} // namespace <anonymous>
+
+constexpr double quotient_filter::max_load;
+
+quotient_filter::quotient_filter(std::shared_ptr<base_hasher> h,
+                                 size_t quotient_bits, size_t remainder_bits)
+    : hasher_(std::move(h)) {
+  assert(quotient_bits > 0 && remainder_bits > 0);
+  assert(quotient_bits + remainder_bits <= 64 && remainder_bits <= 61);
+  assert(hasher_->k() > 0);
+  allocate(quotient_bits, remainder_bits);
+}
+
+quotient_filter::quotient_filter(double fp, size_t capacity, size_t seed)
+    : quotient_filter(make_hasher(1, seed), quotient_bits_for(capacity),
+                      remainder_bits_for(fp)) {
+  assert(fp > 0 && fp < 1);
+  assert(capacity > 0);
+}
+
+void quotient_filter::add(object const& o) {
+  while (!insert(o))
+    if (!resize())
+      throw std::length_error("quotient filter is full");
+}
+
+size_t quotient_filter::lookup(object const& o) const {
+  auto fp = fingerprint(o);
+  auto quotient = fp >> remainder_bits_;
+  auto remainder = fp & ((uint64_t(1) << remainder_bits_) - 1);
+  if (!occupieds_[quotient])
+    return 0;
+  // Runs are sorted, so the search ends at the first larger remainder.
+  for (auto i = run_start(quotient);;) {
+    auto r = slots_.count(i) >> flag_bits;
+    auto count = read_count(i);
+    if (r == remainder)
+      return count;
+    if (r > remainder || i == slots_.size()
+        || !(slots_.count(i) & continuation))
+      return 0;
+  }
+}
+
+void quotient_filter::clear() {
+  slots_.clear();
+  occupieds_.reset();
+  size_ = 0;
+  used_ = 0;
+}
+
+bool quotient_filter::insert(object const& o, size_t count) {
+  assert(count > 0);
+  auto fp = fingerprint(o);
+  auto quotient = fp >> remainder_bits_;
+  auto remainder = fp & ((uint64_t(1) << remainder_bits_) - 1);
+  auto limit = static_cast<size_t>(max_load * capacity());
+  auto occupied = occupieds_[quotient];
+  auto start = run_start(quotient);
+  auto i = start;
+  while (occupied) {
+    auto r = slots_.count(i) >> flag_bits;
+    if (r == remainder) {
+      // Add to the count, which may take more digits.
+      auto end = i;
+      auto old = read_count(end);
+      auto updated = count > npos - old ? npos : old + count;
+      auto have = end - i - 1;
+      auto need = digits(updated, remainder_bits_);
+      if (need > have) {
+        if (used_ + need - have > limit
+            || free_slots(end, need - have) < need - have)
+          return false;
+        for (auto n = have; n < need; ++n)
+          insert_slot(end);
+        used_ += need - have;
+      }
+      write_count(i, updated);
+      size_ += updated - old;
+      return true;
+    }
+    if (r > remainder)
+      break;
+    read_count(i);
+    if (i == slots_.size() || !(slots_.count(i) & continuation))
+      break;
+  }
+  // Insert the remainder and its count before slot i.
+  auto need = 1 + digits(count, remainder_bits_);
+  if (used_ + need > limit || free_slots(i, need) < need)
+    return false;
+  for (size_t n = 0; n < need; ++n)
+    insert_slot(i);
+  if (i != start) {
+    slots_.set(i, (remainder << flag_bits) | continuation | shifted);
+  } else {
+    slots_.set(i, (remainder << flag_bits) | (i != quotient ? shifted : 0));
+    // The former first entry of the run now follows the new one.
+    if (occupied)
+      slots_.set(i + need, slots_.count(i + need) | continuation);
+  }
+  write_count(i, count);
+  occupieds_.set(quotient);
+  used_ += need;
+  size_ += count;
+  return true;
+}
+
+bool quotient_filter::remove(object const& o) {
+  auto fp = fingerprint(o);
+  auto quotient = fp >> remainder_bits_;
+  auto remainder = fp & ((uint64_t(1) << remainder_bits_) - 1);
+  if (!occupieds_[quotient])
+    return false;
+  auto start = run_start(quotient);
+  for (auto i = start;;) {
+    auto r = slots_.count(i) >> flag_bits;
+    auto end = i;
+    auto count = read_count(end);
+    auto last = end == slots_.size() || !(slots_.count(end) & continuation);
+    if (r == remainder) {
+      --size_;
+      if (count > 1) {
+        // Drop the digits that the smaller count no longer needs.
+        auto have = end - i - 1;
+        auto need = digits(count - 1, remainder_bits_);
+        write_count(i, count - 1);
+        for (auto n = need; n < have; ++n)
+          remove_slot(i + 1 + need, quotient);
+        used_ -= have - need;
+        return true;
+      }
+      remove_slot(i, quotient);
+      --used_;
+      if (i == start) {
+        if (last) {
+          occupieds_.reset(quotient);
+        } else {
+          // The next entry of the run becomes its first.
+          auto x = slots_.count(i) & ~(continuation | shifted);
+          slots_.set(i, x | (i != quotient ? shifted : 0));
+        }
+      }
+      return true;
+    }
+    if (r > remainder || last)
+      return false;
+    i = end;
+  }
+}
+
+bool quotient_filter::resize() {
+  if (remainder_bits_ == 1)
+    return false;
+  quotient_filter bigger;
+  bigger.allocate(quotient_bits_ + 1, remainder_bits_ - 1);
+  size_t pos = 0, quotient = npos, count, out = 0;
+  uint64_t fp;
+  while (next(pos, quotient, fp, count))
+    if (!bigger.append(fp, count, out))
+      return false;
+  swap(bigger);
+  return true;
+}
+
+bool quotient_filter::merge(quotient_filter const& other) {
+  auto bits = quotient_bits_ + remainder_bits_;
+  if (bits != other.quotient_bits_ + other.remainder_bits_
+      || !same_hasher(hasher_, other.hasher_))
+    return false;
+  // Both tables together need at most as many slots as they use now.
+  auto q = std::max(quotient_bits_, other.quotient_bits_);
+  while (used_ + other.used_ > max_load * std::ldexp(1.0, q) && q + 1 < bits)
+    ++q;
+  for (;; ++q) {
+    quotient_filter merged;
+    merged.allocate(q, bits - q);
+    size_t x_pos = 0, x_quotient = npos, x_count = 0;
+    size_t y_pos = 0, y_quotient = npos, y_count = 0;
+    uint64_t x_fp = 0, y_fp = 0;
+    auto x = next(x_pos, x_quotient, x_fp, x_count);
+    auto y = other.next(y_pos, y_quotient, y_fp, y_count);
+    size_t out = 0;
+    auto ok = true;
+    while (ok && (x || y)) {
+      if (x && (!y || x_fp < y_fp)) {
+        ok = merged.append(x_fp, x_count, out);
+        x = next(x_pos, x_quotient, x_fp, x_count);
+      } else if (!x || y_fp < x_fp) {
+        ok = merged.append(y_fp, y_count, out);
+        y = other.next(y_pos, y_quotient, y_fp, y_count);
+      } else {
+        ok = merged.append(x_fp, x_count + y_count, out);
+        x = next(x_pos, x_quotient, x_fp, x_count);
+        y = other.next(y_pos, y_quotient, y_fp, y_count);
+      }
+    }
+    // Like insertions, the merge may fill at most max_load of the slots.
+    if (ok && merged.used_ <= max_load * merged.capacity()) {
+      swap(merged);
+      return true;
+    }
+    if (q + 2 > bits)
+      return false;
+  }
+}
+
+void quotient_filter::enumerate(std::function<void(uint64_t, size_t)> f) const {
+  size_t pos = 0, quotient = npos, count;
+  uint64_t fp;
+  while (next(pos, quotient, fp, count))
+    f(fp, count);
+}
+
+size_t quotient_filter::size() const {
+  return size_;
+}
+
+size_t quotient_filter::used() const {
+  return used_;
+}
+
+size_t quotient_filter::capacity() const {
+  return occupieds_.size();
+}
+
+size_t quotient_filter::quotient_bits() const {
+  return quotient_bits_;
+}
+
+size_t quotient_filter::remainder_bits() const {
+  return remainder_bits_;
+}
+
+uint64_t quotient_filter::fingerprint(object const& o) const {
+  digest_buffer digests;
+  (*hasher_)(o, digests);
+  // The fingerprint comes from the high bits of the digest, so that it stays
+  // the same however it splits into quotient and remainder.
+  auto bits = quotient_bits_ + remainder_bits_;
+  return static_cast<uint64_t>(digests[0]) >> (64 - bits);
+}
+
+void quotient_filter::write(container_writer& w) const {
+  w.parameters(filter_type::quotient,
+               {quotient_bits_, remainder_bits_, size_, used_});
+  w.hasher(*hasher_);
+  occupieds_.write(w);
+  slots_.write(w);
+}
+
+int quotient_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::quotient, params) != 0 || params.size() != 4)
+    return 1;
+  auto q = params[0];
+  auto rem = params[1];
+  if (q == 0 || rem == 0 || q + rem > 64 || rem > 61)
+    return 1;
+  std::shared_ptr<base_hasher> h;
+  if (r.hasher(h) != 0 || h->k() == 0)
+    return 2;
+  bitvector occupieds;
+  counter_vector slots;
+  if (occupieds.read(r) != 0 || slots.read(r, rem + flag_bits) != 0)
+    return 3;
+  auto n = size_t(1) << q;
+  if (occupieds.size() != n || slots.size() != n + spare_slots(q))
+    return 4;
+  hasher_ = std::move(h);
+  occupieds_ = std::move(occupieds);
+  slots_ = std::move(slots);
+  quotient_bits_ = q;
+  remainder_bits_ = rem;
+  size_ = params[2];
+  used_ = params[3];
+  return 0;
+}
+
+bool quotient_filter::empty(size_t i) const {
+  if (i < occupieds_.size() && occupieds_[i])
+    return false;
+  return !(slots_.count(i) & (continuation | shifted));
+}
+
+size_t quotient_filter::run_start(size_t quotient) const {
+  // Walk back to the start of the cluster, whose first entry is in its
+  // canonical slot, then skip the runs of the quotients in between.
+  auto b = quotient;
+  while (b > 0 && (slots_.count(b) & shifted))
+    --b;
+  auto s = b;
+  for (; b < quotient; ++b)
+    if (occupieds_[b])
+      do
+        ++s;
+      while (s < slots_.size() && (slots_.count(s) & continuation));
+  return s;
+}
+
+size_t quotient_filter::read_count(size_t& i) const {
+  // The digits hold the count minus one, least significant first.
+  size_t count = 0;
+  size_t shift = 0;
+  for (++i; i < slots_.size(); ++i) {
+    auto x = slots_.count(i);
+    if (!(x & digit))
+      break;
+    if (shift < 64)
+      count |= (x >> flag_bits) << shift;
+    shift += remainder_bits_;
+  }
+  return count + 1;
+}
+
+void quotient_filter::write_count(size_t i, size_t count) {
+  auto mask = (uint64_t(1) << remainder_bits_) - 1;
+  for (auto x = count - 1; x != 0; x >>= remainder_bits_)
+    slots_.set(++i, ((x & mask) << flag_bits) | continuation | shifted | digit);
+}
+
+bool quotient_filter::insert_slot(size_t i) {
+  auto end = i;
+  while (end < slots_.size() && !empty(end))
+    ++end;
+  if (end == slots_.size())
+    return false;
+  // Whatever moves right leaves its canonical slot behind.
+  for (; end > i; --end)
+    slots_.set(end, slots_.count(end - 1) | shifted);
+  // Keep the slot from looking free until the caller fills it.
+  slots_.set(i, continuation | shifted);
+  return true;
+}
+
+void quotient_filter::remove_slot(size_t i, size_t quotient) {
+  // Entries move left up to the end of the cluster or the next run that
+  // starts in its canonical slot. Each run start that moves belongs to the
+  // next occupied quotient.
+  auto j = i + 1;
+  for (; j < slots_.size(); ++j) {
+    auto x = slots_.count(j);
+    if (!(x & shifted))
+      break;
+    if (!(x & continuation)) {
+      quotient = occupieds_.find_next(quotient);
+      if (j - 1 == quotient)
+        x &= ~shifted;
+    }
+    slots_.set(j - 1, x);
+  }
+  slots_.set(j - 1, 0);
+}
+
+size_t quotient_filter::free_slots(size_t i, size_t limit) const {
+  size_t n = 0;
+  for (; i < slots_.size() && n < limit; ++i)
+    if (empty(i))
+      ++n;
+  return n;
+}
+
+bool quotient_filter::append(uint64_t fingerprint, size_t count,
+                             size_t& pos) {
+  auto quotient = fingerprint >> remainder_bits_;
+  auto remainder = fingerprint & ((uint64_t(1) << remainder_bits_) - 1);
+  auto flags = continuation | shifted;
+  if (!occupieds_[quotient]) {
+    pos = std::max(pos, static_cast<size_t>(quotient));
+    flags = pos != quotient ? shifted : 0;
+  }
+  auto need = 1 + digits(count, remainder_bits_);
+  if (pos + need > slots_.size())
+    return false;
+  slots_.set(pos, (remainder << flag_bits) | flags);
+  write_count(pos, count);
+  occupieds_.set(quotient);
+  pos += need;
+  used_ += need;
+  size_ += count;
+  return true;
+}
+
+bool quotient_filter::next(size_t& pos, size_t& quotient,
+                           uint64_t& fingerprint, size_t& count) const {
+  while (pos < slots_.size() && empty(pos))
+    ++pos;
+  if (pos == slots_.size())
+    return false;
+  auto x = slots_.count(pos);
+  if (!(x & continuation))
+    quotient = quotient == npos ? occupieds_.find_first()
+                                : occupieds_.find_next(quotient);
+  fingerprint = (uint64_t(quotient) << remainder_bits_) | (x >> flag_bits);
+  count = read_count(pos);
+  return true;
+}
+
+void quotient_filter::allocate(size_t quotient_bits, size_t remainder_bits) {
+  auto n = size_t(1) << quotient_bits;
+  slots_ = counter_vector(n + spare_slots(quotient_bits),
+                          remainder_bits + flag_bits);
+  occupieds_ = bitvector(n);
+  quotient_bits_ = quotient_bits;
+  remainder_bits_ = remainder_bits;
+  size_ = 0;
+  used_ = 0;
+}
+
+void quotient_filter::swap(quotient_filter& other) {
+  using std::swap;
+  swap(slots_, other.slots_);
+  swap(occupieds_, other.occupieds_);
+  swap(quotient_bits_, other.quotient_bits_);
+  swap(remainder_bits_, other.remainder_bits_);
+  swap(size_, other.size_);
+  swap(used_, other.used_);
+}
+
+} // namespace bf
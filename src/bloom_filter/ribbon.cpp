@@ -0,0 +1,234 @@
+#include <bf/bloom_filter/ribbon.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+#include <bf/container.hpp>
+#include <bf/parallel.hpp>
+
+namespace bf {
+
+namespace {
+
+/// The number of coefficients per row.
+constexpr size_t width = 128;
+
+/// The number of slots per block of a column.
+constexpr size_t block_slots = 64;
+
+/// Counts the trailing zeros of a nonzero row.
+size_t trailing_zeros(ribbon_filter::row_type x) {
+  auto lo = static_cast<uint64_t>(x);
+  if (lo != 0)
+    return __builtin_ctzll(lo);
+  return 64 + __builtin_ctzll(static_cast<uint64_t>(x >> 64));
+}
+
+/// Computes the parity of a row.
+uint64_t parity(ribbon_filter::row_type x) {
+  return __builtin_parityll(static_cast<uint64_t>(x)
+                            ^ static_cast<uint64_t>(x >> 64));
+}
+
+} // namespace <anonymous>
+
+ribbon_filter::ribbon_filter(std::shared_ptr<base_hasher> h,
+                             size_t result_bits)
+    : hasher_(std::move(h)), result_bits_(result_bits) {
+  assert(result_bits > 0 && result_bits <= 32);
+  assert(hasher_->k() > 0);
+}
+
+ribbon_filter::ribbon_filter(std::shared_ptr<base_hasher> h,
+                             span<object const> keys, size_t result_bits)
+    : ribbon_filter(std::move(h), result_bits) {
+  build(keys);
+}
+
+void ribbon_filter::add(object const&) {
+  throw std::logic_error("Ribbon filters are static; use build()");
+}
+
+size_t ribbon_filter::lookup(object const& o) const {
+  if (size_ == 0)
+    return 0;
+  return satisfies(hash(o)) ? 1 : 0;
+}
+
+void ribbon_filter::lookup_many(span<object const> objects,
+                                span<size_t> counts) const {
+  assert(counts.size() >= objects.size());
+  if (size_ == 0) {
+    std::fill_n(counts.data(), objects.size(), size_t(0));
+    return;
+  }
+  // The three blocks of a row span this many bits of the columns.
+  auto bits = 3 * result_bits_ * block_slots;
+  uint64_t hashes[batch_size];
+  for (size_t first = 0; first < objects.size(); first += batch_size) {
+    auto n = std::min(objects.size() - first, size_t(batch_size));
+    for (size_t i = 0; i < n; ++i) {
+      hashes[i] = hash(objects[first + i]);
+      auto base = start(hashes[i]) / block_slots * result_bits_ * block_slots;
+      for (size_t j = 0; j < bits; j += 512)
+        columns_.prefetch(base + j);
+      columns_.prefetch(base + bits - 1);
+    }
+    for (size_t i = 0; i < n; ++i)
+      counts[first + i] = satisfies(hashes[i]) ? 1 : 0;
+  }
+}
+
+void ribbon_filter::clear() {
+  layout(0);
+  size_ = 0;
+}
+
+void ribbon_filter::build(span<object const> keys) {
+  std::vector<uint64_t> hashes(keys.size());
+  digest_buffer d;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    (*hasher_)(keys[i], d);
+    hashes[i] = mix(d[0]);
+  }
+  // Sorted hashes insert their rows in the order of their starts, so that
+  // the elimination moves through the slots sequentially.
+  sort_hashes(hashes, 1);
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+  layout(hashes.size());
+  size_ = hashes.size();
+  if (size_ == 0)
+    return;
+  // The system in echelon form: the row whose first coefficient lies at a
+  // slot, or 0 if there is none.
+  std::vector<row_type> rows(slots_);
+  for (auto h : hashes) {
+    auto i = start(h);
+    auto c = coefficients(h);
+    for (;;) {
+      if (rows[i] == 0) {
+        rows[i] = c;
+        break;
+      }
+      // Eliminate the first coefficient. A row that vanishes depends on
+      // the others, and every solution satisfies it already.
+      c ^= rows[i];
+      if (c == 0)
+        break;
+      auto shift = trailing_zeros(c);
+      i += shift;
+      c >>= shift;
+    }
+  }
+  // Back substitution from the last slot. Bit *k* of the state of a column
+  // holds the solution at slot `i + k`. Slots without a row are free and
+  // take random values.
+  row_type state[32] = {};
+  auto blocks = columns_.data();
+  for (auto i = slots_; i-- > 0;) {
+    auto row = rows[i];
+    auto noise = mix(i + 0x9e3779b97f4a7c15ULL);
+    auto block = blocks + i / block_slots * result_bits_;
+    for (size_t j = 0; j < result_bits_; ++j) {
+      state[j] <<= 1;
+      uint64_t bit = row != 0 ? parity(state[j] & row) : (noise >> j) & 1;
+      state[j] |= bit;
+      block[j] |= bit << (i % block_slots);
+    }
+  }
+}
+
+size_t ribbon_filter::size() const {
+  return size_;
+}
+
+size_t ribbon_filter::slots() const {
+  return slots_;
+}
+
+size_t ribbon_filter::result_bits() const {
+  return result_bits_;
+}
+
+void ribbon_filter::write(container_writer& w) const {
+  w.parameters(filter_type::ribbon, {result_bits_, slots_, size_});
+  w.hasher(*hasher_);
+  columns_.write(w);
+}
+
+int ribbon_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::ribbon, params) != 0 || params.size() != 3
+      || params[0] == 0 || params[0] > 32 || params[1] % block_slots != 0
+      || (params[1] == 0) != (params[2] == 0))
+    return 1;
+  std::shared_ptr<base_hasher> h;
+  if (r.hasher(h) != 0 || h->k() == 0)
+    return 2;
+  bitvector columns;
+  if (columns.read(r) != 0)
+    return 3;
+  auto blocks = params[1] == 0 ? 0 : params[1] / block_slots + 2;
+  if (columns.size() != blocks * params[0] * block_slots)
+    return 4;
+  hasher_ = std::move(h);
+  swap(columns_, columns);
+  result_bits_ = params[0];
+  slots_ = params[1];
+  size_ = params[2];
+  return 0;
+}
+
+void ribbon_filter::layout(size_t keys) {
+  slots_ = 0;
+  if (keys > 0) {
+    // The starts range over all slots but the last width - 1.
+    auto n = static_cast<size_t>(std::ceil(keys * (1 + overhead)));
+    slots_ = (n + width - 1 + block_slots - 1) / block_slots * block_slots;
+  }
+  // Two spare blocks after the last let lookups read three blocks for any
+  // start.
+  auto blocks = slots_ == 0 ? 0 : slots_ / block_slots + 2;
+  columns_ = bitvector(blocks * result_bits_ * block_slots);
+}
+
+uint64_t ribbon_filter::hash(object const& o) const {
+  digest_buffer d;
+  (*hasher_)(o, d);
+  return mix(d[0]);
+}
+
+size_t ribbon_filter::start(uint64_t hash) const {
+  return map_index(hash, slots_ - width + 1, index_mapping::fast_range);
+}
+
+ribbon_filter::row_type ribbon_filter::coefficients(uint64_t hash) const {
+  // The first coefficient is always 1, so that a row occupies its start.
+  auto lo = mix(hash ^ 0x9e3779b97f4a7c15ULL) | 1;
+  auto hi = mix(hash ^ 0xc2b2ae3d27d4eb4fULL);
+  return (row_type(hi) << 64) | lo;
+}
+
+bool ribbon_filter::satisfies(uint64_t hash) const {
+  auto s = start(hash);
+  auto c = coefficients(hash);
+  auto lo = static_cast<uint64_t>(c);
+  auto hi = static_cast<uint64_t>(c >> 64);
+  auto r = result_bits_;
+  auto block = columns_.data() + s / block_slots * r;
+  auto shift = s % block_slots;
+  // Each column of the product is 1 with probability 1/2 for other
+  // elements, which thus rarely need more than a few columns.
+  for (size_t j = 0; j < r; ++j) {
+    // The second shift avoids an undefined shift by 64 if shift is 0.
+    auto x = (block[j] >> shift) | (block[r + j] << 1 << (63 - shift));
+    auto y = (block[r + j] >> shift) | (block[2 * r + j] << 1 << (63 - shift));
+    if (__builtin_parityll((x & lo) ^ (y & hi)))
+      return false;
+  }
+  return true;
+}
+
+} // namespace bf
@@ -0,0 +1,178 @@
+#include <bf/bloom_filter/scalable.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <string.h>
+
+#include <bf/container.hpp>
+
+namespace bf {
+
+namespace {
+
+uint64_t to_bits(double x) {
+  uint64_t result;
+  memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+double from_bits(uint64_t x) {
+  double result;
+  memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+} // namespace <anonymous>
+
+scalable_bloom_filter::scalable_bloom_filter(double fp, size_t capacity,
+                                             double growth, double tightening,
+                                             uint64_t seed)
+    : fp_(fp),
+      capacity_(capacity),
+      growth_(growth),
+      tightening_(tightening),
+      seed_(seed) {
+  assert(fp > 0 && fp < 1);
+  assert(capacity > 0);
+  assert(growth >= 1);
+  assert(tightening > 0 && tightening < 1);
+  grow();
+}
+
+void scalable_bloom_filter::add(object const& o) {
+  // Elements that a stage already contains would only fill the newest one.
+  digest_buffer digests, indices;
+  (*stages_.back().hasher_)(o, digests);
+  if (find(digests, indices))
+    return;
+  auto& stage = stages_.back();
+  stage_indices(stage, digests, indices);
+  for (auto i : indices)
+    if (!stage.bits_[i]) {
+      stage.bits_.set(i);
+      ++ones_;
+    }
+  auto capacity = capacity_ * std::pow(growth_, stages_.size() - 1);
+  if (++elements_.back() >= capacity || 2 * ones_ >= stage.bits_.size())
+    grow();
+}
+
+size_t scalable_bloom_filter::lookup(object const& o) const {
+  digest_buffer digests, indices;
+  (*stages_.back().hasher_)(o, digests);
+  return find(digests, indices) ? 1 : 0;
+}
+
+void scalable_bloom_filter::clear() {
+  stages_.clear();
+  elements_.clear();
+  grow();
+}
+
+size_t scalable_bloom_filter::stages() const {
+  return stages_.size();
+}
+
+basic_bloom_filter const& scalable_bloom_filter::stage(size_t i) const {
+  assert(i < stages_.size());
+  return stages_[i];
+}
+
+size_t scalable_bloom_filter::elements() const {
+  size_t result = 0;
+  for (auto n : elements_)
+    result += n;
+  return result;
+}
+
+double scalable_bloom_filter::fpr_bound() const {
+  auto none = 1.0;
+  for (size_t i = 0; i < stages_.size(); ++i)
+    none *= 1 - stage_fp(i);
+  return 1 - none;
+}
+
+void scalable_bloom_filter::write(container_writer& w) const {
+  std::vector<uint64_t> params = {to_bits(fp_), capacity_, to_bits(growth_),
+                                  to_bits(tightening_), seed_};
+  params.insert(params.end(), elements_.begin(), elements_.end());
+  w.parameters(filter_type::scalable, params);
+  for (auto& stage : stages_)
+    stage.write(w);
+}
+
+int scalable_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::scalable, params) != 0 || params.size() < 6)
+    return 1;
+  std::vector<basic_bloom_filter> stages(params.size() - 5);
+  size_t k = 0;
+  for (auto& stage : stages) {
+    // Lookups rely on stages with ever more hash functions, all of them
+    // prefixes of the digests of the same enhanced double hasher.
+    if (stage.read(r) != 0 || !stage.partition_ || stage.bits_.empty()
+        || stage.hasher_->k() < k)
+      return 2;
+    k = stage.hasher_->k();
+    auto expected = std::make_shared<enhanced_double_hasher>(k, params[4]);
+    if (!same_hasher(stage.hasher_, expected))
+      return 2;
+  }
+  fp_ = from_bits(params[0]);
+  capacity_ = params[1];
+  growth_ = from_bits(params[2]);
+  tightening_ = from_bits(params[3]);
+  seed_ = params[4];
+  stages_ = std::move(stages);
+  elements_.assign(params.begin() + 5, params.end());
+  ones_ = stages_.back().bits_.count();
+  return 0;
+}
+
+void scalable_bloom_filter::grow() {
+  // A partitioned filter with k = log2(1/p) slices of n ln(1/p) / (k ln^2 2)
+  // bits each reaches p once half of its bits are set.
+  auto i = stages_.size();
+  auto fp = stage_fp(i);
+  auto capacity = capacity_ * std::pow(growth_, i);
+  auto k = static_cast<size_t>(std::ceil(-std::log2(fp)));
+  auto ln2 = std::log(2);
+  auto slice = static_cast<size_t>(
+    std::ceil(capacity * -std::log(fp) / (ln2 * ln2) / k));
+  stages_.emplace_back(std::make_shared<enhanced_double_hasher>(k, seed_),
+                       slice * k, true, index_mapping::fast_range);
+  elements_.push_back(0);
+  ones_ = 0;
+}
+
+bool scalable_bloom_filter::find(digest_buffer const& digests,
+                                 digest_buffer& indices) const {
+  for (auto s = stages_.rbegin(); s != stages_.rend(); ++s) {
+    stage_indices(*s, digests, indices);
+    auto found = true;
+    for (auto i : indices)
+      if (!s->bits_[i]) {
+        found = false;
+        break;
+      }
+    if (found)
+      return true;
+  }
+  return false;
+}
+
+void scalable_bloom_filter::stage_indices(basic_bloom_filter const& stage,
+                                          digest_buffer const& digests,
+                                          digest_buffer& indices) {
+  // The hash functions of a stage are a prefix of those of the newest one.
+  indices.resize(stage.hasher_->k());
+  for (size_t i = 0; i < indices.size(); ++i)
+    indices[i] = digests[i];
+  stage.map_indices(indices);
+}
+
+double scalable_bloom_filter::stage_fp(size_t i) const {
+  return fp_ * (1 - tightening_) * std::pow(tightening_, i);
+}
+
+} // namespace bf
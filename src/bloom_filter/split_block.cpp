@@ -0,0 +1,222 @@
+#include <bf/bloom_filter/split_block.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string.h>
+
+#include <bf/bloom_filter/basic.hpp>
+#include <bf/container.hpp>
+#include <bf/cpu.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BF_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bf {
+
+namespace {
+
+// The odd constants from which the bit positions within a block derive.
+uint32_t const salt[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                          0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+void insert_scalar(uint32_t* block, uint32_t h) {
+  for (size_t i = 0; i < 8; ++i)
+    block[i] |= uint32_t(1) << ((h * salt[i]) >> 27);
+}
+
+bool check_scalar(uint32_t const* block, uint32_t h) {
+  for (size_t i = 0; i < 8; ++i)
+    if (!(block[i] & (uint32_t(1) << ((h * salt[i]) >> 27))))
+      return false;
+  return true;
+}
+
+#ifdef BF_X86
+
+__attribute__((target("avx2"))) __m256i make_mask(uint32_t h) {
+  auto salts = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(salt));
+  auto x = _mm256_mullo_epi32(_mm256_set1_epi32(h), salts);
+  x = _mm256_srli_epi32(x, 27);
+  return _mm256_sllv_epi32(_mm256_set1_epi32(1), x);
+}
+
+__attribute__((target("avx2"))) void insert_avx2(uint32_t* block,
+                                                 uint32_t h) {
+  auto p = reinterpret_cast<__m256i*>(block);
+  _mm256_store_si256(p, _mm256_or_si256(_mm256_load_si256(p), make_mask(h)));
+}
+
+__attribute__((target("avx2"))) bool check_avx2(uint32_t const* block,
+                                                uint32_t h) {
+  auto p = reinterpret_cast<__m256i const*>(block);
+  return _mm256_testc_si256(_mm256_load_si256(p), make_mask(h));
+}
+
+#endif // BF_X86
+
+} // namespace <anonymous>
+
+constexpr size_t split_block_bloom_filter::block_bits;
+
+double split_block_bloom_filter::fp(size_t cells, size_t capacity) {
+  auto blocks = std::max<size_t>(cells / block_bits, 1);
+  auto lambda = static_cast<double>(capacity) / blocks;
+  if (lambda == 0)
+    return 0;
+  // Each of the eight words is a one-hash Bloom filter of 32 bits. Sum over
+  // the Poisson-distributed number of elements per block.
+  auto log_lambda = std::log(lambda);
+  auto last = static_cast<size_t>(lambda + 10 * std::sqrt(lambda) + 10);
+  auto empty = std::log1p(-1.0 / 32);
+  double result = 0;
+  for (size_t i = 0; i <= last; ++i) {
+    auto p = std::exp(i * log_lambda - lambda - std::lgamma(i + 1.0));
+    result += p * std::pow(1 - std::exp(empty * i), words_per_block);
+  }
+  return result;
+}
+
+size_t split_block_bloom_filter::m(double fp, size_t capacity) {
+  auto round_up = [](size_t cells) {
+    return (cells + block_bits - 1) / block_bits * block_bits;
+  };
+  auto cells = round_up(std::max<size_t>(basic_bloom_filter::m(fp, capacity),
+                                         block_bits));
+  for (int i = 0; i < 1000; ++i) {
+    if (split_block_bloom_filter::fp(cells, capacity) <= fp)
+      break;
+    cells = round_up(cells + cells / 64);
+  }
+  return cells;
+}
+
+split_block_bloom_filter::split_block_bloom_filter(
+  std::shared_ptr<base_hasher> h, size_t cells)
+    : hasher_(std::move(h)),
+      words_((cells + block_bits - 1) / block_bits * words_per_block) {
+  assert(cells > 0);
+  assert(words_.size() / words_per_block <= 0xffffffffULL);
+}
+
+split_block_bloom_filter::split_block_bloom_filter(double fp, size_t capacity,
+                                                   size_t seed)
+    : split_block_bloom_filter(make_hasher(1, seed), m(fp, capacity)) {
+}
+
+void split_block_bloom_filter::add(object const& o) {
+  auto h = hash(o);
+#ifdef BF_X86
+  if (cpu.avx2)
+    return insert_avx2(block(h), static_cast<uint32_t>(h));
+#endif
+  insert_scalar(block(h), static_cast<uint32_t>(h));
+}
+
+size_t split_block_bloom_filter::lookup(object const& o) const {
+  auto h = hash(o);
+#ifdef BF_X86
+  if (cpu.avx2)
+    return check_avx2(block(h), static_cast<uint32_t>(h));
+#endif
+  return check_scalar(block(h), static_cast<uint32_t>(h));
+}
+
+void split_block_bloom_filter::clear() {
+  std::fill(words_.begin(), words_.end(), 0);
+}
+
+size_t split_block_bloom_filter::size() const {
+  return words_.size() * 32;
+}
+
+std::shared_ptr<base_hasher> const&
+split_block_bloom_filter::hasher_function() const {
+  return hasher_;
+}
+
+digest split_block_bloom_filter::hash(object const& o) const {
+  digest_buffer digests;
+  (*hasher_)(o, digests);
+  // The block index comes from the high-order and the bit positions from the
+  // low-order 32 bits, so make both halves depend on the entire digest.
+  uint64_t h = digests[0];
+  h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+  h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 33);
+}
+
+uint32_t* split_block_bloom_filter::block(digest h) {
+  auto blocks = words_.size() / words_per_block;
+  return &words_[((h >> 32) * blocks >> 32) * words_per_block];
+}
+
+uint32_t const* split_block_bloom_filter::block(digest h) const {
+  auto blocks = words_.size() / words_per_block;
+  return &words_[((h >> 32) * blocks >> 32) * words_per_block];
+}
+
+char* split_block_bloom_filter::serialize(char* buf) {
+  auto hasher_sz = hasher_->serializedSize();
+  *reinterpret_cast<uint32_t*>(buf) = htobe32(hasher_sz);
+  buf += sizeof(hasher_sz);
+  buf = hasher_->serialize(buf);
+  uint64_t words = words_.size();
+  *reinterpret_cast<uint64_t*>(buf) = htobe64(words);
+  buf += sizeof(words);
+  auto sz = words_.size() * sizeof(uint32_t);
+  memmove(buf, words_.data(), sz);
+  return buf + sz;
+}
+
+unsigned int split_block_bloom_filter::serializedSize() const {
+  return sizeof(unsigned int) + hasher_->serializedSize() + sizeof(uint64_t)
+         + words_.size() * sizeof(uint32_t);
+}
+
+int split_block_bloom_filter::fromBuf(const char* buf, unsigned int len) {
+  auto buf_start = buf;
+  auto hasher_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
+  buf += sizeof(unsigned int);
+  hasher_ = hasher_factory::createHasher(buf);
+  if (!hasher_)
+    return 1;
+  if (hasher_->fromBuf(buf, hasher_sz) != 0)
+    return 2;
+  buf += hasher_sz;
+  auto words = be64toh(*reinterpret_cast<const uint64_t*>(buf));
+  buf += sizeof(uint64_t);
+  if (words == 0 || words % words_per_block != 0)
+    return 3;
+  if (static_cast<size_t>(buf - buf_start) + words * sizeof(uint32_t) != len)
+    return 4;
+  words_.assign(reinterpret_cast<const uint32_t*>(buf),
+                reinterpret_cast<const uint32_t*>(buf) + words);
+  return 0;
+}
+
+
+void split_block_bloom_filter::write(container_writer& w) const {
+  w.parameters(filter_type::split_block, {});
+  w.hasher(*hasher_);
+  w.blocks(words_.data(), words_.size() * sizeof(uint32_t), words_.size());
+}
+
+int split_block_bloom_filter::read(container_reader& r) {
+  std::vector<uint64_t> params;
+  if (r.parameters(filter_type::split_block, params) != 0)
+    return 1;
+  if (r.hasher(hasher_) != 0)
+    return 2;
+  uint64_t size, words;
+  if (r.blocks(size, words) != 0 || size != words * sizeof(uint32_t))
+    return 3;
+  if (words == 0 || words % words_per_block != 0)
+    return 4;
+  words_.resize(words);
+  return r.copy(words_.data()) != 0 ? 5 : 0;
+}
+
+} // namespace bf
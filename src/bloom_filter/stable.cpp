@@ -1,5 +1,6 @@
 #include <bf/bloom_filter/stable.hpp>
 
+#include <algorithm>
 #include <cassert>
 
 namespace bf {
@@ -14,25 +15,42 @@ stable_bloom_filter::stable_bloom_filter(std::shared_ptr<base_hasher> h, size_t
 
 void stable_bloom_filter::add(object const& o) {
   // Decrement d distinct cells uniformly at random.
-  std::vector<size_t> indices;
+  digest_buffer indices(d_);
   for (size_t d = 0; d < d_; ++d) {
     bool unique;
     do {
       size_t u = unif_(generator_);
-      unique = true;
-      for (auto i : indices)
-        if (i == u) {
-          unique = false;
-          break;
-        }
+      unique = std::find(indices.begin(), indices.begin() + d, u)
+               == indices.begin() + d;
       if (unique) {
-        indices.push_back(u);
+        indices[d] = u;
         cells_.decrement(u);
       }
     } while (!unique);
   }
 
-  increment(find_indices(o), cells_.max());
+  find_indices(o, indices);
+  increment(indices, cells_.max());
+}
+
+void stable_bloom_filter::add_many(span<object const> objects) {
+  bloom_filter::add_many(objects);
+}
+
+
+void stable_bloom_filter::write(container_writer& w) const {
+  write_cells(w, filter_type::stable, d_);
+}
+
+int stable_bloom_filter::read(container_reader& r) {
+  uint64_t d;
+  if (auto status = read_cells(r, filter_type::stable, d))
+    return status;
+  if (d > cells_.size())
+    return 4;
+  d_ = d;
+  unif_ = std::uniform_int_distribution<>(0, cells_.size() - 1);
+  return 0;
 }
 
 } // namespace bf
@@ -0,0 +1,528 @@
+#include <bf/container.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <istream>
+#include <ostream>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <bf/all.hpp>
+#include <bf/cpu.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BF_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bf {
+
+namespace {
+
+constexpr char magic[8] = {'L', 'I', 'B', 'B', 'F', '\r', '\n', '\x1a'};
+constexpr uint32_t version = 1;
+constexpr uint32_t byte_order = 0x01020304;
+constexpr uint64_t header_size = 64;
+constexpr uint64_t entry_size = 32;
+constexpr uint64_t alignment = 64;
+
+uint64_t align(uint64_t n) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+void put(char* p, T x) {
+  memcpy(p, &x, sizeof(x));
+}
+
+template <typename T>
+T get(char const* p) {
+  T x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+struct crc_table
+{
+  crc_table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      auto c = i;
+      for (int j = 0; j < 8; ++j)
+        c = (c >> 1) ^ (c & 1 ? 0x82f63b78 : 0);
+      entries[i] = c;
+    }
+  }
+
+  uint32_t entries[256];
+};
+
+uint32_t crc32c_portable(unsigned char const* p, uint64_t size, uint32_t crc) {
+  static crc_table const table;
+  for (uint64_t i = 0; i < size; ++i)
+    crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef BF_X86
+
+__attribute__((target("sse4.2"))) uint32_t
+crc32c_sse42(unsigned char const* p, uint64_t size, uint32_t crc) {
+  for (; size > 0 && reinterpret_cast<uintptr_t>(p) % 8 != 0; --size)
+    crc = _mm_crc32_u8(crc, *p++);
+#ifdef __x86_64__
+  uint64_t c = crc;
+  for (; size >= 8; size -= 8, p += 8)
+    c = _mm_crc32_u64(c, get<uint64_t>(reinterpret_cast<char const*>(p)));
+  crc = static_cast<uint32_t>(c);
+#endif
+  for (; size >= 4; size -= 4, p += 4)
+    crc = _mm_crc32_u32(crc, get<uint32_t>(reinterpret_cast<char const*>(p)));
+  for (; size > 0; --size)
+    crc = _mm_crc32_u8(crc, *p++);
+  return crc;
+}
+
+#endif // BF_X86
+
+} // namespace <anonymous>
+
+uint32_t crc32c(void const* data, uint64_t size, uint32_t crc) {
+  auto p = static_cast<unsigned char const*>(data);
+  crc = ~crc;
+#ifdef BF_X86
+  if (cpu.sse42)
+    return ~crc32c_sse42(p, size, crc);
+#endif
+  return ~crc32c_portable(p, size, crc);
+}
+
+void container_writer::parameters(filter_type type,
+                                  std::initializer_list<uint64_t> values) {
+  parameters(type, std::vector<uint64_t>(values));
+}
+
+void container_writer::parameters(filter_type type,
+                                  std::vector<uint64_t> const& values) {
+  if (sections_.empty())
+    type_ = type;
+  std::string bytes(values.size() * sizeof(uint64_t), '\0');
+  if (!values.empty())
+    memcpy(&bytes[0], values.data(), bytes.size());
+  add(section_kind::parameters, std::move(bytes),
+      static_cast<uint64_t>(type));
+}
+
+void container_writer::hasher(base_hasher& h) {
+  std::string bytes(h.serializedSize(), '\0');
+  if (!bytes.empty())
+    h.serialize(&bytes[0]);
+  add(section_kind::hasher, std::move(bytes), 0);
+}
+
+void container_writer::blocks(void const* data, uint64_t size,
+                              uint64_t count) {
+  sections_.push_back(
+    {section_kind::blocks, static_cast<char const*>(data), size, count});
+}
+
+void container_writer::add(section_kind kind, std::string bytes,
+                           uint64_t count) {
+  owned_.emplace_back(new std::string(std::move(bytes)));
+  auto& s = *owned_.back();
+  sections_.push_back({kind, s.data(), s.size(), count});
+}
+
+uint64_t container_writer::size() const {
+  auto n = align(header_size + sections_.size() * entry_size);
+  for (auto& s : sections_)
+    n = align(n + s.size);
+  return n;
+}
+
+std::string container_writer::header() const {
+  auto table = header_size + sections_.size() * entry_size;
+  std::string h(align(table), '\0');
+  auto p = &h[0];
+  memcpy(p, magic, sizeof(magic));
+  put<uint32_t>(p + 8, version);
+  put<uint32_t>(p + 12, byte_order);
+  put<uint32_t>(p + 16, static_cast<uint32_t>(type_));
+  put<uint64_t>(p + 24, sections_.size());
+  put<uint64_t>(p + 32, size());
+  auto offset = align(table);
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    auto& s = sections_[i];
+    auto e = p + header_size + i * entry_size;
+    put<uint32_t>(e, static_cast<uint32_t>(s.kind));
+    put<uint32_t>(e + 4, crc32c(s.data, s.size));
+    put<uint64_t>(e + 8, offset);
+    put<uint64_t>(e + 16, s.size);
+    put<uint64_t>(e + 24, s.count);
+    offset = align(offset + s.size);
+  }
+  put<uint32_t>(p + 20, crc32c(p, table));
+  return h;
+}
+
+char* container_writer::write(char* buf) const {
+  auto h = header();
+  memcpy(buf, h.data(), h.size());
+  auto p = buf + h.size();
+  for (auto& s : sections_) {
+    if (s.size > 0)
+      memcpy(p, s.data, s.size);
+    auto padding = align(s.size) - s.size;
+    memset(p + s.size, 0, padding);
+    p += s.size + padding;
+  }
+  return p;
+}
+
+bool container_writer::write(std::ostream& out) const {
+  static char const zeros[alignment] = {};
+  auto h = header();
+  out.write(h.data(), h.size());
+  for (auto& s : sections_) {
+    out.write(s.data, s.size);
+    out.write(zeros, align(s.size) - s.size);
+  }
+  return static_cast<bool>(out);
+}
+
+bool container_writer::write(int fd) const {
+  static char const zeros[alignment] = {};
+  auto h = header();
+  std::vector<iovec> iov;
+  iov.push_back({const_cast<char*>(h.data()), h.size()});
+  for (auto& s : sections_) {
+    if (s.size > 0)
+      iov.push_back({const_cast<char*>(s.data), s.size});
+    if (align(s.size) != s.size)
+      iov.push_back({const_cast<char*>(zeros), align(s.size) - s.size});
+  }
+  // A single call writes at most IOV_MAX buffers and may write only a part
+  // of them, e.g., at most 2 GiB on Linux.
+  auto i = iov.data();
+  auto end = i + iov.size();
+  while (i != end) {
+    auto n = std::min<size_t>(end - i, IOV_MAX);
+    auto written = ::writev(fd, i, n);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    for (auto w = static_cast<size_t>(written); w > 0;) {
+      if (w < i->iov_len) {
+        i->iov_base = static_cast<char*>(i->iov_base) + w;
+        i->iov_len -= w;
+        break;
+      }
+      w -= i->iov_len;
+      ++i;
+    }
+    while (i != end && i->iov_len == 0)
+      ++i;
+  }
+  return true;
+}
+
+int container_reader::check(char const* h, uint64_t len) {
+  auto table = header_size + sections_ * entry_size;
+  auto crc = crc32c(h, 20);
+  crc = crc32c("\0\0\0\0", 4, crc);
+  crc = crc32c(h + 24, table - 24, crc);
+  if (crc != get<uint32_t>(h + 20))
+    return bad_header_checksum;
+  // Payloads follow the table in order, so that a stream can read them one
+  // after another.
+  auto end = table;
+  for (uint64_t i = 0; i < sections_; ++i) {
+    auto e = h + header_size + i * entry_size;
+    auto offset = get<uint64_t>(e + 8);
+    auto size = get<uint64_t>(e + 16);
+    if (offset % alignment != 0 || offset < end || offset > len
+        || size > len - offset)
+      return bad_section;
+    end = offset + size;
+  }
+  return 0;
+}
+
+namespace {
+
+int check_prefix(char const* h, uint64_t& sections, uint64_t& len) {
+  if (memcmp(h, magic, sizeof(magic)) != 0)
+    return container_reader::bad_magic;
+  if (get<uint32_t>(h + 8) != version)
+    return container_reader::bad_version;
+  if (get<uint32_t>(h + 12) != byte_order)
+    return container_reader::bad_byte_order;
+  sections = get<uint64_t>(h + 24);
+  len = get<uint64_t>(h + 32);
+  if (len < header_size || sections > (len - header_size) / entry_size)
+    return container_reader::bad_section;
+  return 0;
+}
+
+} // namespace <anonymous>
+
+int container_reader::open(char const* buf, uint64_t len,
+                           std::shared_ptr<void const> owner, bool verify) {
+  if (len < header_size)
+    return truncated;
+  uint64_t size;
+  if (auto status = check_prefix(buf, sections_, size))
+    return status;
+  if (size != len)
+    return truncated;
+  if (auto status = check(buf, len))
+    return status;
+  if (verify)
+    for (uint64_t i = 0; i < sections_; ++i) {
+      auto e = buf + header_size + i * entry_size;
+      auto payload = buf + get<uint64_t>(e + 8);
+      if (crc32c(payload, get<uint64_t>(e + 16)) != get<uint32_t>(e + 4))
+        return bad_section_checksum;
+    }
+  buf_ = buf;
+  in_ = nullptr;
+  entries_ = buf + header_size;
+  next_ = 0;
+  type_ = static_cast<filter_type>(get<uint32_t>(buf + 16));
+  owner_ = std::move(owner);
+  return 0;
+}
+
+int container_reader::open(std::istream& in) {
+  char h[header_size];
+  if (!in.read(h, header_size))
+    return truncated;
+  uint64_t len;
+  if (auto status = check_prefix(h, sections_, len))
+    return status;
+  auto table = header_size + sections_ * entry_size;
+  table_.assign(h, header_size);
+  table_.resize(table);
+  if (!in.read(&table_[header_size], table - header_size))
+    return truncated;
+  if (auto status = check(table_.data(), len))
+    return status;
+  buf_ = nullptr;
+  in_ = &in;
+  pos_ = table;
+  entries_ = table_.data() + header_size;
+  next_ = 0;
+  type_ = static_cast<filter_type>(get<uint32_t>(h + 16));
+  owner_.reset();
+  return 0;
+}
+
+char const* container_reader::next(section_kind kind, uint64_t& size,
+                                   uint64_t& count) {
+  if (next_ == sections_)
+    return nullptr;
+  auto e = entries_ + next_ * entry_size;
+  if (get<uint32_t>(e) != static_cast<uint32_t>(kind))
+    return nullptr;
+  ++next_;
+  size = get<uint64_t>(e + 16);
+  count = get<uint64_t>(e + 24);
+  return e;
+}
+
+int container_reader::read(char* dst, char const* entry) {
+  auto offset = get<uint64_t>(entry + 8);
+  auto size = get<uint64_t>(entry + 16);
+  assert(offset >= pos_);
+  if (!in_->ignore(offset - pos_) || !in_->read(dst, size))
+    return read_error;
+  pos_ = offset + size;
+  if (crc32c(dst, size) != get<uint32_t>(entry + 4))
+    return bad_section_checksum;
+  return 0;
+}
+
+char const* container_reader::payload(char const* entry) {
+  if (buf_)
+    return buf_ + get<uint64_t>(entry + 8);
+  small_.resize(get<uint64_t>(entry + 16));
+  return read(&small_[0], entry) == 0 ? small_.data() : nullptr;
+}
+
+int container_reader::parameters(filter_type type,
+                                 std::vector<uint64_t>& values) {
+  uint64_t size, count;
+  auto e = next(section_kind::parameters, size, count);
+  if (!e || count != static_cast<uint64_t>(type)
+      || size % sizeof(uint64_t) != 0)
+    return 1;
+  auto p = payload(e);
+  if (!p)
+    return 1;
+  values.resize(size / sizeof(uint64_t));
+  if (size > 0)
+    memcpy(values.data(), p, size);
+  return 0;
+}
+
+int container_reader::hasher(std::shared_ptr<base_hasher>& h) {
+  uint64_t size, count;
+  auto e = next(section_kind::hasher, size, count);
+  if (!e || size < sizeof(uint32_t))
+    return 1;
+  auto p = payload(e);
+  if (!p)
+    return 1;
+  // The factory reads only the type tag; fromBuf checks the rest of the
+  // section against the serialized size of the hasher before reading it.
+  h = hasher_factory::createHasher(p);
+  if (!h || h->fromBuf(p, size) != 0)
+    return 1;
+  return 0;
+}
+
+int container_reader::blocks(uint64_t& size, uint64_t& count) {
+  current_ = next(section_kind::blocks, size, count);
+  if (!current_)
+    return 1;
+  data_ = buf_ ? buf_ + get<uint64_t>(current_ + 8) : nullptr;
+  return 0;
+}
+
+int container_reader::copy(void* dst) {
+  if (!current_)
+    return 1;
+  auto size = get<uint64_t>(current_ + 16);
+  if (data_) {
+    if (size > 0)
+      memcpy(dst, data_, size);
+    return 0;
+  }
+  return read(static_cast<char*>(dst), current_);
+}
+
+std::vector<char> save(bloom_filter const& bf) {
+  container_writer w;
+  bf.write(w);
+  std::vector<char> buf(w.size());
+  w.write(buf.data());
+  return buf;
+}
+
+namespace {
+
+std::unique_ptr<bloom_filter> make_filter(filter_type type) {
+  switch (type) {
+    case filter_type::basic:
+      return std::unique_ptr<bloom_filter>(new basic_bloom_filter);
+    case filter_type::counting:
+      return std::unique_ptr<bloom_filter>(new counting_bloom_filter);
+    case filter_type::spectral_mi:
+      return std::unique_ptr<bloom_filter>(new spectral_mi_bloom_filter);
+    case filter_type::spectral_rm:
+      return std::unique_ptr<bloom_filter>(new spectral_rm_bloom_filter);
+    case filter_type::stable:
+      return std::unique_ptr<bloom_filter>(new stable_bloom_filter);
+    case filter_type::blocked:
+      return std::unique_ptr<bloom_filter>(new blocked_bloom_filter);
+    case filter_type::split_block:
+      return std::unique_ptr<bloom_filter>(new split_block_bloom_filter);
+    case filter_type::a2:
+      return std::unique_ptr<bloom_filter>(new a2_bloom_filter);
+    case filter_type::bitwise:
+      return std::unique_ptr<bloom_filter>(new bitwise_bloom_filter);
+    case filter_type::scalable:
+      return std::unique_ptr<bloom_filter>(new scalable_bloom_filter);
+    case filter_type::cuckoo:
+      return std::unique_ptr<bloom_filter>(new cuckoo_filter);
+    case filter_type::quotient:
+      return std::unique_ptr<bloom_filter>(new quotient_filter);
+    case filter_type::binary_fuse:
+      return std::unique_ptr<bloom_filter>(new binary_fuse_filter);
+    case filter_type::ribbon:
+      return std::unique_ptr<bloom_filter>(new ribbon_filter);
+    case filter_type::count_min:
+      return std::unique_ptr<bloom_filter>(new count_min_sketch);
+    case filter_type::sharded:
+      // The container does not record the type of the inner filters, so
+      // only a sharded_bloom_filter of the right type can read it.
+      break;
+  }
+  return nullptr;
+}
+
+} // namespace <anonymous>
+
+namespace {
+
+int load(container_reader& r, std::unique_ptr<bloom_filter>& bf) {
+  auto result = make_filter(r.type());
+  if (!result || result->read(r) != 0 || !r.done())
+    return 1;
+  bf = std::move(result);
+  return 0;
+}
+
+} // namespace <anonymous>
+
+int load(char const* buf, uint64_t len, std::unique_ptr<bloom_filter>& bf,
+         std::shared_ptr<void const> owner, bool verify) {
+  container_reader r;
+  if (auto status = r.open(buf, len, std::move(owner), verify))
+    return status;
+  return load(r, bf);
+}
+
+int load(std::istream& in, std::unique_ptr<bloom_filter>& bf) {
+  container_reader r;
+  if (auto status = r.open(in))
+    return status;
+  return load(r, bf);
+}
+
+char* bloom_filter::serialize(char* buf) {
+  container_writer w;
+  write(w);
+  return w.write(buf);
+}
+
+unsigned int bloom_filter::serializedSize() const {
+  container_writer w;
+  write(w);
+  return w.size();
+}
+
+int bloom_filter::fromBuf(const char* buf, unsigned int len) {
+  container_reader r;
+  if (r.open(buf, len) != 0)
+    return 1;
+  if (read(r) != 0 || !r.done())
+    return 2;
+  return 0;
+}
+
+bool bloom_filter::save(std::ostream& out) const {
+  container_writer w;
+  write(w);
+  return w.write(out);
+}
+
+bool bloom_filter::write_to(int fd) const {
+  container_writer w;
+  write(w);
+  return w.write(fd);
+}
+
+int bloom_filter::load(std::istream& in) {
+  container_reader r;
+  if (auto status = r.open(in))
+    return status;
+  if (read(r) != 0 || !r.done())
+    return 1;
+  return 0;
+}
+
+} // namespace bf
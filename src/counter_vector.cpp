@@ -1,8 +1,17 @@
 #include <bf/counter_vector.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <string.h>
 
+#include <bf/container.hpp>
+#include <bf/cpu.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BF_X86 1
+#include <immintrin.h>
+#endif
+
 namespace bf {
 
 counter_vector::counter_vector(size_t cells, size_t width)
@@ -11,22 +20,195 @@ counter_vector::counter_vector(size_t cells, size_t width)
   assert(width > 0);
 }
 
-counter_vector& counter_vector::operator|=(counter_vector const& other) {
-  assert(size() == other.size());
-  assert(width() == other.width());
-  for (size_t cell = 0; cell < size(); ++cell) {
-    bool carry = false;
-    size_t lsb = cell * width_;
-    for (size_t i = 0; i < width_; ++i) {
-      bool b1 = bits_[lsb + i];
-      bool b2 = other.bits_[lsb + i];
-      bits_[lsb + i] = b1 ^ b2 ^ carry;
-      carry = (b1 && b2) || (carry && (b1 != b2));
+namespace {
+
+typedef bitvector::block_type block_type;
+
+constexpr size_t block_bits = bitvector::bits_per_block;
+
+enum class lane_op { add, subtract, minimum, maximum };
+
+// The functions below operate on blocks of counters of width *w*, a divisor
+// of the block size, as SWAR (SIMD within a register): *high* masks the top
+// bit of every counter, and the low bits of a counter are computed without
+// carrying into or borrowing from its neighbors.
+
+/// Spreads the top bit of every counter over the whole counter.
+block_type spread(block_type top, size_t w) {
+  return (top - (top >> (w - 1))) | top;
+}
+
+/// Computes the mask of the counters of *x* that are smaller than in *y*.
+block_type less(block_type x, block_type y, block_type high, size_t w) {
+  auto diff = ((x | high) - (y & ~high)) ^ ((x ^ ~y) & high);
+  return spread(((~x & y) | (~(x ^ y) & diff)) & high, w);
+}
+
+template <lane_op Op>
+block_type swar(block_type x, block_type y, block_type high, size_t w) {
+  switch (Op) {
+    case lane_op::add: {
+      auto sum = ((x & ~high) + (y & ~high)) ^ ((x ^ y) & high);
+      auto overflow = ((x & y) | ((x | y) & ~sum)) & high;
+      return sum | spread(overflow, w);
+    }
+    case lane_op::subtract: {
+      auto diff = ((x | high) - (y & ~high)) ^ ((x ^ ~y) & high);
+      auto borrow = ((~x & y) | (~(x ^ y) & diff)) & high;
+      return diff & ~spread(borrow, w);
+    }
+    case lane_op::minimum: {
+      auto lt = less(x, y, high, w);
+      return (x & lt) | (y & ~lt);
+    }
+    case lane_op::maximum: {
+      auto lt = less(x, y, high, w);
+      return (y & lt) | (x & ~lt);
     }
-    if (carry)
-      for (size_t i = 0; i < width_; ++i)
-        bits_.set(lsb + i);
   }
+  return x;
+}
+
+template <lane_op Op>
+size_t scalar(size_t x, size_t y, size_t max) {
+  switch (Op) {
+    case lane_op::add:
+      return y > max - x ? max : x + y;
+    case lane_op::subtract:
+      return y > x ? 0 : x - y;
+    case lane_op::minimum:
+      return std::min(x, y);
+    case lane_op::maximum:
+      return std::max(x, y);
+  }
+  return x;
+}
+
+#ifdef BF_X86
+
+template <lane_op Op>
+__attribute__((target("avx2"))) __m256i avx2_u8(__m256i x, __m256i y) {
+  switch (Op) {
+    case lane_op::add:
+      return _mm256_adds_epu8(x, y);
+    case lane_op::subtract:
+      return _mm256_subs_epu8(x, y);
+    case lane_op::minimum:
+      return _mm256_min_epu8(x, y);
+    case lane_op::maximum:
+      return _mm256_max_epu8(x, y);
+  }
+  return x;
+}
+
+template <lane_op Op>
+__attribute__((target("avx2"))) __m256i avx2_u16(__m256i x, __m256i y) {
+  switch (Op) {
+    case lane_op::add:
+      return _mm256_adds_epu16(x, y);
+    case lane_op::subtract:
+      return _mm256_subs_epu16(x, y);
+    case lane_op::minimum:
+      return _mm256_min_epu16(x, y);
+    case lane_op::maximum:
+      return _mm256_max_epu16(x, y);
+  }
+  return x;
+}
+
+// There are no 4-bit lanes, so process the low and the high nibbles of every
+// byte separately in 8-bit lanes. Only addition can leave the nibble range.
+template <lane_op Op>
+__attribute__((target("avx2"))) __m256i avx2_nibbles(__m256i x, __m256i y) {
+  if (Op == lane_op::add)
+    return _mm256_min_epu8(_mm256_add_epi8(x, y), _mm256_set1_epi8(0x0f));
+  return avx2_u8<Op>(x, y);
+}
+
+template <lane_op Op>
+__attribute__((target("avx2"))) __m256i avx2_u4(__m256i x, __m256i y) {
+  auto nibble = _mm256_set1_epi8(0x0f);
+  auto lo = avx2_nibbles<Op>(_mm256_and_si256(x, nibble),
+                             _mm256_and_si256(y, nibble));
+  auto hi = avx2_nibbles<Op>(_mm256_and_si256(_mm256_srli_epi16(x, 4), nibble),
+                             _mm256_and_si256(_mm256_srli_epi16(y, 4), nibble));
+  return _mm256_or_si256(lo, _mm256_slli_epi16(hi, 4));
+}
+
+/// Applies an operation to all complete 256-bit chunks of counters of width
+/// 4, 8 or 16.
+/// @return The number of processed blocks.
+template <lane_op Op>
+__attribute__((target("avx2"))) size_t
+avx2(block_type* x, block_type const* y, size_t blocks, size_t w) {
+  constexpr size_t step = sizeof(__m256i) / sizeof(block_type);
+  size_t i = 0;
+  for (; i + step <= blocks; i += step) {
+    auto px = reinterpret_cast<__m256i*>(x + i);
+    auto a = _mm256_loadu_si256(px);
+    auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(y + i));
+    auto r = w == 4 ? avx2_u4<Op>(a, b)
+                    : w == 8 ? avx2_u8<Op>(a, b) : avx2_u16<Op>(a, b);
+    _mm256_storeu_si256(px, r);
+  }
+  return i;
+}
+
+#endif // BF_X86
+
+/// Applies an operation to each pair of counters of *x* and *y*.
+/// @param xs The blocks of *x*.
+/// @param ys The blocks of *y*.
+template <lane_op Op>
+void lanewise(counter_vector& x, counter_vector const& y, block_type* xs,
+              block_type const* ys, size_t blocks) {
+  assert(x.size() == y.size());
+  assert(x.width() == y.width());
+  auto w = x.width();
+  if (block_bits % w != 0) {
+    for (size_t cell = 0; cell < x.size(); ++cell)
+      x.set(cell, scalar<Op>(x.count(cell), y.count(cell), x.max()));
+    return;
+  }
+  size_t i = 0;
+#ifdef BF_X86
+  if (cpu.avx2 && (w == 4 || w == 8 || w == 16))
+    i = avx2<Op>(xs, ys, blocks, w);
+#endif
+  block_type high = 0;
+  for (size_t bit = w - 1; bit < block_bits; bit += w)
+    high |= block_type(1) << bit;
+  for (; i < blocks; ++i)
+    xs[i] = swar<Op>(xs[i], ys[i], high, w);
+}
+
+} // namespace <anonymous>
+
+counter_vector& counter_vector::operator|=(counter_vector const& other) {
+  return add(other);
+}
+
+counter_vector& counter_vector::add(counter_vector const& other) {
+  lanewise<lane_op::add>(*this, other, bits_.data(), other.bits_.data(),
+                         bits_.blocks());
+  return *this;
+}
+
+counter_vector& counter_vector::subtract(counter_vector const& other) {
+  lanewise<lane_op::subtract>(*this, other, bits_.data(),
+                              other.bits_.data(), bits_.blocks());
+  return *this;
+}
+
+counter_vector& counter_vector::minimum(counter_vector const& other) {
+  lanewise<lane_op::minimum>(*this, other, bits_.data(), other.bits_.data(),
+                             bits_.blocks());
+  return *this;
+}
+
+counter_vector& counter_vector::maximum(counter_vector const& other) {
+  lanewise<lane_op::maximum>(*this, other, bits_.data(), other.bits_.data(),
+                             bits_.blocks());
   return *this;
 }
 
@@ -38,52 +220,113 @@ counter_vector operator|(counter_vector const& x, counter_vector const& y) {
 bool counter_vector::increment(size_t cell, size_t value) {
   assert(cell < size());
   assert(value != 0);
-  size_t lsb = cell * width_;
-  bool carry = false;
-  for (size_t i = 0; i < width_; ++i) {
-    bool b1 = bits_[lsb + i];
-    bool b2 = value & (1 << i);
-    bits_[lsb + i] = b1 ^ b2 ^ carry;
-    carry = (b1 && b2) || (carry && (b1 != b2));
+  auto cnt = count(cell);
+  if (value > max() - cnt) {
+    set(cell, max());
+    return false;
   }
-  if (carry)
-    for (size_t i = 0; i < width_; ++i)
-      bits_[lsb + i] = true;
-  return !carry;
+  set(cell, cnt + value);
+  return true;
 }
 
 bool counter_vector::decrement(size_t cell, size_t value) {
   assert(cell < size());
   assert(value != 0);
-  value = ~value + 1; // A - B := A + ~B + 1
-  bool carry = false;
-  size_t lsb = cell * width_;
-  for (size_t i = 0; i < width_; ++i) {
-    bool b1 = bits_[lsb + i];
-    bool b2 = value & (1 << i);
-    bits_[lsb + i] = b1 ^ b2 ^ carry;
-    carry = (b1 && b2) || (carry && (b1 != b2));
+  auto cnt = count(cell);
+  if (value > cnt) {
+    set(cell, 0);
+    return false;
+  }
+  set(cell, cnt - value);
+  return true;
+}
+
+bool counter_vector::increment_atomic(size_t cell, size_t value) {
+  assert(cell < size());
+  assert(value != 0);
+  assert(block_bits % width_ == 0);
+  auto lsb = cell * width_;
+  auto& block = bits_.data()[lsb / block_bits];
+  auto offset = lsb % block_bits;
+  auto max = this->max();
+  auto mask = block_type(max) << offset;
+  auto old = __atomic_load_n(&block, __ATOMIC_RELAXED);
+  for (;;) {
+    auto cnt = (old >> offset) & max;
+    auto saturated = value > max - cnt;
+    auto updated = saturated ? max : cnt + value;
+    // A saturated counter stays as it is without taking the cache line.
+    if (updated == cnt)
+      return !saturated;
+    auto desired = (old & ~mask) | (block_type(updated) << offset);
+    if (__atomic_compare_exchange_n(&block, &old, desired, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return !saturated;
   }
-  return carry;
+}
+
+bool counter_vector::decrement_atomic(size_t cell, size_t value) {
+  assert(cell < size());
+  assert(value != 0);
+  assert(block_bits % width_ == 0);
+  auto lsb = cell * width_;
+  auto& block = bits_.data()[lsb / block_bits];
+  auto offset = lsb % block_bits;
+  auto max = this->max();
+  auto mask = block_type(max) << offset;
+  auto old = __atomic_load_n(&block, __ATOMIC_RELAXED);
+  for (;;) {
+    auto cnt = (old >> offset) & max;
+    auto saturated = value > cnt;
+    auto updated = saturated ? 0 : cnt - value;
+    if (updated == cnt)
+      return !saturated;
+    auto desired = (old & ~mask) | (block_type(updated) << offset);
+    if (__atomic_compare_exchange_n(&block, &old, desired, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return !saturated;
+  }
+}
+
+size_t counter_vector::count_atomic(size_t cell) const {
+  assert(cell < size());
+  assert(block_bits % width_ == 0);
+  auto lsb = cell * width_;
+  auto block = __atomic_load_n(bits_.data() + lsb / block_bits,
+                               __ATOMIC_RELAXED);
+  return (block >> (lsb % block_bits)) & max();
+}
+
+void counter_vector::clear_atomic() {
+  auto blocks = bits_.data();
+  for (size_t i = 0; i < bits_.blocks(); ++i)
+    __atomic_store_n(&blocks[i], block_type(0), __ATOMIC_RELAXED);
 }
 
 size_t counter_vector::count(size_t cell) const {
   assert(cell < size());
-  size_t cnt = 0, order = 1;
-  size_t lsb = cell * width_;
-  for (auto i = lsb; i < lsb + width_; ++i, order <<= 1)
-    if (bits_[i])
-      cnt |= order;
-  return cnt;
+  auto lsb = cell * width_;
+  auto blocks = bits_.data() + lsb / block_bits;
+  auto offset = lsb % block_bits;
+  auto cnt = blocks[0] >> offset;
+  // Only counters whose width does not divide the block size can straddle
+  // two blocks.
+  if (offset + width_ > block_bits)
+    cnt |= blocks[1] << (block_bits - offset);
+  return cnt & max();
 }
 
 void counter_vector::set(size_t cell, size_t value) {
   assert(cell < size());
   assert(value <= max());
-  bitvector bits(width_, value);
   auto lsb = cell * width_;
-  for (size_t i = 0; i < width_; ++i)
-    bits_[lsb + i] = bits[i];
+  auto blocks = bits_.data() + lsb / block_bits;
+  auto offset = lsb % block_bits;
+  blocks[0] = (blocks[0] & ~(max() << offset)) | (value << offset);
+  if (offset + width_ > block_bits) {
+    auto shift = block_bits - offset;
+    blocks[1] = (blocks[1] & ~(max() >> shift)) | (value >> shift);
+  }
 }
 
 void counter_vector::clear() {
@@ -131,4 +374,18 @@ int counter_vector::fromBuf(const char* buf, unsigned int len) {
     return 2;
   return 0;
 }
+
+void counter_vector::write(container_writer& w) const {
+  bits_.write(w);
+}
+
+int counter_vector::read(container_reader& r, size_t width) {
+  if (width == 0 || width > 64 || bits_.read(r) != 0)
+    return 1;
+  if (bits_.size() % width != 0)
+    return 1;
+  width_ = width;
+  return 0;
+}
+
 } // namespace bf
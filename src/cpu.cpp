@@ -0,0 +1,22 @@
+#include <bf/cpu.hpp>
+
+namespace bf {
+
+namespace {
+
+cpu_features detect() {
+  cpu_features f;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  f.popcnt = __builtin_cpu_supports("popcnt");
+  f.sse42 = __builtin_cpu_supports("sse4.2");
+  f.avx2 = __builtin_cpu_supports("avx2");
+#endif
+  return f;
+}
+
+} // namespace <anonymous>
+
+cpu_features cpu = detect();
+
+} // namespace bf
@@ -32,11 +32,13 @@ default_hasher::default_hasher(
     : fns_(std::move(fns)) {
 }
 
-std::vector<digest> default_hasher::operator()(object const& o) const {
-  std::vector<digest> d(fns_.size());
+size_t default_hasher::k() const {
+  return fns_.size();
+}
+
+void default_hasher::operator()(object const& o, digest* digests) const {
   for (size_t i = 0; i < fns_.size(); ++i)
-    d[i] = (*fns_[i])(o);
-  return d;
+    digests[i] = (*fns_[i])(o);
 }
 
 char* default_hasher::serialize(char* buf) {
@@ -66,14 +68,21 @@ unsigned int default_hasher::serializedSize() const {
 
 int default_hasher::fromBuf(const char* buf, unsigned int len) {
   auto buf_start = buf;
+  auto buf_end = buf + len;
+  if (len < 2 * sizeof(unsigned int))
+    return 3;
   if (be32toh(*reinterpret_cast<const unsigned int*>(buf)) != 0)
     return 1;
   buf += sizeof(unsigned int);
   auto ct = be32toh(*reinterpret_cast<const unsigned int*>(buf));
   buf += sizeof(unsigned int);
   for (unsigned int i = 0; i < ct; i++) {
+    if (buf_end - buf < static_cast<ptrdiff_t>(sizeof(unsigned int)))
+      return 3;
     auto h3_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
     buf += sizeof(unsigned int);
+    if (buf_end - buf < static_cast<ptrdiff_t>(h3_sz))
+      return 3;
     auto fn = std::make_shared<default_hash_function>();
     if (fn->fromBuf(buf, h3_sz) != 0)
       return 2;
@@ -91,13 +100,15 @@ double_hasher::double_hasher(size_t k,
     : k_(k), h1_(std::move(h1)), h2_(std::move(h2)) {
 }
 
-std::vector<digest> double_hasher::operator()(object const& o) const {
+size_t double_hasher::k() const {
+  return k_;
+}
+
+void double_hasher::operator()(object const& o, digest* digests) const {
   auto d1 = (*h1_)(o);
   auto d2 = (*h2_)(o);
-  std::vector<digest> d(k_);
-  for (size_t i = 0; i < d.size(); ++i)
-    d[i] = d1 + i * d2;
-  return d;
+  for (size_t i = 0; i < k_; ++i)
+    digests[i] = d1 + i * d2;
 }
 
 char* double_hasher::serialize(char* buf) {
@@ -127,22 +138,33 @@ unsigned int double_hasher::serializedSize() const {
 
 int double_hasher::fromBuf(const char* buf, unsigned int len) {
   auto buf_start = buf;
+  auto buf_end = buf + len;
+  if (len < sizeof(unsigned int) + sizeof(size_t))
+    return 4;
   if (be32toh(*reinterpret_cast<const unsigned int*>(buf)) != 1)
     return 1;
   buf += sizeof(unsigned int);
   k_ = be64toh(*reinterpret_cast<const size_t*>(buf));
   buf += sizeof(size_t);
   {
+    if (buf_end - buf < static_cast<ptrdiff_t>(sizeof(unsigned int)))
+      return 4;
     auto h3_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
     buf += sizeof(unsigned int);
+    if (buf_end - buf < static_cast<ptrdiff_t>(h3_sz))
+      return 4;
     h1_ = std::make_shared<default_hash_function>();
     if (h1_->fromBuf(buf, h3_sz) != 0)
       return 2;
     buf += h3_sz;
   }
   {
+    if (buf_end - buf < static_cast<ptrdiff_t>(sizeof(unsigned int)))
+      return 4;
     auto h3_sz = be32toh(*reinterpret_cast<const unsigned int*>(buf));
     buf += sizeof(unsigned int);
+    if (buf_end - buf < static_cast<ptrdiff_t>(h3_sz))
+      return 4;
     h2_ = std::make_shared<default_hash_function>();
     if (h2_->fromBuf(buf, h3_sz) != 0)
       return 3;
@@ -158,12 +180,14 @@ ap_hasher::ap_hasher(unsigned short idx_) : less_than_idx(idx_) {
     throw std::runtime_error("hash function num too large");
 }
 
-std::vector<digest> ap_hasher::operator()(object const& o) const {
-  std::vector<digest> d(less_than_idx);
+size_t ap_hasher::k() const {
+  return less_than_idx;
+}
+
+void ap_hasher::operator()(object const& o, digest* digests) const {
   for (size_t i = 0; i < less_than_idx; ++i)
-    d[i] = APHahser<unsigned long>::apHash(
+    digests[i] = APHahser<unsigned long>::apHash(
       reinterpret_cast<const unsigned char*>(o.data()), o.size(), i);
-  return d;
 }
 
 char* ap_hasher::serialize(char* buf) {
@@ -180,6 +204,8 @@ unsigned int ap_hasher::serializedSize() const {
 };
 
 int ap_hasher::fromBuf(const char* buf, unsigned int len) {
+  if (len != serializedSize())
+    return 2;
   if (be32toh(*reinterpret_cast<const unsigned int*>(buf)) != 2)
     return 1;
   buf += sizeof(uint32_t);
@@ -187,22 +213,116 @@ int ap_hasher::fromBuf(const char* buf, unsigned int len) {
   return 0;
 }
 
+constexpr uint64_t wyhash::secret[4];
+
+wy_hasher::wy_hasher(size_t k, uint64_t seed) : k_(k), seed_(seed) {
+}
+
+size_t wy_hasher::k() const {
+  return k_;
+}
+
+void wy_hasher::operator()(object const& o, digest* digests) const {
+  // Consecutive functions use seeds one golden-ratio increment apart; wyhash
+  // mixes the seed before use, so nearby seeds yield independent functions.
+  auto seed = seed_;
+  for (size_t i = 0; i < k_; ++i) {
+    digests[i] = wyhash::hash(o.data(), o.size(), seed);
+    seed += 0x9e3779b97f4a7c15ULL;
+  }
+}
+
+char* wy_hasher::serialize(char* buf) {
+  *reinterpret_cast<uint32_t*>(buf) = htobe32(3);
+  buf += sizeof(uint32_t);
+  *reinterpret_cast<uint64_t*>(buf) = htobe64(k_);
+  buf += sizeof(uint64_t);
+  *reinterpret_cast<uint64_t*>(buf) = htobe64(seed_);
+  return buf + sizeof(uint64_t);
+}
+
+unsigned int wy_hasher::serializedSize() const {
+  return sizeof(uint32_t) + 2 * sizeof(uint64_t);
+}
+
+int wy_hasher::fromBuf(const char* buf, unsigned int len) {
+  if (len != serializedSize())
+    return 1;
+  if (be32toh(*reinterpret_cast<const uint32_t*>(buf)) != 3)
+    return 2;
+  buf += sizeof(uint32_t);
+  k_ = be64toh(*reinterpret_cast<const uint64_t*>(buf));
+  buf += sizeof(uint64_t);
+  seed_ = be64toh(*reinterpret_cast<const uint64_t*>(buf));
+  return 0;
+}
+
+enhanced_double_hasher::enhanced_double_hasher(size_t k, uint64_t seed)
+    : k_(k), seed_(seed) {
+}
+
+size_t enhanced_double_hasher::k() const {
+  return k_;
+}
+
+void enhanced_double_hasher::operator()(object const& o,
+                                        digest* digests) const {
+  uint64_t x, y;
+  wyhash::hash128(o.data(), o.size(), seed_, x, y);
+  // Incremental evaluation of x + i * y + (i^3 - i) / 6.
+  for (size_t i = 0; i < k_; ++i) {
+    digests[i] = x;
+    x += y;
+    y += i + 1;
+  }
+}
+
+char* enhanced_double_hasher::serialize(char* buf) {
+  *reinterpret_cast<uint32_t*>(buf) = htobe32(4);
+  buf += sizeof(uint32_t);
+  *reinterpret_cast<uint64_t*>(buf) = htobe64(k_);
+  buf += sizeof(uint64_t);
+  *reinterpret_cast<uint64_t*>(buf) = htobe64(seed_);
+  return buf + sizeof(uint64_t);
+}
+
+unsigned int enhanced_double_hasher::serializedSize() const {
+  return sizeof(uint32_t) + 2 * sizeof(uint64_t);
+}
+
+int enhanced_double_hasher::fromBuf(const char* buf, unsigned int len) {
+  if (len != serializedSize())
+    return 1;
+  if (be32toh(*reinterpret_cast<const uint32_t*>(buf)) != 4)
+    return 2;
+  buf += sizeof(uint32_t);
+  k_ = be64toh(*reinterpret_cast<const uint64_t*>(buf));
+  buf += sizeof(uint64_t);
+  seed_ = be64toh(*reinterpret_cast<const uint64_t*>(buf));
+  return 0;
+}
+
 std::shared_ptr<base_hasher> make_hasher(size_t k, size_t seed,
                                          bool double_hashing) {
   assert(k > 0);
+  if (double_hashing)
+    return std::make_shared<enhanced_double_hasher>(k, seed);
   return std::make_shared<ap_hasher>(k);
-  /*std::minstd_rand0 prng(seed);
-  if (double_hashing) {
-    auto h1 = std::make_shared<default_hash_function>(prng());
-    auto h2 = std::make_shared<default_hash_function>(prng());
-    return std::make_shared<double_hasher>(k, h1, h2);
-  } else {
-    std::vector<std::shared_ptr<default_hash_function>> fns(k);
-    for (size_t i = 0; i < k; ++i) {
-      fns[i] = std::make_shared<default_hash_function>(prng());
-    }
-    return std::make_shared<default_hasher>(fns);
-  }*/
+}
+
+bool same_hasher(std::shared_ptr<base_hasher> const& x,
+                 std::shared_ptr<base_hasher> const& y) {
+  if (!x || !y)
+    return false;
+  if (x == y)
+    return true;
+  auto size = x->serializedSize();
+  if (size != y->serializedSize())
+    return false;
+  std::vector<char> a(size), b(size);
+  x->serialize(a.data());
+  y->serialize(b.data());
+  return a == b;
 }
 
 } // namespace bf
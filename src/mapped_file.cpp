@@ -0,0 +1,44 @@
+#include <bf/mapped_file.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bf {
+
+std::shared_ptr<mapped_file> mapped_file::open(std::string const& path) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  size_t size = st.st_size;
+  void* data = nullptr;
+  // An empty file cannot be mapped, but it is still a valid (empty) file.
+  if (size > 0) {
+    data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      return nullptr;
+    }
+  }
+  // The mapping remains valid after closing its descriptor.
+  ::close(fd);
+  return std::shared_ptr<mapped_file>(
+    new mapped_file(static_cast<char const*>(data), size));
+}
+
+mapped_file::mapped_file(char const* data, size_t size)
+    : data_(data), size_(size) {
+}
+
+mapped_file::~mapped_file() {
+  if (data_)
+    ::munmap(const_cast<char*>(data_), size_);
+}
+
+} // namespace bf
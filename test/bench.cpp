@@ -0,0 +1,762 @@
+// Micro-benchmarks for libbf.
+//
+// Usage: bf-bench [name...]
+//
+// Without arguments, all benchmarks run. Otherwise only those whose name
+// starts with one of the given arguments.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bf/all.hpp"
+#include "bf/cpu.hpp"
+
+using namespace bf;
+
+namespace {
+
+size_t allocations = 0;
+
+} // namespace <anonymous>
+
+// Count every heap allocation so that benchmarks can report allocations per
+// operation next to the running time. The replacements stay out of line, or
+// GCC would see the free() of a pointer from operator new and warn about a
+// mismatched deallocation.
+__attribute__((noinline)) void* operator new(size_t n) {
+  ++allocations;
+  if (auto p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+/// Keeps the compiler from optimizing away a computed value.
+template <typename T>
+void escape(T const& x) {
+  asm volatile("" : : "g"(&x) : "memory");
+}
+
+/// Runs *f* on each of *n* operations and prints the time and number of heap
+/// allocations per operation.
+void measure(char const* name, size_t n, std::function<void(size_t)> f) {
+  auto allocs = allocations;
+  auto start = clock_type::now();
+  for (size_t i = 0; i < n; ++i)
+    f(i);
+  auto stop = clock_type::now();
+  allocs = allocations - allocs;
+  auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  std::printf("  %-40s %10.2f ns/op %8.2f allocs/op\n", name, ns / n,
+              static_cast<double>(allocs) / n);
+}
+
+/// Splits *n* operations evenly among *threads* threads, each running *f* on
+/// its range, and prints the wall-clock time per operation.
+void measure_parallel(char const* name, size_t threads, size_t n,
+                      std::function<void(size_t, size_t)> f) {
+  std::vector<std::thread> workers;
+  auto start = clock_type::now();
+  for (size_t t = 0; t < threads; ++t)
+    workers.emplace_back(f, n * t / threads, n * (t + 1) / threads);
+  for (auto& w : workers)
+    w.join();
+  auto stop = clock_type::now();
+  auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  std::printf("  %-40s %10.2f ns/op %8zu threads\n", name, ns / n, threads);
+}
+
+std::vector<uint64_t> make_keys(size_t n, uint64_t seed = 42) {
+  std::vector<uint64_t> keys(n);
+  auto x = seed;
+  for (auto& k : keys) {
+    // splitmix64
+    x += 0x9e3779b97f4a7c15ULL;
+    auto z = x;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    k = z ^ (z >> 31);
+  }
+  return keys;
+}
+
+void bench_hashing() {
+  size_t const n = 1 << 20;
+  auto keys = make_keys(n);
+  auto h = make_hasher(7);
+  measure("hasher, std::vector result", n, [&](size_t i) {
+    auto d = (*h)(wrap(keys[i]));
+    escape(d);
+  });
+  measure("hasher, digest_buffer result", n, [&](size_t i) {
+    digest_buffer d;
+    (*h)(wrap(keys[i]), d);
+    escape(d);
+  });
+  // URL-sized keys, which exceed the range of the H3 tables.
+  std::string url(64, 'x');
+  ap_hasher ap(7);
+  wy_hasher wy(7, 0);
+  digest_buffer d;
+  measure("ap_hasher, 8-byte key", n, [&](size_t i) {
+    ap(wrap(keys[i]), d);
+    escape(d);
+  });
+  measure("wy_hasher, 8-byte key", n, [&](size_t i) {
+    wy(wrap(keys[i]), d);
+    escape(d);
+  });
+  measure("ap_hasher, 64-byte key", n, [&](size_t i) {
+    std::memcpy(&url[0], &keys[i], sizeof(keys[i]));
+    ap(wrap(url), d);
+    escape(d);
+  });
+  measure("wy_hasher, 64-byte key", n, [&](size_t i) {
+    std::memcpy(&url[0], &keys[i], sizeof(keys[i]));
+    wy(wrap(url), d);
+    escape(d);
+  });
+  // One pass over the key versus one pass per digest.
+  for (size_t k = 4; k <= 16; k += 4) {
+    ap_hasher ap(k);
+    enhanced_double_hasher edh(k, 0);
+    for (size_t size : {8, 64}) {
+      std::string key(size, 'x');
+      auto run = [&](char const* hasher, base_hasher const& h) {
+        auto name = std::string(hasher) + ", k=" + std::to_string(k) + ", "
+                    + std::to_string(size) + "-byte key";
+        measure(name.c_str(), n, [&](size_t i) {
+          std::memcpy(&key[0], &keys[i], sizeof(keys[i]));
+          h(wrap(key), d);
+          escape(d);
+        });
+      };
+      run("ap_hasher", ap);
+      run("enhanced_double_hasher", edh);
+    }
+  }
+}
+
+void bench_filters() {
+  size_t const n = 1 << 20;
+  auto keys = make_keys(n);
+  {
+    basic_bloom_filter bf(make_hasher(7), n * 10);
+    measure("basic_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+    measure("basic_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+  }
+  {
+    blocked_bloom_filter bf(make_hasher(7), n * 10);
+    measure("blocked_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+    measure("blocked_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+  }
+  {
+    counting_bloom_filter bf(make_hasher(7), n * 10, 4);
+    measure("counting_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+    measure("counting_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+    measure("counting_bloom_filter::remove", n,
+            [&](size_t i) { bf.remove(keys[i]); });
+  }
+  {
+    // Grows from 1/64 of the elements to about 7 stages.
+    scalable_bloom_filter bf(0.01, n / 64);
+    measure("scalable_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+    measure("scalable_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+    measure("scalable_bloom_filter::lookup (absent)", n,
+            [&](size_t i) { escape(bf.lookup(~keys[i])); });
+  }
+  {
+    spectral_mi_bloom_filter bf(make_hasher(7), n * 10, 4);
+    measure("spectral_mi_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+  }
+  {
+    stable_bloom_filter bf(make_hasher(7), n * 10, 4, 8);
+    measure("stable_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+  }
+  {
+    a2_bloom_filter bf(7, n * 10, n);
+    measure("a2_bloom_filter::add", n, [&](size_t i) { bf.add(keys[i]); });
+    measure("a2_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+  }
+  {
+    bitwise_bloom_filter bf(7, n * 10);
+    measure("bitwise_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+  }
+}
+
+void bench_split_block() {
+  // Filters of 64 MiB each exceed the caches, so every probe misses.
+  size_t const n = 1 << 20;
+  size_t const cells = size_t(1) << 29;
+  auto keys = make_keys(n);
+  auto others = make_keys(n, 4711);
+  basic_bloom_filter basic(make_hasher(7), cells);
+  split_block_bloom_filter split(make_hasher(1), cells);
+  for (auto k : keys) {
+    basic.add(k);
+    split.add(k);
+  }
+  measure("basic_bloom_filter::lookup (hit)", n,
+          [&](size_t i) { escape(basic.lookup(keys[i])); });
+  measure("basic_bloom_filter::lookup (miss)", n,
+          [&](size_t i) { escape(basic.lookup(others[i])); });
+  measure("split_block_bloom_filter::lookup (hit)", n,
+          [&](size_t i) { escape(split.lookup(keys[i])); });
+  measure("split_block_bloom_filter::lookup (miss)", n,
+          [&](size_t i) { escape(split.lookup(others[i])); });
+  auto features = cpu;
+  cpu.avx2 = false;
+  measure("split_block_bloom_filter::lookup (scalar)", n,
+          [&](size_t i) { escape(split.lookup(keys[i])); });
+  cpu = features;
+}
+
+void bench_batched() {
+  // Filters of 64 MiB each exceed the caches, so every probe misses. Keys
+  // arrive in batches of 1024, like in the probe stage of a hash join.
+  size_t const n = 1 << 20;
+  size_t const cells = size_t(1) << 29;
+  size_t const batch = 1024;
+  auto keys = make_keys(n);
+  std::vector<object> objects;
+  for (auto& k : keys)
+    objects.push_back(wrap(k));
+  std::vector<size_t> counts(batch);
+  // Submits a batch every *batch* operations, so that the timings are per
+  // key as for the single-key calls.
+  auto add_many = [&](bloom_filter& bf, size_t i) {
+    if (i % batch == 0)
+      bf.add_many(span<object const>(objects).subspan(i, batch));
+  };
+  auto lookup_many = [&](bloom_filter const& bf, size_t i) {
+    if (i % batch == 0)
+      bf.lookup_many(span<object const>(objects).subspan(i, batch), counts);
+    escape(counts);
+  };
+  {
+    basic_bloom_filter bf(make_hasher(7), cells);
+    measure("basic_bloom_filter::add", n,
+            [&](size_t i) { bf.add(objects[i]); });
+    measure("basic_bloom_filter::add_many", n,
+            [&](size_t i) { add_many(bf, i); });
+    measure("basic_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(objects[i])); });
+    measure("basic_bloom_filter::lookup_many", n,
+            [&](size_t i) { lookup_many(bf, i); });
+  }
+  {
+    counting_bloom_filter bf(make_hasher(7), cells / 4, 4);
+    measure("counting_bloom_filter::add", n,
+            [&](size_t i) { bf.add(objects[i]); });
+    measure("counting_bloom_filter::add_many", n,
+            [&](size_t i) { add_many(bf, i); });
+    measure("counting_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(objects[i])); });
+    measure("counting_bloom_filter::lookup_many", n,
+            [&](size_t i) { lookup_many(bf, i); });
+  }
+}
+
+void bench_mapping() {
+  // Filters that fit into L1 isolate the cost of mapping a digest to a cell.
+  // The size is not a power of two, as is typical for filters sized by
+  // false-positive rate, and opaque to the compiler, which would otherwise
+  // replace the division by a multiplication.
+  size_t const n = 1 << 20;
+  size_t const k = 7;
+  size_t volatile opaque_cells = 9973;
+  size_t const cells = opaque_cells;
+  auto keys = make_keys(n);
+  auto probes = [&](index_mapping mapping) {
+    return [&, mapping](size_t i) {
+      size_t sum = 0;
+      for (size_t j = 0; j < k; ++j)
+        sum += map_index(keys[i] * (2 * j + 1), cells, mapping);
+      escape(sum);
+    };
+  };
+  measure("7 probes, digest % cells", n, probes(index_mapping::modulo));
+  measure("7 probes, (digest * cells) >> 64", n,
+          probes(index_mapping::fast_range));
+  for (auto mapping : {index_mapping::modulo, index_mapping::fast_range}) {
+    auto suffix = std::string(mapping == index_mapping::modulo
+                                ? " (modulo)" : " (fast range)");
+    basic_bloom_filter bf(make_hasher(7), cells, false, mapping);
+    measure(("basic_bloom_filter::add" + suffix).c_str(), n,
+            [&](size_t i) { bf.add(keys[i]); });
+    measure(("basic_bloom_filter::lookup" + suffix).c_str(), n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+  }
+}
+
+void bench_counters() {
+  size_t const n = 1 << 20;
+  auto keys = make_keys(n);
+  for (size_t width : {4, 8, 5}) {
+    counter_vector v(n, width);
+    counter_vector w(n, width);
+    auto suffix = ", width " + std::to_string(width);
+    measure(("counter_vector::increment" + suffix).c_str(), n,
+            [&](size_t i) { v.increment(keys[i] % n); });
+    measure(("counter_vector::count" + suffix).c_str(), n,
+            [&](size_t i) { escape(v.count(keys[i] % n)); });
+    measure(("counter_vector::decrement" + suffix).c_str(), n,
+            [&](size_t i) { w.decrement(keys[i] % n); });
+    measure(("counter_vector::add (1M cells)" + suffix).c_str(), 10,
+            [&](size_t) { v.add(w); });
+    measure(("counter_vector::minimum (1M cells)" + suffix).c_str(), 10,
+            [&](size_t) { v.minimum(w); });
+    if (width == 5)
+      continue;
+    auto features = cpu;
+    cpu.avx2 = false;
+    measure(("counter_vector::add (1M cells, SWAR)" + suffix).c_str(), 10,
+            [&](size_t) { v.add(w); });
+    cpu = features;
+  }
+}
+
+void bench_popcount() {
+  // 8 MiB bit vectors stream from memory, as when merging or comparing large
+  // filters.
+  size_t const n = 1 << 26;
+  bitvector x(n), y(n);
+  auto keys = make_keys(n / 8);
+  for (auto key : keys) {
+    x.set(key % n);
+    y.set((key >> 32) % n);
+  }
+  auto features = cpu;
+  cpu.popcnt = cpu.avx2 = false;
+  measure("bitvector::count (64 Mbit, portable)", 10,
+          [&](size_t) { escape(x.count()); });
+  cpu.popcnt = features.popcnt;
+  measure("bitvector::count (64 Mbit, POPCNT)", 10,
+          [&](size_t) { escape(x.count()); });
+  cpu.avx2 = features.avx2;
+  measure("bitvector::count (64 Mbit, AVX2)", 10,
+          [&](size_t) { escape(x.count()); });
+  measure("(x & y).count() (64 Mbit)", 10,
+          [&](size_t) { escape((x & y).count()); });
+  measure("count_and(x, y) (64 Mbit)", 10,
+          [&](size_t) { escape(count_and(x, y)); });
+  cpu.avx2 = false;
+  measure("bitvector::operator|= (64 Mbit, scalar)", 10,
+          [&](size_t) { x |= y; });
+  cpu.avx2 = features.avx2;
+  measure("bitvector::operator|= (64 Mbit, AVX2)", 10,
+          [&](size_t) { x |= y; });
+  cpu = features;
+  basic_bloom_filter a(make_hasher(7), n), b(make_hasher(7), n);
+  for (auto key : keys) {
+    a.add(key);
+    b.add(key >> 32);
+  }
+  measure("estimate_cardinality (64 Mbit)", 10,
+          [&](size_t) { escape(a.estimate_cardinality()); });
+  measure("estimate_union (64 Mbit)", 10,
+          [&](size_t) { escape(a.estimate_union(b)); });
+}
+
+void bench_persistence() {
+  // A filter of 512 MiB, written to /dev/null to isolate the cost of
+  // preparing the bytes.
+  basic_bloom_filter bf(make_hasher(7), size_t(1) << 32);
+  auto fd = ::open("/dev/null", O_WRONLY);
+  measure("serialize + write (512 MiB)", 3, [&](size_t) {
+    std::vector<char> buf(bf.serializedSize());
+    bf.serialize(buf.data());
+    escape(::write(fd, buf.data(), buf.size()));
+  });
+  measure("save + write (512 MiB)", 3, [&](size_t) {
+    auto buf = save(bf);
+    escape(::write(fd, buf.data(), buf.size()));
+  });
+  measure("write_to (512 MiB)", 3, [&](size_t) { escape(bf.write_to(fd)); });
+  ::close(fd);
+}
+
+void bench_concurrent() {
+  // Filters of 64 MiB each exceed the caches. The mutex-protected filters
+  // are the baselines that the concurrent filters replace.
+  size_t const n = 1 << 22;
+  size_t const cells = size_t(1) << 29;
+  auto keys = make_keys(n);
+  std::vector<size_t> thread_counts;
+  for (size_t t = 1; t < std::thread::hardware_concurrency(); t *= 2)
+    thread_counts.push_back(t);
+  thread_counts.push_back(std::thread::hardware_concurrency());
+  for (auto threads : thread_counts) {
+    basic_bloom_filter locked(make_hasher(7), cells);
+    std::mutex mutex;
+    measure_parallel("basic_bloom_filter::add + mutex", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i) {
+                         std::lock_guard<std::mutex> lock(mutex);
+                         locked.add(keys[i]);
+                       }
+                     });
+    concurrent_bloom_filter bf(make_hasher(7), cells);
+    measure_parallel("concurrent_bloom_filter::add", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i)
+                         bf.add(keys[i]);
+                     });
+    measure_parallel("concurrent_bloom_filter::lookup", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i)
+                         escape(bf.lookup(keys[i]));
+                     });
+    measure_parallel("concurrent_bloom_filter::add_many", threads, n,
+                     [&](size_t first, size_t last) {
+                       std::vector<object> batch;
+                       for (auto i = first; i < last; ++i) {
+                         batch.push_back(wrap(keys[i]));
+                         if (batch.size() == 1024 || i + 1 == last) {
+                           bf.add_many(batch);
+                           batch.clear();
+                         }
+                       }
+                     });
+    sharded_bloom_filter<basic_bloom_filter> sharded(16, make_hasher(7),
+                                                     cells / 16);
+    measure_parallel("sharded_bloom_filter<basic>::add", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i)
+                         sharded.add(keys[i]);
+                     });
+    measure_parallel("sharded_bloom_filter<basic>::add_many", threads, n,
+                     [&](size_t first, size_t last) {
+                       std::vector<object> batch;
+                       for (auto i = first; i < last; ++i) {
+                         batch.push_back(wrap(keys[i]));
+                         if (batch.size() == 1024 || i + 1 == last) {
+                           sharded.add_many(batch);
+                           batch.clear();
+                         }
+                       }
+                     });
+    counting_bloom_filter locked_counting(make_hasher(7), cells / 4, 4);
+    measure_parallel("counting_bloom_filter::add + mutex", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i) {
+                         std::lock_guard<std::mutex> lock(mutex);
+                         locked_counting.add(keys[i]);
+                       }
+                     });
+    concurrent_counting_bloom_filter counting(make_hasher(7), cells / 4, 4);
+    measure_parallel("concurrent_counting_bloom_filter::add", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i)
+                         counting.add(keys[i]);
+                     });
+    measure_parallel("concurrent_counting_bloom_filter::lookup", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i)
+                         escape(counting.lookup(keys[i]));
+                     });
+    measure_parallel("concurrent_counting_bloom_filter::remove", threads, n,
+                     [&](size_t first, size_t last) {
+                       for (auto i = first; i < last; ++i)
+                         counting.remove(keys[i]);
+                     });
+  }
+}
+
+void bench_bulk_build() {
+  // A 64 MiB filter, as for a nightly rebuild from a large key array.
+  size_t const n = 1 << 22;
+  size_t const cells = size_t(1) << 29;
+  auto keys = make_keys(n);
+  std::vector<object> objects;
+  for (auto& k : keys)
+    objects.push_back(wrap(k));
+  // bulk_build spawns its own threads, so time a single call.
+  auto run = [&](char const* name, size_t threads,
+                 std::function<void(basic_bloom_filter&)> f) {
+    basic_bloom_filter bf(make_hasher(7), cells, true);
+    auto start = clock_type::now();
+    f(bf);
+    auto stop = clock_type::now();
+    auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    std::printf("  %-40s %10.2f ns/op %8zu threads\n", name, ns / n,
+                threads);
+  };
+  run("basic_bloom_filter::add_many", 1,
+      [&](basic_bloom_filter& bf) { bf.add_many(objects); });
+  for (size_t threads = 1; threads <= concurrency(0); threads *= 2)
+    run("basic_bloom_filter::bulk_build", threads,
+        [&](basic_bloom_filter& bf) { bf.bulk_build(objects, threads); });
+}
+
+void bench_merge() {
+  // 64 per-node filters of 2 MiB each, ORed together as one operation. An
+  // operation is one block of one input filter.
+  size_t const nodes = 64;
+  size_t const cells = size_t(1) << 24;
+  size_t const n = nodes * cells / bitvector::bits_per_block;
+  std::vector<std::unique_ptr<basic_bloom_filter>> filters;
+  std::vector<basic_bloom_filter const*> others;
+  auto keys = make_keys(1 << 16);
+  for (size_t i = 0; i < nodes; ++i) {
+    filters.emplace_back(new basic_bloom_filter(make_hasher(7), cells));
+    for (size_t j = i; j < keys.size(); j += nodes)
+      filters.back()->add(keys[j]);
+    others.push_back(filters.back().get());
+  }
+  auto run = [&](char const* name, size_t threads,
+                 std::function<void(basic_bloom_filter&)> f) {
+    basic_bloom_filter bf(make_hasher(7), cells);
+    auto start = clock_type::now();
+    f(bf);
+    auto stop = clock_type::now();
+    auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    std::printf("  %-40s %10.2f ns/op %8zu threads\n", name, ns / n,
+                threads);
+  };
+  run("basic_bloom_filter::merge, one by one", 1, [&](basic_bloom_filter& bf) {
+    for (auto other : others)
+      bf.merge(*other, 1);
+  });
+  for (size_t threads = 1; threads <= concurrency(0); threads *= 2)
+    run("basic_bloom_filter::merge, all at once", threads,
+        [&](basic_bloom_filter& bf) { bf.merge(others, threads); });
+}
+
+void bench_deletion() {
+  // Filters that support removal, sized for the same false-positive
+  // probability as a cuckoo filter with 16-bit fingerprints.
+  size_t const n = 1 << 20;
+  auto keys = make_keys(n);
+  auto fp = 8.0 / 65536;
+  {
+    cuckoo_filter cf(make_hasher(1), n, 16);
+    std::printf("  %-40s %10.2f bits/element\n", "cuckoo_filter",
+                16.0 * cf.capacity() / n);
+    measure("cuckoo_filter::add", n, [&](size_t i) { cf.add(keys[i]); });
+    measure("cuckoo_filter::lookup", n,
+            [&](size_t i) { escape(cf.lookup(keys[i])); });
+    measure("cuckoo_filter::lookup (absent)", n,
+            [&](size_t i) { escape(cf.lookup(~keys[i])); });
+    measure("cuckoo_filter::remove", n,
+            [&](size_t i) { cf.remove(keys[i]); });
+  }
+  {
+    quotient_filter qf(fp, n);
+    std::printf("  %-40s %10.2f bits/element\n", "quotient_filter",
+                (qf.remainder_bits() + 4.0) * qf.capacity() / n);
+    measure("quotient_filter::add", n, [&](size_t i) { qf.add(keys[i]); });
+    measure("quotient_filter::lookup", n,
+            [&](size_t i) { escape(qf.lookup(keys[i])); });
+    measure("quotient_filter::lookup (absent)", n,
+            [&](size_t i) { escape(qf.lookup(~keys[i])); });
+    measure("quotient_filter::remove", n,
+            [&](size_t i) { qf.remove(keys[i]); });
+  }
+  {
+    auto cells = basic_bloom_filter::m(fp, n);
+    auto k = basic_bloom_filter::k(cells, n);
+    counting_bloom_filter bf(make_hasher(k), cells, 4);
+    std::printf("  %-40s %10.2f bits/element\n", "counting_bloom_filter",
+                4.0 * cells / n);
+    measure("counting_bloom_filter::add", n,
+            [&](size_t i) { bf.add(keys[i]); });
+    measure("counting_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+    measure("counting_bloom_filter::lookup (absent)", n,
+            [&](size_t i) { escape(bf.lookup(~keys[i])); });
+    measure("counting_bloom_filter::remove", n,
+            [&](size_t i) { bf.remove(keys[i]); });
+  }
+}
+
+void bench_compaction() {
+  // Operations that need no elements, per distinct fingerprint.
+  size_t const n = 1 << 20;
+  auto keys = make_keys(2 * n);
+  auto h = make_hasher(1);
+  quotient_filter x(h, 21, 12), y(h, 21, 12);
+  for (size_t i = 0; i < n; ++i) {
+    x.add(keys[i]);
+    y.add(keys[n + i]);
+  }
+  auto run = [&](char const* name, std::function<void()> f) {
+    auto start = clock_type::now();
+    f();
+    auto stop = clock_type::now();
+    auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    std::printf("  %-40s %10.2f ns/op\n", name, ns / n);
+  };
+  run("quotient_filter::enumerate", [&] {
+    uint64_t sum = 0;
+    x.enumerate([&](uint64_t fp, size_t) { sum += fp; });
+    escape(sum);
+  });
+  run("quotient_filter::merge", [&] { x.merge(y); });
+  run("quotient_filter::resize", [&] { x.resize(); });
+}
+
+void bench_static() {
+  // Static filters from a key array against a basic Bloom filter at the
+  // same false-positive probability. An operation is one key.
+  size_t const n = 1 << 22;
+  auto keys = make_keys(n);
+  std::vector<object> objects;
+  for (auto& k : keys)
+    objects.push_back(wrap(k));
+  for (size_t bits : {8, 16}) {
+    binary_fuse_filter bff(make_hasher(1), bits);
+    for (size_t threads = 1; threads <= concurrency(0); threads *= 2) {
+      auto start = clock_type::now();
+      bff.build(objects, threads);
+      auto stop = clock_type::now();
+      auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+      std::printf("  %-40s %10.2f ns/op %8zu threads\n",
+                  bits == 8 ? "binary_fuse_filter::build (8 bits)"
+                            : "binary_fuse_filter::build (16 bits)",
+                  ns / n, threads);
+    }
+    std::printf("  %-40s %10.2f bits/element\n", "binary_fuse_filter",
+                1.0 * bff.slots() * bits / n);
+    measure("binary_fuse_filter::lookup", n,
+            [&](size_t i) { escape(bff.lookup(keys[i])); });
+    measure("binary_fuse_filter::lookup (absent)", n,
+            [&](size_t i) { escape(bff.lookup(~keys[i])); });
+    auto start = clock_type::now();
+    ribbon_filter rf(make_hasher(1), objects, bits);
+    auto stop = clock_type::now();
+    auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    std::printf("  %-40s %10.2f ns/op\n",
+                bits == 8 ? "ribbon_filter::build (8 bits)"
+                          : "ribbon_filter::build (16 bits)",
+                ns / n);
+    std::printf("  %-40s %10.2f bits/element\n", "ribbon_filter",
+                1.0 * rf.slots() * bits / n);
+    measure("ribbon_filter::lookup", n,
+            [&](size_t i) { escape(rf.lookup(keys[i])); });
+    measure("ribbon_filter::lookup (absent)", n,
+            [&](size_t i) { escape(rf.lookup(~keys[i])); });
+    auto fp = std::ldexp(1.0, -static_cast<int>(bits));
+    basic_bloom_filter bf(fp, n);
+    for (auto& k : keys)
+      bf.add(k);
+    std::printf("  %-40s %10.2f bits/element\n", "basic_bloom_filter",
+                1.0 * bf.storage().size() / n);
+    measure("basic_bloom_filter::lookup", n,
+            [&](size_t i) { escape(bf.lookup(keys[i])); });
+    measure("basic_bloom_filter::lookup (absent)", n,
+            [&](size_t i) { escape(bf.lookup(~keys[i])); });
+  }
+}
+
+void bench_heavy_hitters() {
+  // A skewed stream of events whose keys follow a power law: the key of
+  // rank r occurs about n / (r ln distinct) times. An operation is one event.
+  size_t const n = 1 << 22;
+  size_t const distinct = 1 << 20;
+  auto keys = make_keys(distinct);
+  auto uniform = make_keys(n, 7);
+  std::vector<uint64_t> stream(n);
+  for (size_t i = 0; i < n; ++i) {
+    auto u = std::ldexp(static_cast<double>(uniform[i] >> 11), -53);
+    stream[i] = keys[static_cast<size_t>(std::pow(distinct, u)) - 1];
+  }
+  std::vector<object> objects;
+  for (auto& x : stream)
+    objects.push_back(wrap(x));
+  count_min_sketch cms(0.0001, 0.001, 100);
+  measure("count_min_sketch::add (top 100)", n,
+          [&](size_t i) { cms.add(stream[i]); });
+  cms.clear();
+  auto start = clock_type::now();
+  cms.add_many(objects);
+  auto stop = clock_type::now();
+  auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  std::printf("  %-40s %10.2f ns/op\n", "count_min_sketch::add_many (top 100)",
+              ns / n);
+  measure("count_min_sketch::lookup", n,
+          [&](size_t i) { escape(cms.lookup(stream[i])); });
+  start = clock_type::now();
+  escape(cms.heavy_hitters().size());
+  stop = clock_type::now();
+  ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  std::printf("  %-40s %10.2f ns\n", "count_min_sketch::heavy_hitters", ns);
+  // The shared row of a spectral MI Bloom filter with as many counters.
+  spectral_mi_bloom_filter mi(make_hasher(cms.rows()),
+                              cms.rows() * cms.cells(), 32);
+  measure("spectral_mi_bloom_filter::add", n,
+          [&](size_t i) { mi.add(stream[i]); });
+}
+
+struct benchmark {
+  char const* name;
+  void (*run)();
+};
+
+benchmark const benchmarks[] = {
+  {"hashing", bench_hashing},
+  {"filters", bench_filters},
+  {"split-block", bench_split_block},
+  {"batched", bench_batched},
+  {"mapping", bench_mapping},
+  {"counters", bench_counters},
+  {"popcount", bench_popcount},
+  {"persistence", bench_persistence},
+  {"concurrent", bench_concurrent},
+  {"bulk-build", bench_bulk_build},
+  {"merge", bench_merge},
+  {"deletion", bench_deletion},
+  {"compaction", bench_compaction},
+  {"static", bench_static},
+  {"heavy-hitters", bench_heavy_hitters},
+};
+
+} // namespace <anonymous>
+
+int main(int argc, char* argv[]) {
+  for (auto& b : benchmarks) {
+    auto selected = argc < 2;
+    for (int i = 1; i < argc; ++i)
+      if (std::strncmp(b.name, argv[i], std::strlen(argv[i])) == 0)
+        selected = true;
+    if (!selected)
+      continue;
+    std::printf("%s\n", b.name);
+    b.run();
+  }
+  return 0;
+}
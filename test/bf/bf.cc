@@ -1,9 +1,11 @@
 #include <cassert>
+#include <cmath>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "configuration.h"
 
@@ -21,6 +23,8 @@ trial<nothing> run(config const& cfg) {
   auto capacity = *cfg.as<size_t>("capacity");
   auto width = *cfg.as<size_t>("width");
   auto part = cfg.check("partition");
+  auto mapping = cfg.check("fast-range") ? index_mapping::fast_range
+                                         : index_mapping::modulo;
   auto double_hashing = cfg.check("double-hashing");
   auto d = *cfg.as<size_t>("evict");
 
@@ -41,10 +45,32 @@ trial<nothing> run(config const& cfg) {
         return error{"need non-zero k"};
 
       auto h = make_hasher(k, seed, double_hashing);
-      bf.reset(new basic_bloom_filter(std::move(h), cells, part));
+      bf.reset(new basic_bloom_filter(std::move(h), cells, part, mapping));
     } else {
       assert(fpr != 0 && capacity != 0);
-      bf.reset(new basic_bloom_filter(fpr, capacity, seed, part));
+      bf.reset(new basic_bloom_filter(fpr, capacity, seed, double_hashing,
+                                      part, mapping));
+    }
+  } else if (type == "blocked") {
+    if (fpr == 0 || capacity == 0) {
+      if (cells == 0)
+        return error{"need non-zero cells"};
+      if (k == 0)
+        return error{"need non-zero k"};
+
+      auto h = make_hasher(k, seed, double_hashing);
+      bf.reset(new blocked_bloom_filter(std::move(h), cells));
+    } else {
+      bf.reset(new blocked_bloom_filter(fpr, capacity, seed, double_hashing));
+    }
+  } else if (type == "split-block") {
+    if (fpr == 0 || capacity == 0) {
+      if (cells == 0)
+        return error{"need non-zero cells"};
+
+      bf.reset(new split_block_bloom_filter(make_hasher(1, seed), cells));
+    } else {
+      bf.reset(new split_block_bloom_filter(fpr, capacity, seed));
     }
   } else if (type == "counting") {
     if (cells == 0)
@@ -55,7 +81,8 @@ trial<nothing> run(config const& cfg) {
       return error{"need non-zero k"};
 
     auto h = make_hasher(k, seed, double_hashing);
-    bf.reset(new counting_bloom_filter(std::move(h), cells, width, part));
+    bf.reset(
+      new counting_bloom_filter(std::move(h), cells, width, part, mapping));
   } else if (type == "spectral-mi") {
     if (cells == 0)
       return error{"need non-zero cells"};
@@ -110,6 +137,20 @@ trial<nothing> run(config const& cfg) {
 
     auto h = make_hasher(k, seed, double_hashing);
     bf.reset(new stable_bloom_filter(std::move(h), cells, seed, d));
+  } else if (type == "binary-fuse") {
+    if (fpr != 0)
+      width = fpr >= 1.0 / 256 ? 8 : 16;
+    if (width != 8 && width != 16)
+      return error{"need cell width 8 or 16"};
+
+    bf.reset(new binary_fuse_filter(make_hasher(1, seed), width));
+  } else if (type == "ribbon") {
+    if (fpr != 0)
+      width = static_cast<size_t>(std::ceil(-std::log2(fpr)));
+    if (width == 0 || width > 32)
+      return error{"need cell width between 1 and 32"};
+
+    bf.reset(new ribbon_filter(make_hasher(1, seed), width));
   } else {
     return error{"invalid bloom filter type"};
   }
@@ -122,6 +163,13 @@ trial<nothing> run(config const& cfg) {
 
   in >> std::noskipws;
 
+  // A static filter needs all elements at once.
+  auto fuse = dynamic_cast<binary_fuse_filter*>(bf.get());
+  auto ribbon = dynamic_cast<ribbon_filter*>(bf.get());
+  auto static_filter = fuse || ribbon;
+  std::vector<std::string> lines;
+  std::vector<double> numbers;
+
   while (std::getline(in, line)) {
     if (line.empty())
       continue;
@@ -133,12 +181,28 @@ trial<nothing> run(config const& cfg) {
       else
         ++p;
 
-    if (numeric)
+    if (static_filter && numeric)
+      numbers.push_back(std::strtod(line.c_str(), nullptr));
+    else if (static_filter)
+      lines.push_back(line);
+    else if (numeric)
       bf->add(std::strtod(line.c_str(), nullptr));
     else
       bf->add(line);
   }
 
+  if (static_filter) {
+    std::vector<object> keys;
+    for (auto& x : numbers)
+      keys.push_back(wrap(x));
+    for (auto& x : lines)
+      keys.push_back(wrap(x));
+    if (ribbon)
+      ribbon->build(keys);
+    else if (!fuse->build(keys))
+      return error{"failed to build binary fuse filter"};
+  }
+
   size_t tn = 0, tp = 0, fp = 0, fn = 0;
   size_t ground_truth;
   std::string element;
@@ -1,9 +1,40 @@
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <typeinfo>
+#include <unistd.h>
+
 #include "test.hpp"
 
 #include "bf/all.hpp"
+#include "bf/cpu.hpp"
 
 using namespace bf;
 
+/// Restores a filter from a container and from the legacy serialization,
+/// checks that both copies save the same container, and runs *check* on
+/// each of them.
+template <class F, class Check>
+void check_round_trip(F& x, Check check)
+{
+  auto buf = save(x);
+  std::unique_ptr<bloom_filter> generic;
+  REQUIRE_EQUAL(load(buf.data(), buf.size(), generic), 0);
+  auto copy = dynamic_cast<F*>(generic.get());
+  REQUIRE(copy != nullptr);
+  CHECK(save(*copy) == buf);
+  std::vector<char> legacy(x.serializedSize());
+  CHECK_EQUAL(x.serialize(legacy.data()), legacy.data() + legacy.size());
+  F old;
+  REQUIRE_EQUAL(old.fromBuf(legacy.data(), legacy.size()), 0);
+  CHECK(save(old) == buf);
+  check(*copy);
+  check(old);
+}
+
 TEST(counter_vector_incrementing_width2) {
   counter_vector v(3, 2);
   // Increment 1/3
@@ -144,6 +175,223 @@ TEST(counter_vector_mergin) {
   CHECK_EQUAL(to_string(a | b), "1001111100");
 }
 
+TEST(counter_vector_widths) {
+  // Compare against plain integers, for widths that divide the block size
+  // and widths whose counters straddle blocks.
+  for (size_t width : {1, 2, 3, 4, 5, 7, 8, 13, 16, 31, 32, 64}) {
+    size_t const cells = 100;
+    counter_vector a(cells, width), b(cells, width);
+    std::vector<size_t> x(cells), y(cells);
+    std::minstd_rand prng(width);
+    for (size_t i = 0; i < 4 * cells; ++i) {
+      auto cell = prng() % cells;
+      size_t value = prng() % 5 + 1;
+      if (prng() % 3 == 0) {
+        auto ok = a.decrement(cell, value);
+        REQUIRE_EQUAL(ok, x[cell] >= value);
+        x[cell] = ok ? x[cell] - value : 0;
+      } else {
+        auto ok = a.increment(cell, value);
+        REQUIRE_EQUAL(ok, value <= a.max() - x[cell]);
+        x[cell] = ok ? x[cell] + value : a.max();
+      }
+      cell = prng() % cells;
+      y[cell] = std::min(y[cell] + value, b.max());
+      b.increment(cell, value);
+    }
+    for (size_t i = 0; i < cells; ++i) {
+      REQUIRE_EQUAL(a.count(i), x[i]);
+      REQUIRE_EQUAL(b.count(i), y[i]);
+    }
+    a |= b;
+    for (size_t i = 0; i < cells; ++i) {
+      size_t sum = std::min(x[i] + y[i], a.max());
+      REQUIRE_EQUAL(a.count(i), sum);
+    }
+  }
+}
+
+TEST(counter_vector_atomic) {
+  // Atomic updates saturate exactly like their sequential counterparts.
+  for (size_t width : {1, 2, 4, 8, 16, 32, 64}) {
+    size_t const cells = 100;
+    counter_vector a(cells, width), b(cells, width);
+    std::minstd_rand prng(width);
+    for (size_t i = 0; i < 4 * cells; ++i) {
+      auto cell = prng() % cells;
+      size_t value = prng() % 5 + 1;
+      if (prng() % 3 == 0)
+        REQUIRE_EQUAL(a.decrement_atomic(cell, value),
+                      b.decrement(cell, value));
+      else
+        REQUIRE_EQUAL(a.increment_atomic(cell, value),
+                      b.increment(cell, value));
+    }
+    for (size_t i = 0; i < cells; ++i) {
+      REQUIRE_EQUAL(a.count_atomic(i), b.count(i));
+      REQUIRE_EQUAL(a.count(i), b.count(i));
+    }
+    a.clear_atomic();
+    for (size_t i = 0; i < cells; ++i)
+      REQUIRE_EQUAL(a.count(i), 0u);
+  }
+}
+
+TEST(counter_vector_lanewise) {
+  auto features = cpu;
+  for (auto avx2 : {false, true}) {
+    cpu.avx2 = avx2 && features.avx2;
+    for (size_t width : {1, 3, 4, 8, 16, 32}) {
+      size_t const cells = 100;
+      counter_vector a(cells, width), b(cells, width);
+      std::minstd_rand prng(width);
+      for (size_t i = 0; i < cells; ++i) {
+        a.set(i, prng() % (a.max() < 20 ? a.max() + 1 : 20));
+        b.set(i, prng() % (b.max() < 20 ? b.max() + 1 : 20));
+      }
+      auto sum = a, difference = a, lower = a, upper = a;
+      sum.add(b);
+      difference.subtract(b);
+      lower.minimum(b);
+      upper.maximum(b);
+      for (size_t i = 0; i < cells; ++i) {
+        auto x = a.count(i), y = b.count(i);
+        REQUIRE_EQUAL(sum.count(i), x + y > a.max() ? a.max() : x + y);
+        REQUIRE_EQUAL(difference.count(i), x > y ? x - y : 0);
+        REQUIRE_EQUAL(lower.count(i), x < y ? x : y);
+        REQUIRE_EQUAL(upper.count(i), x < y ? y : x);
+      }
+    }
+  }
+  cpu = features;
+}
+
+TEST(bitvector_merge) {
+  // Sizes below one chunk, around cache line boundaries, and large enough
+  // to split across threads.
+  for (size_t size : {0, 1, 64 * 8 + 3, 64 * 2048 * 3 + 100, 1000000}) {
+    std::vector<bitvector> xs(5, bitvector(size));
+    std::minstd_rand prng(size);
+    for (auto& x : xs)
+      for (size_t i = 0; i < size; ++i)
+        if (prng() % 2 == 0)
+          x.set(i);
+    std::vector<bitvector const*> others;
+    auto sum = xs[0], product = xs[0];
+    for (size_t i = 1; i < xs.size(); ++i) {
+      others.push_back(&xs[i]);
+      sum |= xs[i];
+      product &= xs[i];
+    }
+    for (size_t threads : {0, 1, 3, 8}) {
+      auto x = xs[0], y = xs[0];
+      x.merge(others, threads);
+      y.intersect(others, threads);
+      REQUIRE_EQUAL(x, sum);
+      REQUIRE_EQUAL(y, product);
+    }
+  }
+}
+
+TEST(bitvector_popcount) {
+  auto features = cpu;
+  for (auto level : {0, 1, 2}) {
+    cpu.popcnt = level >= 1 && features.popcnt;
+    cpu.avx2 = level >= 2 && features.avx2;
+    // Sizes around the 16-vector unroll of the AVX2 kernel and odd tails.
+    for (size_t size : {0, 1, 63, 64, 65, 1000, 4096, 4096 + 64 * 3 + 5,
+                        70000}) {
+      bitvector x(size), y(size);
+      std::minstd_rand prng(size);
+      size_t expected = 0;
+      for (size_t i = 0; i < size; ++i) {
+        if (prng() % 3 == 0) {
+          x.set(i);
+          ++expected;
+        }
+        if (prng() % 2 == 0)
+          y.set(i);
+      }
+      REQUIRE_EQUAL(x.count(), expected);
+      REQUIRE_EQUAL(count_and(x, y), (x & y).count());
+      REQUIRE_EQUAL(count_or(x, y), (x | y).count());
+      REQUIRE_EQUAL(count_xor(x, y), (x ^ y).count());
+      size_t both = 0, either = 0, one = 0, only = 0;
+      for (size_t i = 0; i < size; ++i) {
+        both += x[i] && y[i];
+        either += x[i] || y[i];
+        one += x[i] != y[i];
+        only += x[i] && !y[i];
+      }
+      REQUIRE_EQUAL((x & y).count(), both);
+      REQUIRE_EQUAL((x | y).count(), either);
+      REQUIRE_EQUAL((x ^ y).count(), one);
+      REQUIRE_EQUAL((x - y).count(), only);
+    }
+  }
+  cpu = features;
+}
+
+TEST(hasher_digest_buffer) {
+  auto h = make_hasher(5);
+  digest_buffer d;
+  (*h)(wrap("foo"), d);
+  CHECK_EQUAL(d.size(), 5u);
+  auto v = (*h)(wrap("foo"));
+  REQUIRE_EQUAL(v.size(), 5u);
+  for (size_t i = 0; i < v.size(); ++i)
+    CHECK_EQUAL(d[i], v[i]);
+  // More digests than fit inline spill over to the heap.
+  auto big = make_hasher(digest_buffer::inline_size + 4);
+  (*big)(wrap("foo"), d);
+  CHECK_EQUAL(d.size(), digest_buffer::inline_size + 4);
+  CHECK_EQUAL(d[0], v[0]);
+}
+
+TEST(hasher_wyhash) {
+  wy_hasher h(4, 42);
+  CHECK_EQUAL(h.k(), 4u);
+  // Keys of any length hash, and different lengths give different digests.
+  std::string url = "https://example.com/a/rather/long/path?with=a&query=string";
+  REQUIRE(url.size() > default_hash_function::max_obj_size);
+  auto d = h(wrap(url));
+  REQUIRE_EQUAL(d.size(), 4u);
+  CHECK(d[0] != d[1]);
+  CHECK(d[0] != h(wrap(url.substr(0, url.size() - 1)))[0]);
+  CHECK(h(wrap(""))[0] != wy_hasher(4, 43)(wrap(""))[0]);
+  // Only k and the seed get serialized.
+  std::vector<char> buf(h.serializedSize());
+  CHECK(h.serialize(buf.data()) == buf.data() + buf.size());
+  auto copy = hasher_factory::createHasher(buf.data());
+  REQUIRE(copy != nullptr);
+  REQUIRE_EQUAL(copy->fromBuf(buf.data(), buf.size()), 0);
+  CHECK((*copy)(wrap(url)) == d);
+  // Filters accept long keys with this hasher.
+  basic_bloom_filter bf(std::make_shared<wy_hasher>(3, 0), 1000);
+  bf.add(url);
+  CHECK_EQUAL(bf.lookup(url), 1u);
+}
+
+TEST(hasher_enhanced_double) {
+  enhanced_double_hasher h(6, 7);
+  std::string url = "https://example.com/a/rather/long/path?with=a&query=string";
+  auto d = h(wrap(url));
+  REQUIRE_EQUAL(d.size(), 6u);
+  uint64_t h1, h2;
+  wyhash::hash128(url.data(), url.size(), 7, h1, h2);
+  for (uint64_t i = 0; i < d.size(); ++i)
+    CHECK_EQUAL(d[i], h1 + i * h2 + (i * i * i - i) / 6);
+  std::vector<char> buf(h.serializedSize());
+  CHECK(h.serialize(buf.data()) == buf.data() + buf.size());
+  auto copy = hasher_factory::createHasher(buf.data());
+  REQUIRE(copy != nullptr);
+  REQUIRE_EQUAL(copy->fromBuf(buf.data(), buf.size()), 0);
+  CHECK((*copy)(wrap(url)) == d);
+  // make_hasher picks the hasher by the double hashing option.
+  CHECK(std::dynamic_pointer_cast<enhanced_double_hasher>(make_hasher(3)));
+  CHECK(std::dynamic_pointer_cast<ap_hasher>(make_hasher(3, 0, false)));
+}
+
 TEST(bloom_filter_basic) {
   basic_bloom_filter bf(0.8, 10);
   bf.add("foo");
@@ -160,12 +408,13 @@ TEST(bloom_filter_basic) {
   CHECK_EQUAL(bf.lookup('c'), 1u);
   CHECK_EQUAL(bf.lookup(4711ULL), 1u);
   // True-negatives
-  CHECK_EQUAL(bf.lookup("qux"), 0u);
-  CHECK_EQUAL(bf.lookup("graunt"), 0u);
-  CHECK_EQUAL(bf.lookup(3.1415), 0u);
+  CHECK_EQUAL(bf.lookup("waldo"), 0u);
+  CHECK_EQUAL(bf.lookup('a'), 0u);
+  CHECK_EQUAL(bf.lookup(42), 0u);
   // False-positives
+  CHECK_EQUAL(bf.lookup("qux"), 1u);
   CHECK_EQUAL(bf.lookup("corge"), 1u);
-  CHECK_EQUAL(bf.lookup('a'), 1u);
+  CHECK_EQUAL(bf.lookup(3.1415), 1u);
 
   // another filter
   basic_bloom_filter obf(0.8, 10);
@@ -174,13 +423,802 @@ TEST(bloom_filter_basic) {
   CHECK_EQUAL(obf.lookup("foo"), 1u);
 
   // Make bf using another filter's storage
-  hasher h = obf.hasher_function();
+  auto h = obf.hasher_function();
   bitvector b = obf.storage();
   basic_bloom_filter obfc(h, b);
   CHECK_EQUAL(obfc.storage(), b);
   CHECK_EQUAL(obfc.lookup("foo"), 1u);
 }
 
+TEST(bitvector_view) {
+  bitvector b(200);
+  b.set(3);
+  b.set(150);
+  std::vector<char> buf(b.serializedSize() + sizeof(bitvector::block_type));
+  // Place the blocks at an aligned address behind the 4-byte size field.
+  auto aligned = buf.data() + sizeof(bitvector::block_type) - 4;
+  b.serialize(aligned);
+  bitvector v;
+  REQUIRE_EQUAL(v.viewBuf(aligned, b.serializedSize(), nullptr), 0);
+  CHECK(v.is_view());
+  auto const& cv = v;
+  CHECK(cv.data()
+        == reinterpret_cast<bitvector::block_type const*>(aligned + 4));
+  CHECK_EQUAL(v, b);
+  CHECK_EQUAL(v.count(), 2u);
+  CHECK_EQUAL(v.find_next(3), 150u);
+  // Copies share the viewed blocks, modifications copy them.
+  auto w = v;
+  CHECK(w.is_view());
+  w.set(4);
+  CHECK(!w.is_view());
+  CHECK_EQUAL(w.count(), 3u);
+  CHECK_EQUAL(v.count(), 2u);
+  // Unaligned blocks get copied.
+  b.serialize(aligned + 1);
+  bitvector u;
+  REQUIRE_EQUAL(u.viewBuf(aligned + 1, b.serializedSize(), nullptr), 0);
+  CHECK(!u.is_view());
+  CHECK_EQUAL(u, b);
+  CHECK(u.viewBuf(aligned, b.serializedSize() - 1, nullptr) != 0);
+}
+
+TEST(bloom_filter_mapped) {
+  basic_bloom_filter bf(0.01, 1000);
+  for (int i = 0; i < 1000; ++i)
+    bf.add(i);
+  std::vector<char> buf(bf.serializedSize());
+  bf.serialize(buf.data());
+  char path[] = "/tmp/bf-test-XXXXXX";
+  auto fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  REQUIRE(write(fd, buf.data(), buf.size()) == ssize_t(buf.size()));
+  close(fd);
+  auto file = mapped_file::open(path);
+  unlink(path);
+  REQUIRE(file != nullptr);
+  REQUIRE_EQUAL(file->size(), buf.size());
+  basic_bloom_filter mapped;
+  REQUIRE_EQUAL(mapped.viewBuf(file->data(), file->size(), file), 0);
+  // The mapping outlives the handle.
+  file.reset();
+  CHECK_EQUAL(mapped.storage(), bf.storage());
+  for (int i = 0; i < 2000; ++i)
+    REQUIRE_EQUAL(mapped.lookup(i), bf.lookup(i));
+  mapped.add(4711);
+  CHECK(!mapped.storage().is_view());
+  CHECK_EQUAL(mapped.lookup(4711), 1u);
+  CHECK(mapped_file::open("/nonexistent/filter") == nullptr);
+}
+
+TEST(bloom_filter_fast_range) {
+  CHECK_EQUAL(map_index(~digest(0), 10, index_mapping::fast_range), 9u);
+  CHECK_EQUAL(map_index(digest(1) << 63, 10, index_mapping::fast_range), 5u);
+  CHECK_EQUAL(map_index(42, 10, index_mapping::modulo), 2u);
+
+  basic_bloom_filter bf(make_hasher(3), 1000, false, index_mapping::fast_range);
+  CHECK(bf.mapping() == index_mapping::fast_range);
+  for (int i = 0; i < 100; ++i)
+    bf.add(i);
+  for (int i = 0; i < 100; ++i)
+    REQUIRE_EQUAL(bf.lookup(i), 1u);
+  std::vector<char> buf(bf.serializedSize());
+  CHECK(bf.serialize(buf.data()) == buf.data() + buf.size());
+  basic_bloom_filter copy;
+  REQUIRE_EQUAL(copy.fromBuf(buf.data(), buf.size()), 0);
+  CHECK(copy.mapping() == index_mapping::fast_range);
+  for (int i = 0; i < 100; ++i)
+    REQUIRE_EQUAL(copy.lookup(i), 1u);
+
+  // Modulo filters serialize as before and load with modulo mapping.
+  basic_bloom_filter modulo(make_hasher(3), 1000, false);
+  modulo.add(42);
+  buf.resize(modulo.serializedSize());
+  CHECK_EQUAL(buf.size() + 1, bf.serializedSize());
+  modulo.serialize(buf.data());
+  REQUIRE_EQUAL(copy.fromBuf(buf.data(), buf.size()), 0);
+  CHECK(copy.mapping() == index_mapping::modulo);
+  CHECK_EQUAL(copy.lookup(42), 1u);
+
+  counting_bloom_filter cbf(make_hasher(3), 999, 4, true,
+                            index_mapping::fast_range);
+  cbf.add(42);
+  cbf.add(42);
+  buf.resize(cbf.serializedSize());
+  cbf.serialize(buf.data());
+  counting_bloom_filter ccopy;
+  REQUIRE_EQUAL(ccopy.fromBuf(buf.data(), buf.size()), 0);
+  CHECK(ccopy.mapping() == index_mapping::fast_range);
+  CHECK_EQUAL(ccopy.lookup(42), 2u);
+}
+
+TEST(bloom_filter_blocked) {
+  // The blocking penalty requires more cells than a basic Bloom filter.
+  auto cells = blocked_bloom_filter::m(0.01, 1000);
+  CHECK(cells % blocked_bloom_filter::block_bits == 0);
+  CHECK(cells > basic_bloom_filter::m(0.01, 1000));
+  auto k = blocked_bloom_filter::k(cells, 1000);
+  CHECK(blocked_bloom_filter::fp(cells, 1000, k) <= 0.01);
+
+  blocked_bloom_filter bf(0.01, 1000);
+  CHECK_EQUAL(bf.storage().size(), cells);
+  for (int i = 0; i < 1000; ++i)
+    bf.add(i);
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE_EQUAL(bf.lookup(i), 1u);
+  size_t fps = 0;
+  for (int i = 1000; i < 11000; ++i)
+    fps += bf.lookup(i);
+  CHECK(fps < 200);
+
+  std::vector<char> buf(bf.serializedSize());
+  CHECK(bf.serialize(buf.data()) == buf.data() + buf.size());
+  blocked_bloom_filter copy;
+  REQUIRE_EQUAL(copy.fromBuf(buf.data(), buf.size()), 0);
+  CHECK_EQUAL(copy.storage(), bf.storage());
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE_EQUAL(copy.lookup(i), 1u);
+  bf.clear();
+  CHECK_EQUAL(bf.lookup(42), 0u);
+}
+
+TEST(bloom_filter_split_block) {
+  auto cells = split_block_bloom_filter::m(0.01, 1000);
+  CHECK(cells % split_block_bloom_filter::block_bits == 0);
+  CHECK(split_block_bloom_filter::fp(cells, 1000) <= 0.01);
+
+  split_block_bloom_filter bf(0.01, 1000);
+  CHECK_EQUAL(bf.size(), cells);
+  for (int i = 0; i < 1000; ++i)
+    bf.add(i);
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE_EQUAL(bf.lookup(i), 1u);
+  size_t fps = 0;
+  for (int i = 1000; i < 11000; ++i)
+    fps += bf.lookup(i);
+  CHECK(fps < 200);
+
+  // The scalar fallback sees the same bits as the vectorized code.
+  auto features = cpu;
+  cpu.avx2 = false;
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE_EQUAL(bf.lookup(i), 1u);
+  size_t scalar_fps = 0;
+  for (int i = 1000; i < 11000; ++i)
+    scalar_fps += bf.lookup(i);
+  CHECK_EQUAL(scalar_fps, fps);
+  cpu = features;
+
+  std::vector<char> buf(bf.serializedSize());
+  CHECK(bf.serialize(buf.data()) == buf.data() + buf.size());
+  split_block_bloom_filter copy;
+  REQUIRE_EQUAL(copy.fromBuf(buf.data(), buf.size()), 0);
+  CHECK_EQUAL(copy.size(), bf.size());
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE_EQUAL(copy.lookup(i), 1u);
+  bf.clear();
+  CHECK_EQUAL(bf.lookup(42), 0u);
+}
+
+TEST(bloom_filter_concurrent) {
+  size_t const threads = 8;
+  size_t const n = 20000;
+  concurrent_bloom_filter bf(make_hasher(5), 100000);
+  basic_bloom_filter expected(make_hasher(5), 100000);
+  for (size_t i = 0; i < n; ++i)
+    expected.add(i);
+  std::atomic<size_t> lost{0};
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t)
+    workers.emplace_back([&, t] {
+      std::vector<object> keys;
+      std::vector<size_t> values;
+      for (auto i = t; i < n; i += threads)
+        values.push_back(i);
+      // Half of the threads add one by one, the others in batches.
+      if (t % 2 == 0) {
+        for (auto& v : values)
+          bf.add(v);
+      } else {
+        for (auto& v : values)
+          keys.push_back(wrap(v));
+        bf.add_many(keys);
+      }
+      // Lookups run concurrently with the insertions of other threads.
+      for (auto& v : values)
+        if (bf.lookup(v) != 1)
+          ++lost;
+    });
+  for (auto& w : workers)
+    w.join();
+  CHECK_EQUAL(lost.load(), 0u);
+  CHECK_EQUAL(bf.storage(), expected.storage());
+  std::vector<object> keys;
+  std::vector<size_t> values(2 * n);
+  for (size_t i = 0; i < values.size(); ++i)
+    values[i] = i;
+  for (auto& v : values)
+    keys.push_back(wrap(v));
+  std::vector<size_t> counts(keys.size());
+  bf.lookup_many(keys, counts);
+  for (size_t i = 0; i < keys.size(); ++i)
+    REQUIRE_EQUAL(counts[i], expected.lookup(values[i]));
+  // The serialization is that of a basic Bloom filter.
+  auto buf = save(bf);
+  concurrent_bloom_filter copy;
+  container_reader r;
+  REQUIRE_EQUAL(r.open(buf.data(), buf.size()), 0);
+  REQUIRE_EQUAL(copy.read(r), 0);
+  CHECK_EQUAL(copy.storage(), expected.storage());
+  bf.clear();
+  CHECK_EQUAL(bf.storage().count(), 0u);
+}
+
+TEST(bloom_filter_concurrent_counting) {
+  size_t const threads = 8;
+  size_t const n = 20000;
+  // Few cells of 4 bits make threads contend for blocks and saturate some
+  // counters.
+  concurrent_counting_bloom_filter bf(make_hasher(3), 4096, 4);
+  counting_bloom_filter expected(make_hasher(3), 4096, 4);
+  for (size_t i = 0; i < n; ++i)
+    expected.add(i % 7000);
+  for (size_t i = 0; i < n; i += 3)
+    expected.remove(i % 7000);
+  std::atomic<size_t> lost{0};
+  auto run = [&](bool remove) {
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+      workers.emplace_back([&, t] {
+        std::vector<object> keys;
+        std::vector<size_t> values;
+        for (auto i = t; i < n; i += threads)
+          if (!remove || i % 3 == 0)
+            values.push_back(i % 7000);
+        if (remove) {
+          // Removal stays atomic through a reference to the base class.
+          counting_bloom_filter& base = bf;
+          for (auto& v : values)
+            base.remove(v);
+        } else if (t % 2 == 0) {
+          for (auto& v : values) {
+            bf.add(v);
+            if (bf.lookup(v) == 0)
+              ++lost;
+          }
+        } else {
+          for (auto& v : values)
+            keys.push_back(wrap(v));
+          bf.add_many(keys);
+        }
+      });
+    for (auto& w : workers)
+      w.join();
+  };
+  // Saturating increments commute, and so do saturating decrements, so
+  // each phase ends in the state of the sequential filter.
+  run(false);
+  CHECK_EQUAL(lost.load(), 0u);
+  run(true);
+  std::vector<object> keys;
+  std::vector<size_t> values(10000);
+  for (size_t i = 0; i < values.size(); ++i)
+    values[i] = i;
+  for (auto& v : values)
+    keys.push_back(wrap(v));
+  std::vector<size_t> counts(keys.size());
+  bf.lookup_many(keys, counts);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    REQUIRE_EQUAL(counts[i], expected.lookup(values[i]));
+    REQUIRE_EQUAL(bf.lookup(values[i]), counts[i]);
+  }
+  // The serialization is that of a counting Bloom filter.
+  auto buf = save(bf);
+  concurrent_counting_bloom_filter copy;
+  container_reader r;
+  REQUIRE_EQUAL(r.open(buf.data(), buf.size()), 0);
+  REQUIRE_EQUAL(copy.read(r), 0);
+  for (size_t i = 0; i < 100; ++i)
+    CHECK_EQUAL(copy.lookup(i), expected.lookup(i));
+  bf.clear();
+  for (size_t i = 0; i < 100; ++i)
+    CHECK_EQUAL(bf.lookup(i), 0u);
+  // Counters must not straddle words, neither in new nor in loaded filters.
+  counting_bloom_filter narrow(make_hasher(1), 100, 3);
+  std::vector<char> legacy(narrow.serializedSize());
+  narrow.serialize(legacy.data());
+  CHECK(copy.fromBuf(legacy.data(), legacy.size()) != 0);
+  buf = save(narrow);
+  REQUIRE_EQUAL(r.open(buf.data(), buf.size()), 0);
+  CHECK(copy.read(r) != 0);
+  auto straddles = false;
+  try {
+    concurrent_counting_bloom_filter bad(make_hasher(3), 4096, 3);
+  } catch (std::invalid_argument const&) {
+    straddles = true;
+  }
+  CHECK(straddles);
+}
+
+TEST(bloom_filter_sharded) {
+  size_t const threads = 8;
+  size_t const n = 20000;
+  sharded_bloom_filter<basic_bloom_filter> bf(4, make_hasher(5), 50000);
+  REQUIRE_EQUAL(bf.shards(), 4u);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t)
+    workers.emplace_back([&, t] {
+      std::vector<object> keys;
+      std::vector<size_t> values;
+      for (auto i = t; i < n; i += threads)
+        values.push_back(i);
+      if (t % 2 == 0) {
+        for (auto& v : values)
+          bf.add(v);
+      } else {
+        for (auto& v : values)
+          keys.push_back(wrap(v));
+        bf.add_many(keys);
+      }
+    });
+  for (auto& w : workers)
+    w.join();
+  // Each element lives in the shard that shard_of() selects.
+  size_t adds = 0;
+  for (size_t i = 0; i < bf.shards(); ++i) {
+    auto stats = bf.stats(i);
+    CHECK(stats.adds > n / bf.shards() / 2);
+    adds += stats.adds;
+  }
+  CHECK_EQUAL(adds, n);
+  std::vector<object> keys;
+  std::vector<size_t> values(n);
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = i;
+    REQUIRE_EQUAL(bf.shard(bf.shard_of(i)).lookup(i), 1u);
+  }
+  for (auto& v : values)
+    keys.push_back(wrap(v));
+  std::vector<size_t> counts(keys.size());
+  bf.lookup_many(keys, counts);
+  for (size_t i = 0; i < keys.size(); ++i)
+    REQUIRE_EQUAL(counts[i], 1u);
+  size_t lookups = 0, positives = 0;
+  for (size_t i = 0; i < bf.shards(); ++i) {
+    lookups += bf.stats(i).lookups;
+    positives += bf.stats(i).positives;
+  }
+  CHECK_EQUAL(lookups, n);
+  CHECK_EQUAL(positives, n);
+  // The container nests the shards.
+  auto buf = save(bf);
+  sharded_bloom_filter<basic_bloom_filter> copy;
+  container_reader r;
+  REQUIRE_EQUAL(r.open(buf.data(), buf.size()), 0);
+  REQUIRE_EQUAL(copy.read(r), 0);
+  REQUIRE_EQUAL(copy.shards(), bf.shards());
+  for (size_t i = 0; i < bf.shards(); ++i)
+    CHECK_EQUAL(copy.shard(i).storage(), bf.shard(i).storage());
+  std::unique_ptr<bloom_filter> generic;
+  CHECK(load(buf.data(), buf.size(), generic) != 0);
+  // Shards are saved and rebuilt independently.
+  auto parts = bf.save_shards();
+  REQUIRE_EQUAL(parts.size(), bf.shards());
+  bf.clear(1);
+  CHECK_EQUAL(bf.shard(1).storage().count(), 0u);
+  CHECK_EQUAL(bf.stats(1).adds, 0u);
+  CHECK(bf.shard(0).storage().count() > 0);
+  REQUIRE_EQUAL(bf.load_shard(1, parts[1].data(), parts[1].size()), 0);
+  CHECK_EQUAL(bf.shard(1).storage(), copy.shard(1).storage());
+  CHECK(bf.load_shard(1, parts[1].data(), parts[1].size() / 2) != 0);
+  // The legacy serialization concatenates the shards.
+  std::vector<char> legacy(bf.serializedSize());
+  CHECK_EQUAL(bf.serialize(legacy.data()), legacy.data() + legacy.size());
+  sharded_bloom_filter<basic_bloom_filter> old(4, make_hasher(5), 50000);
+  REQUIRE_EQUAL(old.fromBuf(legacy.data(), legacy.size()), 0);
+  for (size_t i = 0; i < bf.shards(); ++i)
+    CHECK_EQUAL(old.shard(i).storage(), bf.shard(i).storage());
+  bf.clear();
+  for (size_t i = 0; i < bf.shards(); ++i)
+    CHECK_EQUAL(bf.shard(i).storage().count(), 0u);
+}
+
+TEST(bloom_filter_sharded_routing) {
+  // Routing must not correlate with the digests of the inner hasher, even one
+  // that starts from seed 0: a shard then behaves like a standalone filter
+  // holding its share of the elements.
+  auto h = std::make_shared<wy_hasher>(3, 0);
+  auto fast = index_mapping::fast_range;
+  sharded_bloom_filter<basic_bloom_filter> bf(4, h, 8000, false, fast);
+  basic_bloom_filter single(h, 8000, false, fast);
+  size_t const n = 8000;
+  for (size_t i = 0; i < n; ++i) {
+    bf.add(i);
+    if (i % 4 == 0)
+      single.add(i);
+  }
+  size_t sharded_fp = 0, single_fp = 0;
+  for (size_t i = n; i < n + 100000; ++i) {
+    sharded_fp += bf.lookup(i);
+    single_fp += single.lookup(i);
+  }
+  CHECK(sharded_fp < single_fp * 6 / 5);
+}
+
+TEST(bloom_filter_scalable) {
+  scalable_bloom_filter bf(0.01, 1000);
+  CHECK_EQUAL(bf.stages(), 1u);
+  for (size_t i = 0; i < 100000; ++i)
+    bf.add(i);
+  // Stages of 1000, 2000, 4000, ... elements hold 100000 after 7 steps.
+  CHECK(bf.stages() >= 7 && bf.stages() <= 8);
+  for (size_t i = 1; i < bf.stages(); ++i)
+    CHECK(bf.stage(i).storage().size() > bf.stage(i - 1).storage().size());
+  for (size_t i = 0; i < 100000; ++i)
+    REQUIRE_EQUAL(bf.lookup(i), 1u);
+  auto elements = bf.elements();
+  CHECK(elements > 99000 && elements <= 100000);
+  // Known elements do not fill the newest stage.
+  for (size_t i = 0; i < 10000; ++i)
+    bf.add(i);
+  CHECK_EQUAL(bf.elements(), elements);
+  // The false-positive rate stays below the bound however large the filter
+  // grows.
+  CHECK(bf.fpr_bound() < 0.01);
+  size_t positives = 0;
+  for (size_t i = 1000000; i < 1200000; ++i)
+    positives += bf.lookup(i);
+  CHECK(positives / 200000.0 < bf.fpr_bound());
+  check_round_trip(bf, [&](scalable_bloom_filter& copy) {
+    CHECK_EQUAL(copy.stages(), bf.stages());
+    CHECK_EQUAL(copy.elements(), bf.elements());
+    for (size_t i = 0; i < 1000; ++i)
+      REQUIRE_EQUAL(copy.lookup(i), 1u);
+    copy.add(1000001);
+    CHECK_EQUAL(copy.lookup(1000001), 1u);
+  });
+  // Stages with another hasher or seed would hash differently than the
+  // digests that all stages share.
+  scalable_bloom_filter small(0.01, 1000, 2, 0.85, 42);
+  auto small_buf = save(small);
+  container_reader r;
+  REQUIRE_EQUAL(r.open(small_buf.data(), small_buf.size()), 0);
+  std::vector<uint64_t> params;
+  REQUIRE_EQUAL(r.parameters(filter_type::scalable, params), 0);
+  auto k = small.stage(0).hasher_function()->k();
+  auto cells = small.stage(0).storage().size();
+  for (auto h : {make_hasher(k, 42, false),
+                 std::shared_ptr<base_hasher>(
+                   std::make_shared<enhanced_double_hasher>(k, 43))}) {
+    basic_bloom_filter stage(h, cells, true, index_mapping::fast_range);
+    container_writer w;
+    w.parameters(filter_type::scalable, params);
+    stage.write(w);
+    std::vector<char> foreign(w.size());
+    w.write(foreign.data());
+    REQUIRE_EQUAL(r.open(foreign.data(), foreign.size()), 0);
+    scalable_bloom_filter rejected;
+    CHECK(rejected.read(r) != 0);
+  }
+  bf.clear();
+  CHECK_EQUAL(bf.stages(), 1u);
+  CHECK_EQUAL(bf.elements(), 0u);
+  CHECK_EQUAL(bf.lookup(0), 0u);
+}
+
+TEST(cuckoo_filter) {
+  for (size_t bits : {8, 16}) {
+    size_t const n = 100000;
+    cuckoo_filter cf(make_hasher(1), n, bits);
+    REQUIRE_EQUAL(cf.fingerprint_bits(), bits);
+    REQUIRE(cf.capacity() >= n);
+    for (size_t i = 0; i < n; ++i)
+      REQUIRE(cf.insert(i));
+    CHECK(!cf.full());
+    CHECK_EQUAL(cf.size(), n);
+    for (size_t i = 0; i < n; ++i)
+      REQUIRE_EQUAL(cf.lookup(i), 1u);
+    size_t positives = 0;
+    for (size_t i = n; i < 3 * n; ++i)
+      positives += cf.lookup(i);
+    auto fpr = positives / (2.0 * n);
+    CHECK(fpr < 8.0 / (1 << bits) * 1.5);
+    // Removed elements disappear except for false positives, and the
+    // others stay.
+    for (size_t i = 0; i < n; i += 2)
+      REQUIRE(cf.remove(i));
+    CHECK_EQUAL(cf.size(), n / 2);
+    positives = 0;
+    for (size_t i = 0; i < n; ++i)
+      if (i % 2 == 1)
+        REQUIRE_EQUAL(cf.lookup(i), 1u);
+      else
+        positives += cf.lookup(i);
+    CHECK(positives / (n / 2.0) < 8.0 / (1 << bits) * 1.5);
+    // Copies count separately.
+    cf.add("foo");
+    cf.add("foo");
+    CHECK(cf.remove("foo"));
+    CHECK_EQUAL(cf.lookup("foo"), 1u);
+    CHECK(cf.remove("foo"));
+    check_round_trip(cf, [&](cuckoo_filter const& copy) {
+      CHECK_EQUAL(copy.size(), cf.size());
+      for (size_t i = 0; i < n; ++i)
+        REQUIRE_EQUAL(copy.lookup(i), cf.lookup(i));
+    });
+    cf.clear();
+    CHECK_EQUAL(cf.size(), 0u);
+    CHECK_EQUAL(cf.lookup(1), 0u);
+  }
+  // A full filter keeps the last fingerprint that found no slot aside, so
+  // that no element goes missing, and rejects further insertions.
+  cuckoo_filter small(make_hasher(1), 16, 8);
+  size_t inserted = 0;
+  while (small.insert(inserted))
+    ++inserted;
+  CHECK(small.full());
+  CHECK_EQUAL(small.size(), inserted);
+  CHECK(inserted >= small.capacity() * 3 / 4);
+  for (size_t i = 0; i < inserted; ++i)
+    REQUIRE_EQUAL(small.lookup(i), 1u);
+  // Adding through the generic interface fails instead of losing the key.
+  bloom_filter& generic = small;
+  auto thrown = false;
+  try {
+    generic.add(inserted);
+  } catch (std::length_error const&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  CHECK_EQUAL(small.size(), inserted);
+  for (size_t i = 0; i < inserted; i += 2)
+    REQUIRE(small.remove(i));
+  CHECK(!small.full());
+  for (size_t i = 1; i < inserted; i += 2)
+    REQUIRE_EQUAL(small.lookup(i), 1u);
+  // The desired false-positive probability selects the fingerprint width.
+  CHECK_EQUAL(cuckoo_filter(0.05, 1000).fingerprint_bits(), 8u);
+  CHECK_EQUAL(cuckoo_filter(0.001, 1000).fingerprint_bits(), 16u);
+}
+
+TEST(quotient_filter) {
+  typedef std::map<uint64_t, size_t> counts;
+  auto contents = [](quotient_filter const& qf) {
+    counts result;
+    uint64_t last = 0;
+    qf.enumerate([&](uint64_t fp, size_t count) {
+      CHECK(result.empty() || fp > last);
+      last = fp;
+      result[fp] = count;
+    });
+    return result;
+  };
+  auto h = make_hasher(1);
+  // Two-bit remainders make counts spill into several digits.
+  quotient_filter qf(h, 8, 2);
+  CHECK_EQUAL(qf.capacity(), 256u);
+  counts expected;
+  uint64_t x = 42;
+  for (size_t i = 0; i < 20000; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    auto key = (x >> 33) % 300;
+    auto fp = qf.fingerprint(wrap(key));
+    if ((x >> 20) % 3 != 0) {
+      auto n = (x >> 10) % 4 == 0 ? (x >> 40) % 100 + 1 : 1;
+      if (qf.insert(key, n))
+        expected[fp] += n;
+    } else if (qf.remove(key)) {
+      REQUIRE(expected[fp] > 0);
+      if (--expected[fp] == 0)
+        expected.erase(fp);
+    } else {
+      REQUIRE(expected.count(fp) == 0);
+    }
+    if (i % 1000 == 0)
+      REQUIRE(contents(qf) == expected);
+  }
+  REQUIRE(contents(qf) == expected);
+  size_t total = 0;
+  for (auto& p : expected)
+    total += p.second;
+  CHECK_EQUAL(qf.size(), total);
+  CHECK(qf.used() <= qf.capacity() * quotient_filter::max_load);
+  for (size_t key = 0; key < 300; ++key) {
+    auto i = expected.find(qf.fingerprint(wrap(key)));
+    REQUIRE_EQUAL(qf.lookup(key), i == expected.end() ? 0 : i->second);
+  }
+  // Doubling keeps the fingerprints and counts.
+  REQUIRE(qf.resize());
+  CHECK_EQUAL(qf.capacity(), 512u);
+  CHECK_EQUAL(qf.remainder_bits(), 1u);
+  CHECK(contents(qf) == expected);
+  CHECK_EQUAL(qf.size(), total);
+  CHECK(!qf.resize());
+  for (size_t key = 0; key < 300; ++key) {
+    auto i = expected.find(qf.fingerprint(wrap(key)));
+    REQUIRE_EQUAL(qf.lookup(key), i == expected.end() ? 0 : i->second);
+  }
+  // Merging adds up the counts of filters of any size.
+  quotient_filter other(h, 7, 3);
+  size_t added = 0;
+  for (size_t key = 250; key < 270; ++key) {
+    REQUIRE(other.insert(key, key % 50 + 1));
+    added += key % 50 + 1;
+  }
+  auto sum = contents(other);
+  for (auto& p : expected)
+    sum[p.first] += p.second;
+  REQUIRE(qf.merge(other));
+  CHECK(contents(qf) == sum);
+  CHECK_EQUAL(qf.size(), total + added);
+  CHECK(!qf.merge(quotient_filter(make_hasher(1, 1), 6, 4)));
+  CHECK(!qf.merge(quotient_filter(h, 6, 5)));
+  // Two full filters with 3-bit fingerprints exceed the load limit at any
+  // quotient size.
+  quotient_filter tiny(h, 2, 1), more(h, 2, 1);
+  for (size_t key = 0; key < 100; ++key) {
+    tiny.insert(key);
+    more.insert(key + 100);
+  }
+  auto used = tiny.used();
+  CHECK(used + more.used() > quotient_filter::max_load * tiny.capacity());
+  CHECK(!tiny.merge(more));
+  CHECK_EQUAL(tiny.used(), used);
+  check_round_trip(qf, [&](quotient_filter const& copy) {
+    CHECK(contents(copy) == sum);
+    CHECK_EQUAL(copy.size(), qf.size());
+  });
+  qf.clear();
+  CHECK_EQUAL(qf.size(), 0u);
+  CHECK_EQUAL(qf.used(), 0u);
+  CHECK(contents(qf).empty());
+  // A filter at its maximum load rejects insertions and keeps a
+  // false-positive probability of about 0.9 / 2^r.
+  quotient_filter full(0.005, 10000);
+  CHECK_EQUAL(full.remainder_bits(), 8u);
+  size_t n = 0;
+  while (full.insert(n))
+    ++n;
+  CHECK_EQUAL(full.used(), n);
+  CHECK(n >= full.capacity() * quotient_filter::max_load - 1);
+  for (size_t i = 0; i < n; ++i)
+    REQUIRE(full.lookup(i) >= 1);
+  size_t positives = 0;
+  for (size_t i = n; i < n + 100000; ++i)
+    positives += full.lookup(i) > 0;
+  CHECK(positives / 100000.0 < 0.9 / 256 * 1.5);
+  // Adding through the generic interface grows the filter instead.
+  bloom_filter& generic = full;
+  generic.add(n);
+  CHECK_EQUAL(full.remainder_bits(), 7u);
+  CHECK_EQUAL(full.used(), n + 1);
+  for (size_t i = 0; i <= n; ++i)
+    REQUIRE(full.lookup(i) >= 1);
+  // Only a filter that cannot give up another remainder bit fails.
+  quotient_filter last(h, 2, 1);
+  bloom_filter& small = last;
+  auto thrown = false;
+  try {
+    for (size_t key = 0; key < 100; ++key)
+      small.add(key);
+  } catch (std::length_error const&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+TEST(binary_fuse_filter) {
+  for (size_t bits : {8, 16}) {
+    for (size_t n : {0, 1, 10, 1000, 300000}) {
+      std::vector<uint64_t> keys(n);
+      for (size_t i = 0; i < n; ++i)
+        keys[i] = i * 0x9e3779b97f4a7c15ULL;
+      std::vector<object> objects;
+      for (auto& k : keys)
+        objects.push_back(wrap(k));
+      // Duplicates do not keep the filter from building.
+      if (n > 0)
+        objects.push_back(wrap(keys[0]));
+      binary_fuse_filter bff(make_hasher(1), bits);
+      REQUIRE(bff.build(objects, 4));
+      CHECK_EQUAL(bff.size(), n);
+      CHECK_EQUAL(bff.fingerprint_bits(), bits);
+      for (auto k : keys)
+        REQUIRE_EQUAL(bff.lookup(k), 1u);
+      if (n < 1000)
+        continue;
+      // Close to 9 or 18 bits per key for large sets. Small sets need up to
+      // half as many slots more.
+      CHECK(1.0 * bff.slots() / n < (n < 100000 ? 1.5 : 1.2));
+      size_t positives = 0;
+      size_t const queries = 1000000;
+      for (size_t i = 0; i < queries; ++i)
+        positives += bff.lookup(~keys[i % n] + i);
+      CHECK(1.0 * positives / queries < 1.5 / (1 << bits));
+      std::vector<size_t> counts(objects.size());
+      bff.lookup_many(objects, counts);
+      for (auto c : counts)
+        REQUIRE_EQUAL(c, 1u);
+      // Building on one thread yields the same filter.
+      binary_fuse_filter single(make_hasher(1), objects, bits, 1);
+      CHECK(save(single) == save(bff));
+      check_round_trip(bff, [&](binary_fuse_filter const& copy) {
+        for (size_t i = 0; i < n; ++i) {
+          REQUIRE_EQUAL(copy.lookup(keys[i]), 1u);
+          REQUIRE_EQUAL(copy.lookup(~keys[i]), bff.lookup(~keys[i]));
+        }
+      });
+      bff.clear();
+      CHECK_EQUAL(bff.size(), 0u);
+      CHECK_EQUAL(bff.lookup(keys[0]), 0u);
+    }
+  }
+  // Adding through the generic interface fails instead of losing the key.
+  binary_fuse_filter empty(make_hasher(1));
+  bloom_filter& generic = empty;
+  auto thrown = false;
+  try {
+    generic.add(42);
+  } catch (std::logic_error const&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+TEST(ribbon_filter) {
+  for (size_t bits : {1, 7, 16}) {
+    for (size_t n : {0, 1, 10, 1000, 300000}) {
+      std::vector<uint64_t> keys(n);
+      for (size_t i = 0; i < n; ++i)
+        keys[i] = i * 0x9e3779b97f4a7c15ULL;
+      std::vector<object> objects;
+      for (auto& k : keys)
+        objects.push_back(wrap(k));
+      if (n > 0)
+        objects.push_back(wrap(keys[0]));
+      ribbon_filter rf(make_hasher(1), objects, bits);
+      CHECK_EQUAL(rf.size(), n);
+      CHECK_EQUAL(rf.result_bits(), bits);
+      for (auto k : keys)
+        REQUIRE_EQUAL(rf.lookup(k), 1u);
+      if (n < 1000)
+        continue;
+      // A few percent more slots than keys for large sets. Small sets also
+      // pay for the 127 slots after the last start.
+      CHECK(1.0 * rf.slots() / n < (n < 100000 ? 1.25 : 1.05));
+      size_t positives = 0;
+      size_t const queries = 1000000;
+      for (size_t i = 0; i < queries; ++i)
+        positives += rf.lookup(~keys[i % n] + i);
+      auto fp = 1.0 / (size_t(1) << bits);
+      CHECK(1.0 * positives / queries < 1.2 * fp + 0.0001);
+      std::vector<size_t> counts(objects.size());
+      rf.lookup_many(objects, counts);
+      for (auto c : counts)
+        REQUIRE_EQUAL(c, 1u);
+      check_round_trip(rf, [&](ribbon_filter const& copy) {
+        for (size_t i = 0; i < n; ++i) {
+          REQUIRE_EQUAL(copy.lookup(keys[i]), 1u);
+          REQUIRE_EQUAL(copy.lookup(~keys[i]), rf.lookup(~keys[i]));
+        }
+      });
+      rf.clear();
+      CHECK_EQUAL(rf.size(), 0u);
+      CHECK_EQUAL(rf.lookup(keys[0]), 0u);
+    }
+  }
+  // Adding through the generic interface fails instead of losing the key.
+  ribbon_filter empty(make_hasher(1));
+  bloom_filter& generic = empty;
+  auto thrown = false;
+  try {
+    generic.add(42);
+  } catch (std::logic_error const&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
 TEST(bloom_filter_counting) {
   counting_bloom_filter bf(make_hasher(3), 10, 2);
   for (size_t i = 0; i < 3; ++i) {
@@ -199,6 +1237,196 @@ TEST(bloom_filter_counting) {
   CHECK_EQUAL(bf.lookup("corge"), 0u);
 }
 
+TEST(bloom_filter_batched) {
+  // Batches span several rounds of prefetching and end with a partial one.
+  std::vector<uint64_t> keys(3 * bloom_filter::batch_size + 5);
+  for (size_t i = 0; i < keys.size(); ++i)
+    keys[i] = i * 7;
+  std::vector<object> objects;
+  for (auto& k : keys)
+    objects.push_back(wrap(k));
+  auto inserted = span<object const>(objects).subspan(0, keys.size() / 2);
+  std::vector<size_t> counts(objects.size());
+
+  basic_bloom_filter basic(make_hasher(3), 1000);
+  basic_bloom_filter single(make_hasher(3), 1000);
+  basic.add_many(inserted);
+  for (auto& o : inserted)
+    single.add(o);
+  CHECK_EQUAL(basic.storage(), single.storage());
+  basic.lookup_many(objects, counts);
+  for (size_t i = 0; i < objects.size(); ++i)
+    REQUIRE_EQUAL(counts[i], basic.lookup(objects[i]));
+
+  counting_bloom_filter counting(make_hasher(3), 1000, 4);
+  counting.add_many(inserted);
+  counting.add_many(inserted);
+  counting.lookup_many(objects, counts);
+  for (size_t i = 0; i < objects.size(); ++i) {
+    REQUIRE_EQUAL(counts[i], counting.lookup(objects[i]));
+    if (i < inserted.size())
+      REQUIRE(counts[i] >= 2u);
+  }
+
+  // Spectral MI filters keep their insertion policy.
+  spectral_mi_bloom_filter mi(make_hasher(3), 100, 4);
+  spectral_mi_bloom_filter mi_single(make_hasher(3), 100, 4);
+  mi.add_many(inserted);
+  for (auto& o : inserted)
+    mi_single.add(o);
+  for (auto& o : objects)
+    REQUIRE_EQUAL(mi.lookup(o), mi_single.lookup(o));
+}
+
+TEST(bloom_filter_bulk_build) {
+  // More elements than one round of slices takes, so that the rounds reuse
+  // their position buffers.
+  std::vector<uint64_t> keys(300000);
+  for (size_t i = 0; i < keys.size(); ++i)
+    keys[i] = i * 7;
+  std::vector<object> objects;
+  for (auto& k : keys)
+    objects.push_back(wrap(k));
+  for (auto partition : {false, true}) {
+    basic_bloom_filter single(make_hasher(4), 2000000, partition);
+    single.add("foo");
+    for (auto& o : objects)
+      single.add(o);
+    for (size_t threads : {0, 1, 2, 3, 8}) {
+      basic_bloom_filter bulk(make_hasher(4), 2000000, partition);
+      bulk.add("foo");
+      bulk.bulk_build(objects, threads);
+      REQUIRE_EQUAL(bulk.storage(), single.storage());
+    }
+  }
+  // Small inputs and tiny filters fall back to a single thread.
+  basic_bloom_filter small(make_hasher(3), 10);
+  basic_bloom_filter small_single(make_hasher(3), 10);
+  small.bulk_build(span<object const>(objects).subspan(0, 1000), 8);
+  for (size_t i = 0; i < 1000; ++i)
+    small_single.add(objects[i]);
+  CHECK_EQUAL(small.storage(), small_single.storage());
+}
+
+TEST(bloom_filter_merge) {
+  std::vector<std::unique_ptr<basic_bloom_filter>> nodes;
+  std::vector<basic_bloom_filter const*> others;
+  basic_bloom_filter all(make_hasher(3), 1 << 20);
+  for (size_t n = 0; n < 8; ++n) {
+    nodes.emplace_back(new basic_bloom_filter(make_hasher(3), 1 << 20));
+    for (size_t i = 0; i < 1000; ++i) {
+      nodes.back()->add(n * 1000 + i);
+      all.add(n * 1000 + i);
+    }
+    others.push_back(nodes.back().get());
+  }
+  for (size_t threads : {0, 1, 4}) {
+    basic_bloom_filter x(make_hasher(3), 1 << 20);
+    REQUIRE(x.merge(others, threads));
+    CHECK_EQUAL(x.storage(), all.storage());
+    basic_bloom_filter y(make_hasher(3), 1 << 20);
+    REQUIRE(y.merge(*nodes[0], threads));
+    REQUIRE(y.merge(*nodes[1], threads));
+    REQUIRE(y.intersect(*nodes[1], threads));
+    CHECK_EQUAL(y.storage(), nodes[1]->storage());
+    REQUIRE(x.intersect(others, threads));
+    auto common = all.storage();
+    for (auto& node : nodes)
+      common &= node->storage();
+    CHECK_EQUAL(x.storage(), common);
+  }
+  // Filters that map elements to different bits do not combine.
+  basic_bloom_filter x(make_hasher(3), 1 << 20);
+  CHECK(x.compatible(*nodes[0]));
+  CHECK(!x.compatible(basic_bloom_filter(make_hasher(4), 1 << 20)));
+  CHECK(!x.compatible(basic_bloom_filter(make_hasher(3, 1), 1 << 20)));
+  CHECK(!x.compatible(basic_bloom_filter(make_hasher(3), 1 << 19)));
+  CHECK(!x.compatible(basic_bloom_filter(make_hasher(3), 1 << 20, true)));
+  basic_bloom_filter other(make_hasher(3, 1), 1 << 20);
+  other.add(42);
+  others.push_back(&other);
+  CHECK(!x.merge(other));
+  CHECK(!x.merge(others));
+  CHECK_EQUAL(x.storage().count(), 0u);
+}
+
+TEST(bloom_filter_estimates) {
+  basic_bloom_filter empty(make_hasher(4), 1 << 20);
+  CHECK_EQUAL(empty.estimate_cardinality(), 0.0);
+  CHECK_EQUAL(empty.estimate_fpr(), 0.0);
+  for (auto partition : {false, true}) {
+    basic_bloom_filter x(make_hasher(4), 1 << 20, partition);
+    basic_bloom_filter y(make_hasher(4), 1 << 20, partition);
+    for (size_t i = 0; i < 30000; ++i)
+      x.add(i);
+    for (size_t i = 20000; i < 50000; ++i)
+      y.add(i);
+    auto n = x.estimate_cardinality();
+    CHECK(n > 29400 && n < 30600);
+    // Duplicates do not count.
+    for (size_t i = 0; i < 1000; ++i)
+      x.add(i);
+    CHECK_EQUAL(x.estimate_cardinality(), n);
+    auto u = x.estimate_union(y);
+    CHECK(u > 49000 && u < 51000);
+    auto common = x.estimate_intersection(y);
+    CHECK(common > 9000 && common < 11000);
+    // The estimated rate matches the observed one of a well-filled filter.
+    basic_bloom_filter z(make_hasher(4), 1 << 16, partition);
+    for (size_t i = 0; i < 10000; ++i)
+      z.add(i);
+    size_t positives = 0;
+    for (size_t i = 1000000; i < 1200000; ++i)
+      positives += z.lookup(i);
+    auto observed = positives / 200000.0;
+    auto fpr = z.estimate_fpr();
+    CHECK(observed > fpr * 0.9 && observed < fpr * 1.1);
+  }
+  basic_bloom_filter full(make_hasher(2), 64);
+  for (size_t i = 0; i < 10000; ++i)
+    full.add(i);
+  CHECK(std::isinf(full.estimate_cardinality()));
+  CHECK_EQUAL(full.estimate_fpr(), 1.0);
+}
+
+TEST(bloom_filter_counting_merge) {
+  counting_bloom_filter x(make_hasher(3), 1000, 8);
+  counting_bloom_filter y(make_hasher(3), 1000, 8);
+  for (int i = 0; i < 100; ++i) {
+    x.add(i);
+    y.add(i + 50);
+  }
+  counting_bloom_filter both(make_hasher(3), 1000, 8);
+  REQUIRE(both.merge(x));
+  REQUIRE(both.intersect(y));
+  REQUIRE(x.merge(y));
+  for (int i = 0; i < 150; ++i) {
+    REQUIRE(x.lookup(i) >= (i >= 50 && i < 100 ? 2u : 1u));
+    if (i >= 50 && i < 100)
+      REQUIRE(both.lookup(i) >= 1u);
+  }
+  size_t fps = 0;
+  for (int i = 150; i < 1150; ++i)
+    fps += both.lookup(i) > 0;
+  CHECK(fps < 20);
+  // Filters that map elements differently do not combine.
+  std::vector<std::unique_ptr<counting_bloom_filter>> others;
+  others.emplace_back(new counting_bloom_filter(make_hasher(3), 100, 8));
+  others.emplace_back(new counting_bloom_filter(make_hasher(3), 1000, 4));
+  others.emplace_back(new counting_bloom_filter(make_hasher(3, 1), 1000, 8));
+  others.emplace_back(new counting_bloom_filter(make_hasher(3), 1000, 8, true));
+  others.emplace_back(new counting_bloom_filter(make_hasher(3), 1000, 8,
+                                                false,
+                                                index_mapping::fast_range));
+  auto before = save(x);
+  for (auto& other : others) {
+    CHECK(!x.compatible(*other));
+    CHECK(!x.merge(*other));
+    CHECK(!x.intersect(*other));
+  }
+  CHECK(save(x) == before);
+}
+
 TEST(bloom_filter_spectral_mi) {
   spectral_mi_bloom_filter bf(make_hasher(3), 8, 2);
   bf.add("oh");
@@ -207,11 +1435,91 @@ TEST(bloom_filter_spectral_mi) {
   bf.add("god");
   bf.add("becky");
   bf.add("look");
-  CHECK_EQUAL(bf.lookup("oh"), 2u);
+  CHECK_EQUAL(bf.lookup("oh"), 3u); // FP, same cells as "god".
   CHECK_EQUAL(bf.lookup("my"), 1u);
-  CHECK_EQUAL(bf.lookup("god"), 1u);
+  CHECK_EQUAL(bf.lookup("god"), 3u); // FP, same cells as "oh".
   CHECK_EQUAL(bf.lookup("becky"), 1u);
-  CHECK_EQUAL(bf.lookup("look"), 2u); // FP, same cells as "god".
+  CHECK_EQUAL(bf.lookup("look"), 1u);
+}
+
+TEST(count_min_sketch) {
+  // A skewed stream: key i occurs 2000 / (i + 1) times, in rounds.
+  size_t const n = 2000;
+  std::map<uint64_t, size_t> truth;
+  std::vector<uint64_t> stream;
+  for (size_t round = 0; round < n; ++round)
+    for (uint64_t i = 0; i < n && (i + 1) * round < n; ++i)
+      stream.push_back(i);
+  for (auto x : stream)
+    ++truth[x];
+  auto key = [](uint64_t x) {
+    return std::string(reinterpret_cast<char const*>(&x), sizeof(x));
+  };
+  count_min_sketch cms(0.001, 0.01, 10);
+  CHECK_EQUAL(cms.rows(), 5u);
+  CHECK_EQUAL(cms.cells(), 2719u);
+  for (auto x : stream)
+    cms.add(x);
+  CHECK_EQUAL(cms.total(), stream.size());
+  // Estimates never fall short, and exceed the truth by at most 0.1% of the
+  // stream.
+  for (auto& p : truth) {
+    REQUIRE(cms.lookup(p.first) >= p.second);
+    CHECK(cms.lookup(p.first) <= p.second + stream.size() / 1000);
+  }
+  auto top = cms.heavy_hitters();
+  REQUIRE_EQUAL(top.size(), 10u);
+  for (uint64_t i = 0; i < 10; ++i) {
+    CHECK(top[i].key == key(i));
+    CHECK_EQUAL(top[i].count, cms.lookup(i));
+  }
+  // Batches update the same counters and heavy hitters.
+  std::vector<object> objects;
+  for (auto& x : stream)
+    objects.push_back(wrap(x));
+  count_min_sketch batched(0.001, 0.01, 10);
+  batched.add_many(objects);
+  CHECK(save(batched) == save(cms));
+  std::vector<size_t> counts(objects.size());
+  cms.lookup_many(objects, counts);
+  for (size_t i = 0; i < objects.size(); ++i)
+    REQUIRE_EQUAL(counts[i], cms.lookup(stream[i]));
+  // Merging two halves of the stream finds the same heavy hitters.
+  count_min_sketch x(0.001, 0.01, 10);
+  count_min_sketch y(0.001, 0.01, 10);
+  for (size_t i = 0; i < stream.size(); ++i)
+    (i % 2 == 0 ? x : y).insert(stream[i]);
+  REQUIRE(x.merge(y));
+  CHECK_EQUAL(x.total(), stream.size());
+  top = x.heavy_hitters();
+  REQUIRE_EQUAL(top.size(), 10u);
+  for (uint64_t i = 0; i < 10; ++i)
+    CHECK(top[i].key == key(i));
+  for (auto& p : truth)
+    REQUIRE(x.lookup(p.first) >= p.second);
+  count_min_sketch other_seed(0.001, 0.01, 10, 1);
+  CHECK(!x.merge(other_seed));
+  check_round_trip(cms, [&](count_min_sketch const& copy) {
+    CHECK_EQUAL(copy.total(), cms.total());
+    CHECK_EQUAL(copy.heavy_hitters().size(), 10u);
+    CHECK(copy.heavy_hitters()[0].key == key(0));
+  });
+  // Weighted insertions and saturating counters.
+  count_min_sketch narrow(make_hasher(3), 64, 4, 2);
+  narrow.insert("foo", 3);
+  narrow.insert("bar", 10);
+  narrow.insert("bar", 10);
+  narrow.insert("baz");
+  CHECK_EQUAL(narrow.lookup("foo"), 3u);
+  CHECK_EQUAL(narrow.lookup("bar"), 15u);
+  top = narrow.heavy_hitters();
+  REQUIRE_EQUAL(top.size(), 2u);
+  CHECK(top[0].key == std::string("bar", 4));
+  CHECK(top[1].key == std::string("foo", 4));
+  narrow.clear();
+  CHECK_EQUAL(narrow.lookup("bar"), 0u);
+  CHECK_EQUAL(narrow.total(), 0u);
+  CHECK(narrow.heavy_hitters().empty());
 }
 
 TEST(bloom_filter_spectral_rm) {
@@ -303,10 +1611,10 @@ TEST(bloom_filter_stable) {
   bf.add("black fish");
   bf.add("grey fish");
   bf.add("jelly fish");
-  CHECK_EQUAL(bf.lookup("one fish"), 0u);
+  CHECK_EQUAL(bf.lookup("one fish"), 1u);
   CHECK_EQUAL(bf.lookup("two fish"), 2u);
-  CHECK_EQUAL(bf.lookup("red fish"), 3u);
-  CHECK_EQUAL(bf.lookup("blue fish"), 3u);
+  CHECK_EQUAL(bf.lookup("red fish"), 2u);
+  CHECK_EQUAL(bf.lookup("blue fish"), 1u);
 }
 
 TEST(bloom_filter_a2) {
@@ -322,3 +1630,186 @@ TEST(bloom_filter_a2) {
   CHECK_EQUAL(bf.lookup("baz"), 1u);
   CHECK_EQUAL(bf.lookup("qux"), 1u);
 }
+
+TEST(container_crc32c) {
+  auto features = cpu;
+  for (auto sse42 : {false, true}) {
+    cpu.sse42 = sse42 && features.sse42;
+    CHECK_EQUAL(crc32c("123456789", 9), 0xe3069283u);
+    // Checksumming in pieces gives the same result as in one go.
+    std::string data(1000, 'x');
+    for (size_t i = 0; i < data.size(); ++i)
+      data[i] = static_cast<char>(i * 7);
+    auto crc = crc32c(data.data() + 1, 500);
+    CHECK_EQUAL(crc32c(data.data() + 501, 499, crc),
+                crc32c(data.data() + 1, 999));
+  }
+  cpu = features;
+}
+
+TEST(container_round_trip) {
+  std::vector<std::unique_ptr<bloom_filter>> filters;
+  filters.emplace_back(new basic_bloom_filter(make_hasher(3), 999, true,
+                                              index_mapping::fast_range));
+  filters.emplace_back(new counting_bloom_filter(make_hasher(3), 500, 4));
+  filters.emplace_back(new spectral_mi_bloom_filter(make_hasher(3), 500, 5));
+  filters.emplace_back(new spectral_rm_bloom_filter(
+    make_hasher(3), 500, 4, make_hasher(2, 1), 300, 4));
+  filters.emplace_back(new stable_bloom_filter(make_hasher(3), 500, 2, 2));
+  filters.emplace_back(new blocked_bloom_filter(make_hasher(3), 4096));
+  filters.emplace_back(new split_block_bloom_filter(make_hasher(8), 4096));
+  filters.emplace_back(new a2_bloom_filter(3, 1000, 50));
+  filters.emplace_back(new bitwise_bloom_filter(3, 1000));
+  for (auto& bf : filters) {
+    for (int i = 0; i < 100; ++i)
+      bf->add(i % 60);
+    auto buf = save(*bf);
+    std::unique_ptr<bloom_filter> copy;
+    REQUIRE_EQUAL(load(buf.data(), buf.size(), copy), 0);
+    REQUIRE(copy != nullptr);
+    CHECK(typeid(*copy) == typeid(*bf));
+    for (int i = 0; i < 200; ++i)
+      REQUIRE_EQUAL(copy->lookup(i), bf->lookup(i));
+    // Writing the loaded filter reproduces the container.
+    CHECK(save(*copy) == buf);
+    // Streams carry the same container.
+    std::stringstream ss;
+    REQUIRE(bf->save(ss));
+    CHECK(ss.str() == std::string(buf.begin(), buf.end()));
+    std::unique_ptr<bloom_filter> streamed;
+    REQUIRE_EQUAL(load(ss, streamed), 0);
+    for (int i = 0; i < 200; ++i)
+      REQUIRE_EQUAL(streamed->lookup(i), bf->lookup(i));
+  }
+}
+
+TEST(container_streaming) {
+  basic_bloom_filter bf(make_hasher(3), 100000);
+  for (int i = 0; i < 1000; ++i)
+    bf.add(i);
+  auto buf = save(bf);
+  // Write to a file descriptor.
+  char path[] = "/tmp/bf-test-XXXXXX";
+  auto fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  REQUIRE(bf.write_to(fd));
+  close(fd);
+  std::ifstream in(path, std::ios::binary);
+  unlink(path);
+  std::string contents((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+  CHECK(contents == std::string(buf.begin(), buf.end()));
+  // Read into an existing filter.
+  std::stringstream ss(contents);
+  basic_bloom_filter copy;
+  REQUIRE_EQUAL(copy.load(ss), 0);
+  CHECK_EQUAL(copy.storage(), bf.storage());
+  // The filter type must match.
+  ss.clear();
+  ss.seekg(0);
+  counting_bloom_filter counting;
+  CHECK(counting.load(ss) != 0);
+  // Truncated and corrupted streams fail.
+  std::stringstream truncated(contents.substr(0, contents.size() - 100));
+  CHECK(copy.load(truncated) != 0);
+  auto corrupt = contents;
+  corrupt[corrupt.size() - 64] ^= 1;
+  std::stringstream corrupted(corrupt);
+  CHECK(copy.load(corrupted) != 0);
+}
+
+TEST(container_validation) {
+  basic_bloom_filter bf(make_hasher(3), 1000);
+  bf.add("foo");
+  auto buf = save(bf);
+  REQUIRE_EQUAL(buf.size() % 64, 0u);
+  std::unique_ptr<bloom_filter> copy;
+  container_reader r;
+  REQUIRE_EQUAL(r.open(buf.data(), buf.size()), 0);
+  CHECK(r.type() == filter_type::basic);
+  CHECK_EQUAL(r.open(buf.data(), buf.size() - 64), container_reader::truncated);
+  auto corrupt = buf;
+  corrupt[0] = 'X';
+  CHECK_EQUAL(load(corrupt.data(), corrupt.size(), copy),
+              container_reader::bad_magic);
+  corrupt = buf;
+  corrupt[70] ^= 1;
+  CHECK_EQUAL(load(corrupt.data(), corrupt.size(), copy),
+              container_reader::bad_header_checksum);
+  // Flip a bit in the payload of the last section, the bit vector.
+  corrupt = buf;
+  corrupt[buf.size() - 64] ^= 1;
+  CHECK_EQUAL(load(corrupt.data(), corrupt.size(), copy),
+              container_reader::bad_section_checksum);
+  CHECK_EQUAL(load(corrupt.data(), corrupt.size(), copy, nullptr, false), 0);
+  CHECK(copy != nullptr);
+  // A filter of another type rejects the sections.
+  REQUIRE_EQUAL(r.open(buf.data(), buf.size()), 0);
+  counting_bloom_filter counting;
+  CHECK(counting.read(r) != 0);
+  // A hasher section shorter than its hasher fails instead of reading on.
+  struct truncated_hasher : ap_hasher
+  {
+    char* serialize(char* buf) override
+    {
+      *reinterpret_cast<uint32_t*>(buf) = htobe32(2);
+      return buf + sizeof(uint32_t);
+    }
+    unsigned int serializedSize() const override
+    {
+      return sizeof(uint32_t);
+    }
+  } truncated;
+  container_writer w;
+  w.hasher(truncated);
+  std::vector<char> short_buf(w.size());
+  w.write(short_buf.data());
+  std::shared_ptr<base_hasher> h;
+  REQUIRE_EQUAL(r.open(short_buf.data(), short_buf.size()), 0);
+  CHECK(r.hasher(h) != 0);
+  // A partitioned filter whose bits k does not divide fails to load and
+  // leaves the filter as it was.
+  auto hasher = make_hasher(3);
+  bitvector odd(1000);
+  container_writer partitioned;
+  partitioned.parameters(filter_type::basic, {1, 0});
+  partitioned.hasher(*hasher);
+  odd.write(partitioned);
+  std::vector<char> odd_buf(partitioned.size());
+  partitioned.write(odd_buf.data());
+  REQUIRE_EQUAL(r.open(odd_buf.data(), odd_buf.size()), 0);
+  CHECK(bf.read(r) != 0);
+  CHECK(save(bf) == buf);
+  // A bitwise filter reads no more levels than follow, and at least one.
+  for (uint64_t levels : {0ull, 1ull << 40}) {
+    container_writer bitwise;
+    bitwise.parameters(filter_type::bitwise, {3, 1000, 0, levels});
+    std::vector<char> bitwise_buf(bitwise.size());
+    bitwise.write(bitwise_buf.data());
+    REQUIRE_EQUAL(r.open(bitwise_buf.data(), bitwise_buf.size()), 0);
+    bitwise_bloom_filter bw(3, 1000);
+    CHECK(bw.read(r) != 0);
+  }
+}
+
+TEST(container_mapped) {
+  basic_bloom_filter bf(make_hasher(3), 100000);
+  for (int i = 0; i < 1000; ++i)
+    bf.add(i);
+  auto buf = save(bf);
+  char path[] = "/tmp/bf-test-XXXXXX";
+  auto fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  REQUIRE(write(fd, buf.data(), buf.size()) == ssize_t(buf.size()));
+  close(fd);
+  auto file = mapped_file::open(path);
+  unlink(path);
+  REQUIRE(file != nullptr);
+  std::unique_ptr<bloom_filter> mapped;
+  REQUIRE_EQUAL(load(file->data(), file->size(), mapped, file), 0);
+  auto& basic = static_cast<basic_bloom_filter&>(*mapped);
+  // The payload is aligned, so the filter uses the mapping in place.
+  CHECK(basic.storage().is_view());
+  for (int i = 0; i < 2000; ++i)
+    REQUIRE_EQUAL(mapped->lookup(i), bf.lookup(i));
+}